@@ -7,10 +7,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 
 #define FUSE_USE_VERSION 31
 #include <fuse.h>
 
+#include "fat16_log.h"
+
 /* Unit size */
 #define PHYSICAL_SECTOR_SIZE 512        // 每个物理扇区的大小
 #define MAX_LOGICAL_SECTOR_SIZE 4096    // 逻辑扇区的最大大小
@@ -44,7 +47,7 @@
 
 #define MAX_NAME_LEN 512
 
-typedef uint16_t cluster_t;
+typedef uint32_t cluster_t;        // FAT16 与 FAT32 共用，FAT16 的表项读出后换算到 FAT32 的取值
 typedef uint64_t sector_t;
 typedef uint8_t attr_t;
 
@@ -53,12 +56,17 @@ typedef uint8_t BYTE;
 typedef uint16_t WORD;
 typedef uint32_t DWORD;
 
-// 簇号（FAT表项）
-#define CLUSTER_FREE        0x0000u         // 未分配的簇号
-#define CLUSTER_MIN         0x0002u         // 第一个代表簇的簇号
-#define CLUSTER_MAX         0xFFEFu         // 最后一个代表簇的簇号
-#define CLUSTER_END         0xFFFFu         // 文件结束的簇号
-#define CLUSTER_END_BOUND   0xFFF8u         // 文件结束簇号界限，大于等于该数的簇号都被视为文件结束
+// 簇号（FAT表项），按 FAT32 的 28 位取值，见 fat_entry_decode
+#define CLUSTER_FREE        0x00000000u     // 未分配的簇号
+#define CLUSTER_MIN         0x00000002u     // 第一个代表簇的簇号
+#define CLUSTER_MAX         0x0FFFFFF6u     // 最后一个代表簇的簇号
+#define CLUSTER_BAD         0x0FFFFFF7u     // 坏簇
+#define CLUSTER_END         0x0FFFFFFFu     // 文件结束的簇号
+#define CLUSTER_END_BOUND   0x0FFFFFF8u     // 文件结束簇号界限，大于等于该数的簇号都被视为文件结束
+#define FAT32_ENTRY_MASK    0x0FFFFFFFu     // FAT32 表项只用低 28 位，高 4 位保留
+
+#define FAT16_CLUSTER_MAX   0xFFEFu         // FAT16 能表示的最大簇号
+#define FAT16_MAX_CLUSTERS  65524u          // 簇数不少于 65525 的卷按规范是 FAT32
 
 #define DEFAULT_IMAGE       "fat16.img"
 
@@ -92,6 +100,43 @@ typedef struct {
 } __attribute__ ((packed, aligned(__alignof__(DWORD)))) BPB_BS;
 static_assert(sizeof(BPB_BS) == PHYSICAL_SECTOR_SIZE, "Wrong BPB size");
 
+/* FAT32 BPB Structure，前 36 字节与 FAT16 相同；BPB_FATSz16 为 0 的卷就是 FAT32 */
+typedef struct {
+    BYTE BPB_Common[36];
+    DWORD BPB_FATSz32;
+    WORD BPB_ExtFlags;
+    WORD BPB_FSVer;
+    DWORD BPB_RootClus;         // 根目录的第一个簇
+    WORD BPB_FSInfo;            // FSInfo 所在的扇区
+    WORD BPB_BkBootSec;         // 引导扇区备份所在的扇区，0 表示没有备份
+    BYTE BPB_Reserved[12];
+    BYTE BS_DrvNum;
+    BYTE BS_Reserved1;
+    BYTE BS_BootSig;
+    DWORD BS_VollID;
+    BYTE BS_VollLab[11];
+    BYTE BS_FilSysType[8];
+    BYTE Reserved2[420];
+    WORD Signature_word;
+} __attribute__ ((packed, aligned(__alignof__(DWORD)))) BPB32_BS;
+static_assert(sizeof(BPB32_BS) == PHYSICAL_SECTOR_SIZE, "Wrong BPB32 size");
+
+/* FAT32 FSInfo 扇区，保存空闲簇数和下一个空闲簇的提示，两者都可能不准确 */
+#define FSINFO_LEAD_SIG     0x41615252u
+#define FSINFO_STRUC_SIG    0x61417272u
+#define FSINFO_TRAIL_SIG    0xAA550000u
+#define FSINFO_UNKNOWN      0xFFFFFFFFu     // 空闲簇数或提示未知
+typedef struct {
+    DWORD FSI_LeadSig;
+    BYTE FSI_Reserved1[480];
+    DWORD FSI_StrucSig;
+    DWORD FSI_Free_Count;
+    DWORD FSI_Nxt_Free;
+    BYTE FSI_Reserved2[12];
+    DWORD FSI_TrailSig;
+} __attribute__ ((packed, aligned(__alignof__(DWORD)))) FSINFO;
+static_assert(sizeof(FSINFO) == PHYSICAL_SECTOR_SIZE, "Wrong FSInfo size");
+
 /* FAT Directory Structure */
 typedef struct {
     BYTE DIR_Name[11];
@@ -109,6 +154,39 @@ typedef struct {
 } __attribute__ ((packed, aligned(__alignof__(DWORD)))) DIR_ENTRY;
 static_assert(sizeof(DIR_ENTRY) == DIR_ENTRY_SIZE, "Wrong DIR_ENTRY size");
 
+/**
+ * @brief 把磁盘上的 FAT 表项换算为 cluster_t：FAT16 的 0xFFF8~0xFFFF 换算为 CLUSTER_END，
+ *        0xFFF7 换算为 CLUSTER_BAD；FAT32 去掉保留的高 4 位。
+ */
+static inline cluster_t fat_entry_decode(uint32_t raw, int fat_bits) {
+    if(fat_bits == 32) {
+        return raw & FAT32_ENTRY_MASK;
+    }
+    if(raw >= 0xFFF8u) {
+        return CLUSTER_END;
+    }
+    return raw == 0xFFF7u ? CLUSTER_BAD : raw;
+}
+
+/**
+ * @brief fat_entry_decode 的逆变换。FAT32 的高 4 位由调用者保留。
+ */
+static inline uint32_t fat_entry_encode(cluster_t clus, int fat_bits) {
+    return fat_bits == 32 ? (clus & FAT32_ENTRY_MASK) : (clus & 0xFFFFu);
+}
+
+// 目录项中的第一个簇号，FAT32 的高 16 位在 DIR_FstClusHI 中（FAT16 为 0）
+static inline cluster_t dir_entry_cluster(const DIR_ENTRY* dir) {
+    return ((cluster_t)dir->DIR_FstClusHI << 16) | dir->DIR_FstClusLO;
+}
+
+static inline void dir_entry_set_cluster(DIR_ENTRY* dir, cluster_t clus) {
+    dir->DIR_FstClusHI = clus >> 16;
+    dir->DIR_FstClusLO = clus & 0xFFFFu;
+}
+
+int to_shortname(const char* name, size_t len, char* res);
+
 enum FindResult {
     FIND_EXIST = 0,
     FIND_EMPTY = 1,
@@ -117,5 +195,121 @@ enum FindResult {
 
 int sector_read(sector_t sec_num, void *buffer);
 int sector_write(sector_t sec_num, const void *buffer);
+int sectors_read(sector_t sec, size_t count, void* buffer);          // 连续多个扇区，失败返回 -EIO
+int sectors_write(sector_t sec, size_t count, const void* buffer);
+void init_disk(const char* path, uint64_t seek_time_us);
+void init_disk_striped(const char* const* paths, size_t count, size_t stripe_sectors, uint64_t seek_time_us);
+int disk_set_dsync(bool dsync);
+int disk_flush(void);
+int disk_stat(struct stat* st);
+
+// 模拟磁盘的时间模型，见 fat16_fixed.c
+typedef struct {
+    const char* model;          // linear / curve / rotational / ssd
+    uint64_t seek_time_us;      // 每个磁道的寻道时间
+    uint64_t settle_time_us;    // 每次寻道的稳定时间（curve / rotational）
+    uint64_t seek_knee;         // 寻道曲线由 sqrt 变为线性的磁道数（curve / rotational）
+    uint64_t rpm;               // 转速（rotational）
+    uint64_t ssd_latency_us;    // 每次访问的延迟（ssd）
+    uint64_t ssd_channels;      // 可并行的通道数（ssd）
+} DiskTiming;
+int disk_set_timing(const DiskTiming* timing);
+void disk_set_layout(sector_t fat_sec, sector_t root_sec, sector_t data_sec);
+int disk_enable_heatmap(const char* path);
+char* disk_heatmap_render(size_t* len);
+void disk_heatmap_dump(void);
+uint64_t disk_seek_estimate(sector_t from, sector_t to);
+
+extern struct fuse_operations fat16_oper;
+
+// FUSE 操作的编号，用于统计和跟踪
+enum FuseOp {
+    OP_OTHER = 0,               // 不在任何 FUSE 操作中的 I/O
+    OP_INIT,
+    OP_DESTROY,
+    OP_GETATTR,
+    OP_READDIR,
+    OP_READ,
+    OP_MKNOD,
+    OP_UNLINK,
+    OP_UTIMENS,
+    OP_MKDIR,
+    OP_RMDIR,
+    OP_WRITE,
+    OP_TRUNCATE,
+    OP_OPEN,
+    OP_RELEASE,
+    OP_RENAME,
+    OP_COPY_FILE_RANGE,
+    OP_IOCTL,
+    OP_COUNT
+};
+extern const char* const OP_NAMES[OP_COUNT];
+
+// 操作统计（fat16_stats.c），通过虚拟文件 /.stats 查看
+void stats_disk_io(bool write, long tracks);
+void stats_wrap_operations(struct fuse_operations* ops);
+char* stats_render(size_t* len);
+void stats_reset(void);
+
+// 簇链（simple_fat16.c）
+bool is_cluster_inuse(cluster_t clus);
+int free_clusters(cluster_t clus);
+long free_clusters_batch(cluster_t* clus, size_t max);
+
+// 向量化扫描（fat16_simd.c）
+#define DIR_ENTRIES_PER_SECTOR (PHYSICAL_SECTOR_SIZE / DIR_ENTRY_SIZE)
+typedef struct {
+    uint32_t free;              // DIR_Name[0] == NAME_FREE
+    uint32_t deleted;           // DIR_Name[0] == NAME_DELETED
+    uint32_t lfn;               // DIR_Attr == ATTR_LFN
+    uint32_t match;             // DIR_Name 与要找的 8.3 文件名相同
+} DirScanMask;
+void dir_scan(const void* sector, const char* name, DirScanMask* mask);
+void fat_free_bitmap(const void* fat, size_t n, int bits, uint64_t* bitmap);
+size_t fat_count_free(const void* fat, size_t n, int bits);
+size_t fat_find_free_run(const void* fat, size_t n, int bits, size_t want, size_t* carry);
+const char* simd_variant(void);
+
+// 第一个 FAT 表和目录扇区的缓存，后台加载（fat16_fatcache.c）
+int fatcache_open(sector_t first, size_t sectors, int fat_bits, size_t entries);
+void fatcache_close(void);
+int fatcache_set_warm_file(const char* path);
+long fatcache_free_count(void);
+int dir_sector_read(sector_t sec, void* buffer);
+bool fatcache_lookup(sector_t sec, size_t count, void* buffer);     // 由模拟磁盘在持有磁盘的锁时调用
+void fatcache_fill(sector_t sec, size_t count, const void* buffer);
+
+// 文件布局查询：对挂载点下打开的文件调用 ioctl(fd, FAT16_IOC_EXTENTS, map)，见 fat16_ioctl 和 fat16_extents.c
+#define FAT16_EXTENTS_MAX 256       // 每次调用最多返回的 extent 数
+
+typedef struct {
+    uint64_t offset;            // 在文件中的字节偏移
+    uint64_t sector;            // 起始扇区
+    uint64_t track;             // 起始扇区所在的磁道
+    uint32_t cluster;           // 起始簇号
+    uint32_t clusters;          // 连续的簇数
+    uint64_t seek_ns;           // 读完上一个 extent 后移到这里的估计时间，第一个 extent 为 0
+} Fat16Extent;
+
+typedef struct {
+    uint32_t start;             // 输入：从第几个 extent 开始返回
+    uint32_t count;             // 输出：本次返回的 extent 数
+    uint32_t total;             // 输出：文件的 extent 总数
+    uint32_t cluster_size;      // 输出：簇的字节数
+    uint64_t seek_ns;           // 输出：顺序读取整个文件时 extent 之间的估计时间之和
+    Fat16Extent extents[FAT16_EXTENTS_MAX];
+} Fat16ExtentMap;
+#define FAT16_IOC_EXTENTS _IOWR('F', 0x16, Fat16ExtentMap)
+
+// 后台回收被删除文件的簇链（fat16_reclaim.c）
+int reclaim_chain(cluster_t clus);
+long reclaim_drain(void);
+void reclaim_wrap_operations(struct fuse_operations* ops);
+
+// 回调之间的读写锁（fat16_lock.c）
+void fs_lock_write(void);
+void fs_unlock(void);
+void lock_wrap_operations(struct fuse_operations* ops);
 
 #endif
\ No newline at end of file
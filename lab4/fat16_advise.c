@@ -0,0 +1,410 @@
+/**
+ * fat16_advise: 按镜像中实际的文件分布统计簇内浪费的空间（slack），估算换用其他簇大小的效果，
+ * 并给出 fat16_mkfs 的参数建议。只读取镜像，不做任何修改。
+ *
+ * 用法: fat16_advise [-v] [-w 浪费上限百分比] <镜像>
+ *   -v  列出每个文件的大小、簇数和 slack
+ *   -w  推荐簇大小时允许浪费的空间占文件数据的比例上限，默认 10
+ *
+ * 输出分三部分：
+ *   1. 按文件大小分组的文件数、数据量、实际分配的空间和 slack。实际分配按簇链长度计算，
+ *      簇链比文件大小需要的更长时（例如写入时多预留的簇），多出的簇也算作 slack。
+ *   2. 用 512B ~ 8KB 的簇重新格式化同一个卷并放入同样的文件时，需要的簇数、浪费的字节、
+ *      extent 数（顺序读取所有文件的寻道次数）以及 FAT 的类型和大小。extent 数的估计方法：
+ *      每个非空文件至少一个 extent，簇链中相邻两个簇不连续的比例沿用镜像中现在观测到的比例。
+ *   3. 推荐的簇大小：浪费不超过上限的最大簇（簇越大，簇链越短、FAT 越小、extent 越少），
+ *      以及对应的 fat16_mkfs 命令。命令从 <source-dir> 导入文件创建新镜像 <new-image>，
+ *      不会覆盖被分析的镜像。
+ *
+ * 目录也按其簇链统计，所需空间为其中已使用的目录项（含已删除的项）。FAT16 的根目录在固定区域，不计入。
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "fat16_image.h"
+
+#define MIN_CLUSTER_SIZE    512u
+#define MAX_CLUSTER_SIZE    8192u
+#define WHATIF_COUNT        5           // 512B, 1KB, 2KB, 4KB, 8KB
+
+typedef struct {
+    uint32_t size;              // 文件大小；目录为已使用的目录项所占的字节数
+    uint32_t clusters;          // 簇链长度
+    bool is_dir;
+} Item;
+
+typedef struct {
+    const char* name;
+    uint64_t limit;             // 该组文件大小的上限（含）
+    size_t files;
+    uint64_t bytes;
+    uint64_t allocated;
+} Bucket;
+
+static Bucket buckets[] = {
+    { "0",          0 },
+    { "1-512",      512 },
+    { "513-1K",     1024 },
+    { "1K-2K",      2048 },
+    { "2K-4K",      4096 },
+    { "4K-8K",      8192 },
+    { "8K-64K",     65536 },
+    { "64K-1M",     1048576 },
+    { ">1M",        UINT64_MAX },
+};
+#define BUCKET_COUNT (sizeof(buckets) / sizeof(buckets[0]))
+
+typedef struct {
+    Fat16Image img;
+    bool verbose;
+
+    Item* items;
+    size_t nitems;
+    size_t capacity;
+
+    uint8_t* seen;              // 已经走过的簇，用于发现环和交叉链接
+    uint64_t links;             // 簇链中相邻两个簇的对数
+    uint64_t breaks;            // 其中不连续的对数
+} Advisor;
+
+static Advisor a;
+
+static void add_item(uint32_t size, uint32_t clusters, bool is_dir, const char* path) {
+    if(a.nitems == a.capacity) {
+        a.capacity = a.capacity ? a.capacity * 2 : 256;
+        a.items = realloc(a.items, a.capacity * sizeof(Item));
+    }
+    a.items[a.nitems++] = (Item){ size, clusters, is_dir };
+    if(a.verbose) {
+        uint64_t allocated = (uint64_t)clusters * a.img.cluster_size;
+        printf("  %-40s %10u bytes %6u clusters %10lu slack%s\n", path, size, clusters,
+               allocated > size ? allocated - size : 0, is_dir ? " (dir)" : "");
+    }
+}
+
+/**
+ * @brief 沿 FAT 表走 first 开始的簇链，统计长度和不连续的次数。
+ *        clusters 不为 NULL 时存入链上的簇号（调用者负责释放）。
+ */
+static uint32_t walk_chain(cluster_t first, cluster_t** clusters) {
+    Fat16Image* img = &a.img;
+    uint32_t n = 0, cap = 0;
+    if(clusters != NULL) {
+        *clusters = NULL;
+    }
+    for(cluster_t clus = first; image_cluster_valid(img, clus) && !a.seen[clus]; clus = img->fat[clus]) {
+        a.seen[clus] = 1;
+        if(clusters != NULL) {
+            if(n == cap) {
+                cap = cap ? cap * 2 : 16;
+                *clusters = realloc(*clusters, cap * sizeof(cluster_t));
+            }
+            (*clusters)[n] = clus;
+        }
+        cluster_t next = img->fat[clus];
+        if(image_cluster_valid(img, next)) {
+            a.links++;
+            a.breaks += next != clus + 1;
+        }
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief 统计目录 first 中的所有文件，并递归统计子目录。first 为 0 表示 FAT16 的根目录。
+ */
+static int scan_dir(cluster_t first, const char* path) {
+    Fat16Image* img = &a.img;
+    char* buffer;
+    size_t size;
+    uint32_t nclus = 0;
+    if(first == 0) {
+        size = (size_t)img->root_sectors * img->sector_size;
+        buffer = malloc(size);
+        int ret = image_read(img, img->root_sec, img->root_sectors, buffer);
+        if(ret < 0) {
+            free(buffer);
+            return ret;
+        }
+    } else {
+        cluster_t* clusters;
+        nclus = walk_chain(first, &clusters);
+        size = (size_t)nclus * img->cluster_size;
+        buffer = malloc(size);
+        for(uint32_t i = 0; i < nclus; i++) {
+            int ret = image_read(img, image_cluster_sector(img, clusters[i]), img->sec_per_clus,
+                                 buffer + (size_t)i * img->cluster_size);
+            if(ret < 0) {
+                free(clusters);
+                free(buffer);
+                return ret;
+            }
+        }
+        free(clusters);
+    }
+
+    int ret = 0;
+    size_t used = 0;
+    char name[FAT_NAME_LEN + 2];
+    for(size_t off = 0; off < size && ret == 0; off += DIR_ENTRY_SIZE) {
+        const DIR_ENTRY* dir = (const DIR_ENTRY*)(buffer + off);
+        if(dir->DIR_Name[0] == NAME_FREE) {
+            break;
+        }
+        used = off + DIR_ENTRY_SIZE;
+        if(dir->DIR_Name[0] == NAME_DELETED || dir->DIR_Attr == ATTR_LFN
+                || (dir->DIR_Attr & ATTR_VOLUME) != 0 || dir->DIR_Name[0] == '.') {
+            continue;
+        }
+        fat_name_to_str(dir->DIR_Name, name);
+        char* child = join_path(path, name);
+        cluster_t clus = dir_entry_cluster(dir);
+        if((dir->DIR_Attr & ATTR_DIRECTORY) != 0) {
+            if(image_cluster_valid(img, clus) && !a.seen[clus]) {
+                ret = scan_dir(clus, child);
+            }
+        } else {
+            add_item(dir->DIR_FileSize, clus == CLUSTER_FREE ? 0 : walk_chain(clus, NULL), false, child);
+        }
+        free(child);
+    }
+    if(first != 0) {
+        add_item(used, nclus, true, path);
+    }
+    free(buffer);
+    return ret;
+}
+
+static void print_size(uint64_t bytes, int width) {
+    const char* units[] = { "B", "K", "M", "G", "T" };
+    double v = bytes;
+    size_t u = 0;
+    while(v >= 1024 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        v /= 1024;
+        u++;
+    }
+    printf(u == 0 ? "%*.0f%s" : "%*.1f%s", width, v, units[u]);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void report_buckets(void) {
+    Fat16Image* img = &a.img;
+    uint64_t excess = 0;            // 超出文件大小所需的簇
+    size_t excess_files = 0;
+    for(size_t i = 0; i < a.nitems; i++) {
+        const Item* it = &a.items[i];
+        if(it->is_dir) {
+            continue;
+        }
+        Bucket* b = buckets;
+        while(it->size > b->limit) {
+            b++;
+        }
+        b->files++;
+        b->bytes += it->size;
+        b->allocated += (uint64_t)it->clusters * img->cluster_size;
+        uint32_t need = (it->size + img->cluster_size - 1) / img->cluster_size;
+        if(it->clusters > need) {
+            excess += it->clusters - need;
+            excess_files++;
+        }
+    }
+
+    printf("\nslack by file size (cluster %u bytes)\n", img->cluster_size);
+    printf("%-8s %8s %10s %10s %10s %7s\n", "size", "files", "data", "allocated", "slack", "slack%");
+    Bucket total = { "total" };
+    for(size_t i = 0; i < BUCKET_COUNT; i++) {
+        total.files += buckets[i].files;
+        total.bytes += buckets[i].bytes;
+        total.allocated += buckets[i].allocated;
+    }
+    for(size_t i = 0; i <= BUCKET_COUNT; i++) {
+        const Bucket* b = i < BUCKET_COUNT ? &buckets[i] : &total;
+        if(b->files == 0 && b != &total) {
+            continue;
+        }
+        printf("%-8s %8zu ", b->name, b->files);
+        print_size(b->bytes, 9);
+        printf(" ");
+        print_size(b->allocated, 9);
+        printf(" ");
+        print_size(b->allocated - b->bytes, 9);
+        printf(" %6.1f%%\n", percent(b->allocated - b->bytes, b->allocated));
+    }
+    if(excess > 0) {
+        printf("%lu clusters in %zu files are beyond what their size needs\n", excess, excess_files);
+    }
+}
+
+typedef struct {
+    uint32_t cluster_size;
+    uint64_t clusters;          // 放入所有文件需要的簇数
+    uint64_t wasted;
+    double extents;
+    int fat_bits;
+    uint32_t volume_clusters;   // 该簇大小下卷的簇数
+    uint32_t sec_per_fat;
+    uint32_t reserved;
+    uint32_t root_entries;
+} WhatIf;
+
+/**
+ * @brief 与 fat16_mkfs 相同的方法计算该簇大小下的卷布局。簇数超过 FAT16 上限时按 FAT32 计算。
+ */
+static void layout(WhatIf* w) {
+    Fat16Image* img = &a.img;
+    uint32_t spc = w->cluster_size / img->sector_size;
+    for(w->fat_bits = img->fat_bits; ; w->fat_bits = 32) {
+        bool fat32 = w->fat_bits == 32;
+        // FAT16 沿用现在的保留区和根目录大小；FAT32 使用 fat16_mkfs 的默认值
+        w->reserved = fat32 && img->fat_bits != 32 ? 32 : img->reserved;
+        w->root_entries = fat32 ? 0 : img->dir_entries;
+        uint32_t root_sectors = (w->root_entries * DIR_ENTRY_SIZE + img->sector_size - 1) / img->sector_size;
+        uint32_t sec_per_fat = 1;
+        uint32_t clusters = 0;
+        while(true) {
+            uint64_t meta_sectors = w->reserved + (uint64_t)img->fats * sec_per_fat + root_sectors;
+            clusters = meta_sectors < img->sectors ? (img->sectors - meta_sectors) / spc : 0;
+            uint32_t need = ((uint64_t)(clusters + 2) * (w->fat_bits / 8) + img->sector_size - 1) / img->sector_size;
+            if(need <= sec_per_fat) {
+                break;
+            }
+            sec_per_fat = need;
+        }
+        w->volume_clusters = clusters;
+        w->sec_per_fat = sec_per_fat;
+        if(fat32 || clusters <= FAT16_MAX_CLUSTERS) {
+            return;
+        }
+    }
+}
+
+static void simulate(WhatIf* w, double break_ratio) {
+    w->clusters = 0;
+    w->wasted = 0;
+    w->extents = 0;
+    for(size_t i = 0; i < a.nitems; i++) {
+        const Item* it = &a.items[i];
+        uint64_t n = (it->size + w->cluster_size - 1) / w->cluster_size;
+        if(it->is_dir && n == 0) {
+            n = 1;      // 目录至少有一个簇
+        }
+        w->clusters += n;
+        w->wasted += n * w->cluster_size - it->size;
+        if(n > 0) {
+            w->extents += 1 + (n - 1) * break_ratio;
+        }
+    }
+    layout(w);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-v] [-w max_waste_percent] <image>\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    double max_waste = 10;
+    int opt;
+    while((opt = getopt(argc, argv, "vw:")) != -1) {
+        switch(opt) {
+        case 'v': a.verbose = true; break;
+        case 'w': max_waste = atof(optarg); break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc - 1 || max_waste < 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    Fat16Image* img = &a.img;
+    const char* path = argv[optind];
+    int ret = image_open(img, path, false);
+    if(ret == 0) {
+        ret = image_load_fat(img);
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot load FAT image: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    a.seen = calloc(img->clusters + CLUSTER_MIN, 1);
+    ret = scan_dir(img->root_clus, "/");
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot read directory tree: %s\n", path, strerror(-ret));
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+
+    size_t files = 0, dirs = 0;
+    uint64_t data = 0;
+    for(size_t i = 0; i < a.nitems; i++) {
+        a.items[i].is_dir ? dirs++ : files++;
+        data += a.items[i].is_dir ? 0 : a.items[i].size;
+    }
+    double break_ratio = a.links ? (double)a.breaks / a.links : 0.0;
+    printf("%s: FAT%d, %u clusters of %u bytes, %zu files, %zu directories, ",
+           path, img->fat_bits, img->clusters, img->cluster_size, files, dirs);
+    print_size(data, 0);
+    printf(" of data, %.1f%% of cluster links not contiguous\n", 100 * break_ratio);
+
+    report_buckets();
+
+    printf("\nwhat if the same files were stored with another cluster size\n");
+    printf("%-8s %10s %10s %7s %10s %6s %10s %6s\n",
+           "cluster", "clusters", "wasted", "waste%", "extents", "FAT", "FAT size", "fits");
+    WhatIf whatif[WHATIF_COUNT];
+    const WhatIf* best = NULL;
+    const WhatIf* smallest_fit = NULL;
+    for(size_t i = 0; i < WHATIF_COUNT; i++) {
+        WhatIf* w = &whatif[i];
+        w->cluster_size = MIN_CLUSTER_SIZE << i;
+        simulate(w, break_ratio);
+        bool fits = w->clusters <= w->volume_clusters;
+        printf("%-8u %10lu ", w->cluster_size, w->clusters);
+        print_size(w->wasted, 9);
+        printf(" %6.1f%% %10.0f %6d ", percent(w->wasted, data), w->extents, w->fat_bits);
+        print_size((uint64_t)w->sec_per_fat * img->sector_size, 9);
+        printf(" %6s\n", fits ? "yes" : "no");
+        if(!fits) {
+            continue;
+        }
+        if(smallest_fit == NULL) {
+            smallest_fit = w;
+        }
+        if(percent(w->wasted, data) <= max_waste) {
+            best = w;       // 簇越大越好，后面的会覆盖前面的
+        }
+    }
+
+    if(best == NULL) {
+        best = smallest_fit;
+    }
+    if(best == NULL) {
+        printf("\nthe files do not fit in this volume with any cluster size up to %u bytes\n", MAX_CLUSTER_SIZE);
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+    printf("\nrecommended: %u-byte clusters, %.1f%% wasted (limit %.0f%%), %.0f extents\n",
+           best->cluster_size, percent(best->wasted, data), max_waste, best->extents);
+    printf("  fat16_mkfs");
+    if(best->fat_bits == 32) {
+        printf(" -F 32");
+    } else {
+        printf(" -r %u", best->root_entries);
+    }
+    // fat16_mkfs 会截断输出镜像，命令中不能出现被分析的镜像，由用户填写新镜像的路径
+    printf(" -R %u -s %u -f %u -d <source-dir> <new-image> %u\n", best->reserved,
+           best->cluster_size / img->sector_size, img->fats,
+           (uint32_t)((uint64_t)img->sectors * img->sector_size / 1024));
+    printf("  (<source-dir> holds a copy of the files in %s; fat16_mkfs overwrites <new-image>)\n", path);
+
+    free(a.items);
+    free(a.seen);
+    image_close(img);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,328 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "fat16.h"
+#include "fat16_cache.h"
+
+/**
+ * 内核页缓存和目录项缓存的配置与失效通知。
+ *
+ * init 时把 entry_timeout / attr_timeout 设为较长的时间，fat16_open 设置 keep_cache，
+ * 重复的 stat 和读取由内核缓存直接返回，不再进入守护进程。
+ *
+ * 通过挂载点的修改，内核会自己更新它用过的那个路径的缓存；但 FAT 的文件名不区分大小写，
+ * "/a.txt" 和 "/A.TXT" 在内核里是两个不同的 inode，通过一个写入后另一个的属性和页缓存就过期了。
+ * 所以这一层记下 getattr 见过的每种写法（按 8.3 短文件名归并），修改成功后对其他写法调用
+ * fuse_invalidate_path。在回调中直接发通知可能与内核等待同一个请求而死锁，所以通知放进队列，
+ * 由后台线程发出。
+ *
+ * 高层 API 只能让 inode 失效，不能让某个名字的“不存在”缓存失效：先 stat("/FOO") 再创建 "/foo"，
+ * "/FOO" 在 negative_timeout 内仍然不存在，所以 negative_timeout 默认较短。
+ */
+
+#define ALIAS_BUCKETS 1024
+#define ALIAS_MAX 4             // 每个文件最多记录的写法，超过后替换最早的
+
+typedef struct Alias {
+    struct Alias* next;
+    char* key;                  // 每一级都转换为 8.3 短文件名的路径
+    char* paths[ALIAS_MAX];
+    int count;
+} Alias;
+
+typedef struct Pending {
+    struct Pending* next;
+    char* path;
+} Pending;
+
+static CacheOptions options;
+static struct fuse_operations inner;
+static struct fuse* fuse;
+
+static pthread_mutex_t alias_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Alias* aliases[ALIAS_BUCKETS];
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static Pending* queue_head;
+static Pending** queue_tail = &queue_head;
+static bool notifier_running;
+static bool notifier_stop;
+static pthread_t notifier;
+
+/**
+ * @brief 把 path 的每一级转换为短文件名，得到不区分写法的键
+ *
+ * @return char*  新分配的字符串，路径中有不合法的文件名时返回 NULL
+ */
+static char* alias_key(const char* path) {
+    char* key = malloc(strlen(path) / 2 * (FAT_NAME_LEN + 1) + FAT_NAME_LEN + 2);
+    char* p = key;
+    while(*path != '\0') {
+        while(*path == '/') {
+            path++;
+        }
+        size_t len = strcspn(path, "/");
+        if(len == 0) {
+            break;
+        }
+        *p++ = '/';
+        if(to_shortname(path, len, p) < 0) {
+            free(key);
+            return NULL;
+        }
+        p += FAT_NAME_LEN;
+        path += len;
+    }
+    *p = '\0';
+    return key;
+}
+
+static size_t alias_hash(const char* key) {
+    size_t h = 5381;
+    for(; *key != '\0'; key++) {
+        h = h * 33 + (unsigned char)*key;
+    }
+    return h % ALIAS_BUCKETS;
+}
+
+// 记录 path 这种写法，需要持有 alias_mutex
+static void alias_record(const char* path) {
+    char* key = alias_key(path);
+    if(key == NULL) {
+        return;
+    }
+    Alias** bucket = &aliases[alias_hash(key)];
+    Alias* a = *bucket;
+    while(a != NULL && strcmp(a->key, key) != 0) {
+        a = a->next;
+    }
+    if(a == NULL) {
+        a = calloc(1, sizeof(Alias));
+        a->key = key;
+        a->next = *bucket;
+        *bucket = a;
+    } else {
+        free(key);
+    }
+    int n = min(a->count, ALIAS_MAX);
+    for(int i = 0; i < n; i++) {
+        if(strcmp(a->paths[i], path) == 0) {
+            return;
+        }
+    }
+    int i = a->count++ % ALIAS_MAX;
+    free(a->paths[i]);
+    a->paths[i] = strdup(path);
+}
+
+static void queue_push(const char* path) {
+    Pending* p = malloc(sizeof(Pending));
+    p->path = strdup(path);
+    p->next = NULL;
+    pthread_mutex_lock(&queue_mutex);
+    *queue_tail = p;
+    queue_tail = &p->next;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// key 是否等于 prefix，或在 prefix 目录之下
+static bool key_under(const char* key, const char* prefix, size_t len) {
+    return strncmp(key, prefix, len) == 0 && (key[len] == '\0' || key[len] == '/');
+}
+
+/**
+ * @brief path 被修改后，让它的其他写法失效
+ *
+ * @param subtree   目录被删除或移动，同时让它之下所有记录过的路径失效
+ * @param forget    path 已不存在，不再记录它的写法
+ */
+static void invalidate_aliases(const char* path, bool subtree, bool forget) {
+    if(!notifier_running) {
+        return;
+    }
+    char* key = alias_key(path);
+    if(key == NULL) {
+        return;
+    }
+    size_t len = strlen(key);
+    pthread_mutex_lock(&alias_mutex);
+    size_t first = subtree ? 0 : alias_hash(key);
+    size_t last = subtree ? ALIAS_BUCKETS - 1 : first;
+    for(size_t b = first; b <= last; b++) {
+        Alias** link = &aliases[b];
+        while(*link != NULL) {
+            Alias* a = *link;
+            bool match = subtree ? key_under(a->key, key, len) : strcmp(a->key, key) == 0;
+            if(!match) {
+                link = &a->next;
+                continue;
+            }
+            int n = min(a->count, ALIAS_MAX);
+            for(int i = 0; i < n; i++) {
+                // 内核已经更新了这次操作所用路径的缓存
+                if(strcmp(a->paths[i], path) != 0) {
+                    queue_push(a->paths[i]);
+                }
+            }
+            if(forget) {
+                *link = a->next;
+                for(int i = 0; i < n; i++) {
+                    free(a->paths[i]);
+                }
+                free(a->key);
+                free(a);
+            } else {
+                link = &a->next;
+            }
+        }
+    }
+    pthread_mutex_unlock(&alias_mutex);
+    free(key);
+}
+
+static void* notifier_main(void* arg) {
+    pthread_mutex_lock(&queue_mutex);
+    while(true) {
+        while(queue_head == NULL && !notifier_stop) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        }
+        if(queue_head == NULL) {
+            break;
+        }
+        Pending* p = queue_head;
+        queue_head = p->next;
+        if(queue_head == NULL) {
+            queue_tail = &queue_head;
+        }
+        pthread_mutex_unlock(&queue_mutex);
+        // 内核没有缓存这个路径时返回 -ENOENT，不需要处理
+        int ret = fuse_invalidate_path(fuse, p->path);
+        log_debug("invalidate %s: %d", p->path, ret);
+        free(p->path);
+        free(p);
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+// ===========================包装后的回调===============================
+
+static void* cache_init(struct fuse_conn_info* conn, struct fuse_config* config) {
+    void* ret = inner.init ? inner.init(conn, config) : NULL;
+    config->entry_timeout = options.entry_timeout;
+    config->attr_timeout = options.entry_timeout;
+    config->negative_timeout = options.negative_timeout;
+    fuse = fuse_get_context()->fuse;
+    notifier_stop = false;
+    notifier_running = pthread_create(&notifier, NULL, notifier_main, NULL) == 0;
+    if(!notifier_running) {
+        log_warn("Start invalidation thread failed, aliases may see stale attributes");
+    }
+    return ret;
+}
+
+static void cache_destroy(void* data) {
+    if(notifier_running) {
+        pthread_mutex_lock(&queue_mutex);
+        notifier_stop = true;
+        pthread_cond_signal(&queue_cond);
+        pthread_mutex_unlock(&queue_mutex);
+        pthread_join(notifier, NULL);
+        notifier_running = false;
+    }
+    if(inner.destroy) {
+        inner.destroy(data);
+    }
+}
+
+static int cache_getattr(const char* path, struct stat* stbuf, struct fuse_file_info* fi) {
+    int ret = inner.getattr(path, stbuf, fi);
+    if(ret == 0 && notifier_running) {
+        pthread_mutex_lock(&alias_mutex);
+        alias_record(path);
+        pthread_mutex_unlock(&alias_mutex);
+    }
+    return ret;
+}
+
+static int cache_unlink(const char* path) {
+    int ret = inner.unlink(path);
+    if(ret == 0) {
+        invalidate_aliases(path, false, true);
+    }
+    return ret;
+}
+
+static int cache_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    int ret = inner.utimens(path, tv, fi);
+    if(ret == 0) {
+        invalidate_aliases(path, false, false);
+    }
+    return ret;
+}
+
+static int cache_rmdir(const char* path) {
+    int ret = inner.rmdir(path);
+    if(ret == 0) {
+        invalidate_aliases(path, true, true);
+    }
+    return ret;
+}
+
+static int cache_rename(const char* from, const char* to, unsigned int flags) {
+    int ret = inner.rename(from, to, flags);
+    if(ret == 0) {
+        invalidate_aliases(from, true, true);
+        invalidate_aliases(to, true, false);
+    }
+    return ret;
+}
+
+static ssize_t cache_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                                     const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                                     size_t size, int flags) {
+    ssize_t ret = inner.copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+    if(ret > 0) {
+        invalidate_aliases(path_out, false, false);
+    }
+    return ret;
+}
+
+static int cache_write(const char* path, const char* data, size_t size, off_t offset,
+                       struct fuse_file_info* fi) {
+    int ret = inner.write(path, data, size, offset, fi);
+    if(ret > 0) {
+        invalidate_aliases(path, false, false);
+    }
+    return ret;
+}
+
+static int cache_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    int ret = inner.truncate(path, size, fi);
+    if(ret == 0) {
+        invalidate_aliases(path, false, false);
+    }
+    return ret;
+}
+
+/**
+ * @brief 设置内核缓存的时间并包装修改文件系统的回调，需要在 fuse_main 之前调用
+ */
+void cache_wrap_operations(struct fuse_operations* ops, const CacheOptions* opts) {
+    inner = *ops;
+    options = *opts;
+    ops->init = cache_init;
+    ops->destroy = cache_destroy;
+    ops->getattr = cache_getattr;
+    ops->unlink = cache_unlink;
+    ops->utimens = cache_utimens;
+    ops->rmdir = cache_rmdir;
+    ops->rename = cache_rename;
+    ops->copy_file_range = cache_copy_file_range;
+    ops->write = cache_write;
+    ops->truncate = cache_truncate;
+}
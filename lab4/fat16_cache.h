@@ -0,0 +1,21 @@
+#ifndef FAT16_CACHE_H
+#define FAT16_CACHE_H
+
+/**
+ * 内核缓存的配置（fat16_cache.c）。守护进程是镜像唯一的写者，所以目录项和属性可以长时间缓存，
+ * 文件内容在打开时保留在内核页缓存中。
+ */
+
+typedef struct {
+    double entry_timeout;       // 目录项和属性的缓存时间（秒）
+    double negative_timeout;    // “文件不存在”的缓存时间（秒）
+} CacheOptions;
+
+#define CACHE_DEFAULT_TIMEOUT 3600.0
+#define CACHE_DEFAULT_NEGATIVE_TIMEOUT 1.0
+
+struct fuse_operations;
+
+void cache_wrap_operations(struct fuse_operations* ops, const CacheOptions* options);
+
+#endif
@@ -0,0 +1,592 @@
+/**
+ * fat16_defrag: 离线整理 FAT16 镜像，使每个文件/目录的簇都连续，并按目录的局部性排列。
+ *
+ * 用法: fat16_defrag [-n] [-v] <镜像>
+ *   -n  只报告碎片情况，不修改镜像
+ *   -v  打印每个被移动的文件
+ *
+ * 整理时镜像不能处于挂载状态。整理后的布局为：目录自己的簇，紧接着该目录下所有文件的簇，
+ * 然后依次是各个子目录（递归）。簇只会被复制到空闲簇中，每批最多移动 DEFRAG_BATCH 个簇，
+ * 每批结束时提交 FAT 和目录项，所以整理随时可以被中断：镜像始终是一致的，最多留下丢失的簇，
+ * 用 fat16_fsck -r 释放后可以再次整理。有丢失的簇链时拒绝整理，至少需要一个空闲簇。
+ *
+ * 碎片情况按文件统计：extent 是一段连续的簇，seek 距离是顺序读取文件时，
+ * 相邻两个 extent 之间磁头需要移动的磁道数（与 fat16_fixed.c 中 seek_to 的计算方法相同）。
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fat16_image.h"
+
+#define DEFRAG_BATCH 4096       // 每批最多移动的簇数
+
+typedef struct {
+    cluster_t* clusters;        // 簇链上的簇，按链上顺序；整理时随移动更新为当前位置
+    size_t n;
+    bool is_dir;
+    long parent;                // 父目录在 chains 中的下标，父目录为根目录时为 -1
+    char* path;
+} Chain;
+
+typedef struct {
+    Fat16Image img;
+    bool verbose;
+
+    Chain* chains;              // 按整理后的顺序排列
+    size_t nchains;
+    size_t capacity;
+
+    uint8_t* claimed;           // 已被某条簇链认领的簇
+    cluster_t* new_clus;        // 旧簇号 -> 新簇号，0 表示该簇未被使用
+    size_t lost;                // 丢失的簇数
+    cluster_t placed_end;       // 整理后最后一个已用簇之后的簇号
+
+    long* slot_chain;           // 目标位置 -> 簇链下标，-1 表示整理后空闲
+    size_t* slot_pos;           // 目标位置 -> 在簇链中的下标
+    long* owner;                // 当前位置 -> 簇链下标，-1 表示空闲
+    size_t* owner_pos;          // 当前位置 -> 在簇链中的下标
+
+    // 当前批次
+    cluster_t* moved;           // 旧位置 -> 新位置，0 表示本批没有移动
+    uint8_t* fresh;             // 本批的新位置
+    cluster_t batch[DEFRAG_BATCH];  // 本批移动的簇的旧位置
+    size_t batch_len;
+    size_t copies;              // 复制过的簇数，被挪开再搬回的簇计两次
+    uint8_t* dirty;             // 每条簇链：1 表示本批有簇被移动，2 表示首簇被移动
+    uint8_t* touched;           // 每个目录：本批需要修改其中的目录项
+    char* buffer;               // 一个簇的缓冲区
+} Defrag;
+
+static Defrag d;
+
+typedef struct {
+    size_t files;               // 至少有一个簇的文件/目录数
+    size_t extents;
+    size_t fragmented;          // extent 多于一个的文件数
+    uint64_t seek_tracks;       // 顺序读取所有文件时 extent 之间的寻道距离之和
+} FragStats;
+
+static long cluster_track(cluster_t clus, bool last_sector) {
+    Fat16Image* img = &d.img;
+    sector_t sec = image_cluster_sector(img, clus) + (last_sector ? img->sec_per_clus - 1 : 0);
+    return sec / SEC_PER_TRACK;
+}
+
+/**
+ * @brief 统计碎片情况，mapped 为真时按整理后的簇号计算
+ */
+static void frag_stats(FragStats* st, bool mapped) {
+    memset(st, 0, sizeof(FragStats));
+    for(size_t i = 0; i < d.nchains; i++) {
+        Chain* c = &d.chains[i];
+        if(c->n == 0) {
+            continue;
+        }
+        size_t extents = 1;
+        for(size_t j = 1; j < c->n; j++) {
+            cluster_t prev = mapped ? d.new_clus[c->clusters[j - 1]] : c->clusters[j - 1];
+            cluster_t cur = mapped ? d.new_clus[c->clusters[j]] : c->clusters[j];
+            if(cur != prev + 1) {
+                extents++;
+                st->seek_tracks += labs(cluster_track(cur, false) - cluster_track(prev, true));
+            }
+        }
+        st->files++;
+        st->extents += extents;
+        st->fragmented += extents > 1;
+    }
+}
+
+static void print_stats(const char* when, const FragStats* st) {
+    printf("%s: %zu files, %zu fragmented, %.3f extents/file, avg seek distance %.2f tracks/file\n",
+           when, st->files, st->fragmented,
+           st->files ? (double)st->extents / st->files : 0.0,
+           st->files ? (double)st->seek_tracks / st->files : 0.0);
+}
+
+/**
+ * @brief 沿 FAT 表收集从 first 开始的簇链，并加入整理顺序。
+ *
+ * @return int 成功返回链在 d.chains 中的下标；first 已被认领（如 . 和 .. 项）返回 -EEXIST；
+ *             链不合法返回其它负值
+ */
+static int add_chain(cluster_t first, bool is_dir, long parent, char* path) {
+    Fat16Image* img = &d.img;
+    if(!image_cluster_valid(img, first)) {
+        fprintf(stderr, "%s: invalid first cluster %u\n", path, first);
+        return -EINVAL;
+    }
+    if(d.claimed[first]) {
+        return -EEXIST;
+    }
+    if(d.nchains == d.capacity) {
+        d.capacity = d.capacity ? d.capacity * 2 : 256;
+        d.chains = realloc(d.chains, d.capacity * sizeof(Chain));
+    }
+    Chain* c = &d.chains[d.nchains];
+    memset(c, 0, sizeof(Chain));
+    c->is_dir = is_dir;
+    c->parent = parent;
+    c->path = path;
+
+    size_t cap = 0;
+    cluster_t clus = first;
+    while(true) {
+        if(!image_cluster_valid(img, clus) || d.claimed[clus]) {
+            fprintf(stderr, "%s: broken or cross-linked chain at cluster %u, run fat16_fsck first\n",
+                    path, clus);
+            free(c->clusters);
+            return -EINVAL;
+        }
+        d.claimed[clus] = 1;
+        if(c->n == cap) {
+            cap = cap ? cap * 2 : 16;
+            c->clusters = realloc(c->clusters, cap * sizeof(cluster_t));
+        }
+        c->clusters[c->n++] = clus;
+        cluster_t next = img->fat[clus];
+        if(next >= CLUSTER_END_BOUND) {
+            break;
+        }
+        clus = next;
+    }
+    return d.nchains++;
+}
+
+static int read_dir(const Chain* c, char** buffer, size_t* size) {
+    Fat16Image* img = &d.img;
+    if(c == NULL) {
+        *size = (size_t)img->root_sectors * img->sector_size;
+        *buffer = malloc(*size);
+        return image_read(img, img->root_sec, img->root_sectors, *buffer);
+    }
+    *size = c->n * img->cluster_size;
+    *buffer = malloc(*size);
+    for(size_t i = 0; i < c->n; i++) {
+        int ret = image_read(img, image_cluster_sector(img, c->clusters[i]), img->sec_per_clus,
+                             *buffer + i * img->cluster_size);
+        if(ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief 收集目录 dir（NULL 表示根目录）下的所有簇链：先是文件，然后递归每个子目录。
+ */
+static int collect_dir(size_t dir_idx, bool root, const char* path) {
+    char* buffer;
+    size_t size;
+    int ret = read_dir(root ? NULL : &d.chains[dir_idx], &buffer, &size);
+    if(ret < 0) {
+        free(buffer);
+        return ret;
+    }
+
+    for(int pass = 0; pass < 2 && ret >= 0; pass++) {
+        bool want_dir = pass == 1;
+        for(size_t off = 0; off < size; off += DIR_ENTRY_SIZE) {
+            DIR_ENTRY* dir = (DIR_ENTRY*)(buffer + off);
+            if(dir->DIR_Name[0] == NAME_FREE) {
+                break;
+            }
+            if(dir->DIR_Name[0] == NAME_DELETED || dir->DIR_Attr == ATTR_LFN
+                    || (dir->DIR_Attr & ATTR_VOLUME) != 0 || dir_entry_cluster(dir) == CLUSTER_FREE) {
+                continue;
+            }
+            bool is_dir = (dir->DIR_Attr & ATTR_DIRECTORY) != 0;
+            if(is_dir != want_dir) {
+                continue;
+            }
+            char name[FAT_NAME_LEN + 2];
+            fat_name_to_str(dir->DIR_Name, name);
+            char* child = join_path(path, name);
+            ret = add_chain(dir_entry_cluster(dir), is_dir, root ? -1 : (long)dir_idx, child);
+            if(ret == -EEXIST) {
+                // . 和 .. 指向已经收集过的目录
+                free(child);
+                ret = 0;
+                continue;
+            }
+            if(ret < 0) {
+                free(child);
+                break;
+            }
+            if(is_dir) {
+                ret = collect_dir(ret, false, child);
+                if(ret < 0) {
+                    break;
+                }
+            }
+        }
+    }
+    free(buffer);
+    return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief 按整理顺序为每个簇分配新簇号（跳过坏簇），同时记录每个目标位置属于哪条簇链的第几个簇。
+ *        没有被任何目录项引用的簇（丢失的簇链）只计数，整理前需要先用 fat16_fsck -r 释放。
+ *
+ * @return size_t 不在目标位置上的簇数
+ */
+static size_t plan_layout(void) {
+    Fat16Image* img = &d.img;
+    cluster_t last = img->clusters + CLUSTER_MIN;
+    for(cluster_t clus = CLUSTER_MIN; clus < last; clus++) {
+        d.slot_chain[clus] = -1;
+        d.owner[clus] = -1;
+        if(!d.claimed[clus] && img->fat[clus] != CLUSTER_FREE && img->fat[clus] != CLUSTER_BAD) {
+            d.lost++;
+        }
+    }
+    cluster_t next = CLUSTER_MIN;
+    size_t moves = 0;
+    for(size_t i = 0; i < d.nchains; i++) {
+        Chain* c = &d.chains[i];
+        for(size_t j = 0; j < c->n; j++) {
+            while(img->fat[next] == CLUSTER_BAD) {
+                next++;
+            }
+            d.new_clus[c->clusters[j]] = next;
+            d.slot_chain[next] = i;
+            d.slot_pos[next] = j;
+            d.owner[c->clusters[j]] = i;
+            d.owner_pos[c->clusters[j]] = j;
+            moves += c->clusters[j] != next;
+            next++;
+        }
+    }
+    d.placed_end = next;
+    return moves;
+}
+
+static int sync_image(void) {
+    return fdatasync(d.img.fd) == 0 ? 0 : -errno;
+}
+
+/**
+ * @brief 把簇链 i 的第 j 个簇复制到空闲簇 to。旧位置在本批提交之前保持不变，仍然有效。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+static int batch_move(long i, size_t j, cluster_t to) {
+    Fat16Image* img = &d.img;
+    Chain* c = &d.chains[i];
+    cluster_t from = c->clusters[j];
+    int ret = image_read(img, image_cluster_sector(img, from), img->sec_per_clus, d.buffer);
+    if(ret == 0) {
+        ret = image_write(img, image_cluster_sector(img, to), img->sec_per_clus, d.buffer);
+    }
+    if(ret < 0) {
+        return ret;
+    }
+    c->clusters[j] = to;
+    d.copies++;
+    d.moved[from] = to;
+    d.fresh[to] = 1;
+    d.batch[d.batch_len++] = from;
+    d.owner[from] = -1;
+    d.owner[to] = i;
+    d.owner_pos[to] = j;
+    img->fat[to] = CLUSTER_END;     // 占住目标簇，提交时再连入簇链
+    d.dirty[i] = max(d.dirty[i], j == 0 ? 2 : 1);
+    return 0;
+}
+
+/**
+ * @brief 将目录项中的首簇号改为本批移动后的位置（包括 . 和 ..）
+ *
+ * @return bool 是否有目录项被修改
+ */
+static bool remap_entries(char* buffer, size_t size) {
+    Fat16Image* img = &d.img;
+    bool changed = false;
+    for(size_t off = 0; off < size; off += DIR_ENTRY_SIZE) {
+        DIR_ENTRY* dir = (DIR_ENTRY*)(buffer + off);
+        if(dir->DIR_Name[0] == NAME_FREE) {
+            break;
+        }
+        if(dir->DIR_Name[0] == NAME_DELETED || dir->DIR_Attr == ATTR_LFN) {
+            continue;
+        }
+        cluster_t clus = dir_entry_cluster(dir);
+        if(image_cluster_valid(img, clus) && d.moved[clus] != 0) {
+            dir_entry_set_cluster(dir, d.moved[clus]);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// 修改 count 个扇区中的目录项，有变化时写回
+static int remap_sectors(sector_t sec, size_t count, char* buffer) {
+    Fat16Image* img = &d.img;
+    int ret = image_read(img, sec, count, buffer);
+    if(ret == 0 && remap_entries(buffer, count * img->sector_size)) {
+        ret = image_write(img, sec, count, buffer);
+    }
+    return ret;
+}
+
+/**
+ * @brief 提交一批移动，每一步之后镜像都是一致的（最多留下丢失的簇，fat16_fsck -r 可以释放）：
+ *        1. 修改新位置上的目录簇中的目录项，这些簇还没有被引用；
+ *        2. 在 FAT 中把新位置连入簇链，旧位置保持原来的链接，经过旧位置读到的内容相同；
+ *        3. 修改没有移动的目录簇中的目录项：首簇被移动的簇链的父目录，首簇被移动的目录的子目录中的 ..；
+ *        4. 在 FAT 中释放旧位置。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+static int batch_commit(void) {
+    Fat16Image* img = &d.img;
+    if(d.batch_len == 0) {
+        return 0;
+    }
+    int ret = 0;
+    for(size_t k = 0; k < d.batch_len && ret == 0; k++) {
+        cluster_t to = d.moved[d.batch[k]];
+        if(d.chains[d.owner[to]].is_dir) {
+            ret = remap_sectors(image_cluster_sector(img, to), img->sec_per_clus, d.buffer);
+        }
+    }
+    if(ret == 0) {
+        ret = sync_image();
+    }
+
+    bool root_touched = false;
+    for(size_t i = 0; i < d.nchains && ret == 0; i++) {
+        Chain* c = &d.chains[i];
+        if(d.dirty[i] != 0) {
+            for(size_t j = 0; j < c->n; j++) {
+                img->fat[c->clusters[j]] = j + 1 < c->n ? c->clusters[j + 1] : CLUSTER_END;
+            }
+        }
+        if(d.dirty[i] == 2) {
+            if(c->parent < 0) {
+                root_touched = true;
+            } else {
+                d.touched[c->parent] = 1;
+            }
+        }
+        if(c->is_dir && c->parent >= 0 && d.dirty[c->parent] == 2) {
+            d.touched[i] = 1;
+        }
+    }
+    if(ret == 0) {
+        ret = image_flush_fat(img);
+    }
+    if(ret == 0) {
+        ret = sync_image();
+    }
+
+    if(ret == 0 && root_touched) {
+        char* buffer = malloc((size_t)img->root_sectors * img->sector_size);
+        ret = remap_sectors(img->root_sec, img->root_sectors, buffer);
+        free(buffer);
+    }
+    for(size_t i = 0; i < d.nchains && ret == 0; i++) {
+        Chain* c = &d.chains[i];
+        for(size_t j = 0; d.touched[i] && j < c->n && ret == 0; j++) {
+            if(!d.fresh[c->clusters[j]]) {
+                ret = remap_sectors(image_cluster_sector(img, c->clusters[j]), img->sec_per_clus, d.buffer);
+            }
+        }
+        d.touched[i] = 0;
+        d.dirty[i] = 0;
+    }
+    if(ret == 0) {
+        ret = sync_image();
+    }
+
+    for(size_t k = 0; k < d.batch_len; k++) {
+        cluster_t from = d.batch[k];
+        d.fresh[d.moved[from]] = 0;
+        d.moved[from] = 0;
+        if(ret == 0) {
+            img->fat[from] = CLUSTER_FREE;
+        }
+    }
+    d.batch_len = 0;
+    if(ret == 0) {
+        ret = image_flush_fat(img);
+    }
+    return ret;
+}
+
+/**
+ * @brief 从 *cursor 向下寻找不小于 limit 的空闲簇，找不到返回 0
+ */
+static cluster_t find_spare(cluster_t* cursor, cluster_t limit) {
+    Fat16Image* img = &d.img;
+    while(*cursor > limit) {
+        cluster_t clus = --(*cursor);
+        if(img->fat[clus] == CLUSTER_FREE) {
+            return clus;
+        }
+    }
+    return 0;
+}
+
+// 目标位置 s 上是否已经是整理后应在这里的簇
+static bool slot_done(cluster_t s) {
+    return d.owner[s] == d.slot_chain[s] && (d.owner[s] < 0 || d.owner_pos[s] == d.slot_pos[s]);
+}
+
+/**
+ * @brief 按目标布局逐个窗口整理，每个窗口最多 DEFRAG_BATCH 个簇，分两批提交：
+ *        先把窗口中不属于这里的簇搬到窗口之后的空闲簇（从卷的末尾开始找），
+ *        再把属于窗口的簇搬进来，这时它们的目标簇都已经空闲。
+ *        窗口中还没整理好的位置（空闲的或被占用的）不能多于空闲簇数，否则窗口之后的空闲簇不够用。
+ *
+ * @return int 成功返回0，没有空闲簇可用时返回 -ENOSPC，失败返回POSIX错误代码的负值，镜像总是一致的
+ */
+static int defrag_image(void) {
+    Fat16Image* img = &d.img;
+    for(cluster_t t = CLUSTER_MIN; t < d.placed_end; ) {
+        size_t spares = image_count_free(img);
+        size_t pending = 0;
+        cluster_t w_end = t;
+        for(; w_end < d.placed_end && w_end - t < DEFRAG_BATCH; w_end++) {
+            if(!slot_done(w_end) && ++pending > spares) {
+                break;
+            }
+        }
+        if(w_end == t) {
+            return -ENOSPC;
+        }
+
+        cluster_t cursor = img->clusters + CLUSTER_MIN;
+        int ret = 0;
+        for(cluster_t s = t; s < w_end && ret == 0; s++) {
+            if(d.owner[s] >= 0 && !slot_done(s)) {
+                cluster_t spare = find_spare(&cursor, w_end);
+                ret = spare != 0 ? batch_move(d.owner[s], d.owner_pos[s], spare) : -ENOSPC;
+            }
+        }
+        if(ret == 0) {
+            ret = batch_commit();
+        }
+        for(cluster_t s = t; s < w_end && ret == 0; s++) {
+            if(!slot_done(s)) {
+                ret = batch_move(d.slot_chain[s], d.slot_pos[s], s);
+            }
+        }
+        if(ret == 0) {
+            ret = batch_commit();
+        }
+        if(ret < 0) {
+            return ret;
+        }
+        if(d.verbose) {
+            printf("  clusters %u-%u done\n", t, w_end - 1);
+        }
+        t = w_end;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n] [-v] <image>\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    bool dry_run = false;
+    int opt;
+    while((opt = getopt(argc, argv, "nv")) != -1) {
+        switch(opt) {
+        case 'n': dry_run = true; break;
+        case 'v': d.verbose = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Fat16Image* img = &d.img;
+    const char* path = argv[optind];
+    int ret = image_open(img, path, !dry_run);
+    if(ret == 0) {
+        ret = image_load_fat(img);
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot load FAT16 image: %s\n", path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if(img->fat_bits != 16) {
+        // 整理按 FAT16 固定的根目录区域组织布局，FAT32 的根目录也是簇链，暂不支持
+        fprintf(stderr, "%s: only FAT16 images can be defragmented\n", path);
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+    size_t last = img->clusters + CLUSTER_MIN;
+    d.claimed = calloc(last, 1);
+    d.new_clus = calloc(last, sizeof(cluster_t));
+    d.slot_chain = malloc(last * sizeof(long));
+    d.slot_pos = malloc(last * sizeof(size_t));
+    d.owner = malloc(last * sizeof(long));
+    d.owner_pos = malloc(last * sizeof(size_t));
+    d.moved = calloc(last, sizeof(cluster_t));
+    d.fresh = calloc(last, 1);
+    d.buffer = malloc(img->cluster_size);
+
+    ret = collect_dir(0, true, "/");
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot defragment: %s\n", path, strerror(-ret));
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+
+    d.dirty = calloc(d.nchains, 1);
+    d.touched = calloc(d.nchains, 1);
+    size_t moves = plan_layout();
+    FragStats before, after;
+    frag_stats(&before, false);
+    frag_stats(&after, true);
+    print_stats("before", &before);
+    if(d.verbose) {
+        for(size_t i = 0; i < d.nchains; i++) {
+            Chain* c = &d.chains[i];
+            if(d.new_clus[c->clusters[0]] != c->clusters[0]) {
+                printf("  %s: %zu clusters, %u -> %u\n", c->path, c->n,
+                       c->clusters[0], d.new_clus[c->clusters[0]]);
+            }
+        }
+    }
+
+    if(!dry_run && moves > 0 && d.lost > 0) {
+        fprintf(stderr, "%s: %zu lost clusters, run fat16_fsck -r first\n", path, d.lost);
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+    if(!dry_run && moves > 0) {
+        ret = defrag_image();
+        if(ret < 0) {
+            fprintf(stderr, "%s: defragmentation stopped: %s; the image is consistent, "
+                    "run fat16_fsck -r to release lost clusters\n", path, strerror(-ret));
+            image_close(img);
+            return EXIT_FAILURE;
+        }
+        frag_stats(&after, false);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_stats(dry_run ? "planned" : "after", &after);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    if(dry_run) {
+        printf("%s: %zu clusters would move, %.3fs\n", path, moves, elapsed);
+    } else {
+        printf("%s: %zu clusters moved with %zu copies, %.3fs\n", path, moves, d.copies, elapsed);
+    }
+    image_close(img);
+    return EXIT_SUCCESS;
+}
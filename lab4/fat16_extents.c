@@ -0,0 +1,131 @@
+/**
+ * fat16_extents: 通过挂载点查询文件在镜像中的布局（FAT16_IOC_EXTENTS）。
+ *
+ * 用法: fat16_extents [-r] [-v] <文件或目录>...
+ *   -r  递归处理目录下的所有文件和子目录
+ *   -v  打印每个 extent 的偏移、簇号、起始扇区和磁道
+ *
+ * 对每个文件打印 extent 数、簇数，以及顺序读取整个文件时 extent 之间的估计寻道时间。
+ * 寻道时间由守护进程按挂载时的时间模型（--seek_time、--disk_model 等）计算，
+ * 与 fat16_defrag 统计的寻道距离对应。文件系统必须是 simple_fat16 挂载的。
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fat16.h"
+
+typedef struct {
+    bool recursive;
+    bool verbose;
+    size_t files;
+    size_t extents;
+    size_t fragmented;          // extent 多于一个的文件数
+    uint64_t seek_ns;
+    int errors;
+} Report;
+
+static Report r;
+static Fat16ExtentMap map;
+
+static double ms(uint64_t ns) {
+    return ns / 1e6;
+}
+
+/**
+ * @brief 查询并打印一个已打开文件的所有 extent，每次 ioctl 最多返回 FAT16_EXTENTS_MAX 个
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+static int report_file(int fd, const char* path) {
+    uint64_t clusters = 0;
+    memset(&map, 0, sizeof(map));
+    do {
+        if(ioctl(fd, FAT16_IOC_EXTENTS, &map) < 0) {
+            return -errno;
+        }
+        for(uint32_t i = 0; i < map.count; i++) {
+            Fat16Extent* e = &map.extents[i];
+            clusters += e->clusters;
+            if(r.verbose) {
+                printf("  %6u %12lu %10u %8u %12lu %8lu %10.3f\n", map.start + i, e->offset, e->cluster,
+                       e->clusters, e->sector, e->track, ms(e->seek_ns));
+            }
+        }
+        map.start += map.count;
+    } while(map.count > 0 && map.start < map.total);
+
+    printf("%s: %u extents, %lu clusters of %u bytes, %.3f ms seek\n", path, map.total, clusters,
+           map.cluster_size, ms(map.seek_ns));
+    if(map.total > 0) {
+        r.files++;
+        r.extents += map.total;
+        r.fragmented += map.total > 1;
+        r.seek_ns += map.seek_ns;
+    }
+    return 0;
+}
+
+static void report_path(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        r.errors++;
+        return;
+    }
+    if(r.verbose) {
+        printf("%s:\n  %6s %12s %10s %8s %12s %8s %10s\n", path, "extent", "offset", "cluster",
+               "clusters", "sector", "track", "seek(ms)");
+    }
+    int ret = report_file(fd, path);
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot query extents: %s\n", path, strerror(-ret));
+        r.errors++;
+    }
+
+    DIR* dir = r.recursive ? fdopendir(fd) : NULL;
+    if(dir == NULL) {
+        close(fd);
+        return;
+    }
+    struct dirent* de;
+    while((de = readdir(dir)) != NULL) {
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+            continue;
+        }
+        char child[MAX_NAME_LEN * 2];
+        snprintf(child, sizeof(child), "%s/%s", path, de->d_name);
+        report_path(child);
+    }
+    closedir(dir);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-r] [-v] <file>...\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    int opt;
+    while((opt = getopt(argc, argv, "rv")) != -1) {
+        switch(opt) {
+        case 'r': r.recursive = true; break;
+        case 'v': r.verbose = true; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if(optind == argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    for(int i = optind; i < argc; i++) {
+        report_path(argv[i]);
+    }
+    if(r.files > 1) {
+        printf("total: %zu files, %zu fragmented, %.3f extents/file, %.3f ms seek\n", r.files,
+               r.fragmented, (double)r.extents / r.files, ms(r.seek_ns));
+    }
+    return r.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,425 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fat16.h"
+
+/**
+ * 第一个 FAT 表和目录扇区在内存中的缓存。
+ *
+ * 缓存位于模拟磁盘这一层，内容始终与镜像相同：模拟磁盘读写扇区后（持有磁盘的锁）调用 fatcache_fill
+ * 更新缓存，读时先调用 fatcache_lookup，命中就不再访问磁盘。日志事务中还没有写入镜像的修改不在缓存中，
+ * 由 journal_overlay 在读出后覆盖，与没有缓存时一样。
+ *
+ * FAT 表：挂载时只分配内存，不读 FAT 表。后台线程按磁道顺序把 FAT 表读进缓存，每次读一个磁道；
+ * 前台请求读到还没有加载的扇区时直接从磁盘读取，并顺便放入缓存。
+ * 加载每个扇区时统计其中的空闲表项，之后每次写入都更新这个计数，所以 FSInfo 中没有空闲簇数时，
+ * 不需要在挂载时扫描整个 FAT 表，卸载时由 fatcache_free_count 给出准确的数值。
+ * 其他 FAT 表只写不读（写 FAT 的函数都从第一个 FAT 表读出后写入每一个 FAT 表），不缓存。
+ *
+ * 目录扇区：通过 dir_sector_read 读的扇区放入一个直接映射的缓存，冲突时替换。写任何扇区时，
+ * 如果它在缓存中就一起更新，所以目录被删除、簇被重新分配给文件后缓存也不会过期。
+ *
+ * 热扇区文件（--warm=file）：卸载时把本次挂载中前台访问过的 FAT 扇区和缓存中的目录扇区的扇区号
+ * 写入该文件，同时记下镜像的大小、修改时间和 inode 作为版本。下次挂载时版本相同，后台线程先按
+ * 扇区号顺序（即磁道顺序）读入这些扇区，再加载 FAT 表的其余部分；版本不同（镜像在两次挂载之间
+ * 被修改过，如 fsck、日志重放）时忽略该文件。
+ */
+
+#define DIR_CACHE_SECTORS 4096          // 目录扇区缓存的大小（2 MiB）
+#define WARM_MAGIC 0x5736314Fu          // "O16W"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;             // 之后的扇区号个数（uint64_t）
+    uint64_t size;              // 保存时镜像的大小、修改时间和 inode
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t ino;
+} __attribute__((packed)) WarmHeader;
+
+typedef struct {
+    sector_t sec;
+    bool valid;
+    bool used;                  // 本次挂载中被前台访问过，卸载时写入热扇区文件
+} DirSlot;
+
+typedef struct {
+    bool open;
+    sector_t first;             // 第一个 FAT 表的起始扇区
+    size_t sectors;             // FAT 表的扇区数
+    int fat_bits;
+    size_t entries;             // 有效的表项数（簇数 + 2），之后的表项不计入空闲数
+    char* data;
+    uint8_t* loaded;            // 每个扇区是否已经在缓存中
+    uint8_t* used;              // 每个扇区是否被前台访问过
+    size_t free_count;          // 已加载的扇区中空闲的表项数
+    DirSlot* dir_slots;
+    char* dir_data;
+} FatCache;
+
+static FatCache fc;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t warmer;
+static bool warmer_running;
+static volatile bool warmer_stop;
+static int warm_fd = -1;
+
+static __thread bool reading_dir;       // 当前线程在 dir_sector_read 中
+static __thread bool warming;           // 当前线程是后台加载线程
+
+// FAT 表第 index 个扇区中空闲的有效表项数
+static size_t sector_free(size_t index, const char* data) {
+    size_t per_sec = PHYSICAL_SECTOR_SIZE / (fc.fat_bits / 8);
+    size_t lo = max(index * per_sec, (size_t)CLUSTER_MIN);
+    size_t hi = min((index + 1) * per_sec, fc.entries);
+    if(lo >= hi) {
+        return 0;
+    }
+    return fat_count_free(data + (lo - index * per_sec) * (fc.fat_bits / 8), hi - lo, fc.fat_bits);
+}
+
+static bool in_fat(sector_t sec) {
+    return sec >= fc.first && sec < fc.first + fc.sectors;
+}
+
+// sec 在目录扇区缓存中的位置，不在缓存中返回 NULL，需要持有 cache_mutex
+static DirSlot* dir_slot(sector_t sec) {
+    DirSlot* slot = &fc.dir_slots[sec % DIR_CACHE_SECTORS];
+    return slot->valid && slot->sec == sec ? slot : NULL;
+}
+
+static char* dir_slot_data(const DirSlot* slot) {
+    return fc.dir_data + (slot - fc.dir_slots) * PHYSICAL_SECTOR_SIZE;
+}
+
+/**
+ * @brief 由模拟磁盘在持有磁盘的锁时调用：[sec, sec + count) 全部在缓存中时复制到 buffer
+ *
+ * @return bool 是否命中
+ */
+bool fatcache_lookup(sector_t sec, size_t count, void* buffer) {
+    if(!fc.open) {
+        return false;
+    }
+    bool fat = in_fat(sec);
+    if(fat ? sec + count > fc.first + fc.sectors : in_fat(sec + count - 1)) {
+        return false;       // 跨过 FAT 表边界的读不查缓存
+    }
+    pthread_mutex_lock(&cache_mutex);
+    bool hit = true;
+    for(size_t i = 0; i < count && hit; i++) {
+        hit = fat ? fc.loaded[sec - fc.first + i] : dir_slot(sec + i) != NULL;
+    }
+    for(size_t i = 0; i < count && hit; i++) {
+        char* dst = (char*)buffer + i * PHYSICAL_SECTOR_SIZE;
+        if(fat) {
+            memcpy(dst, fc.data + (sec - fc.first + i) * PHYSICAL_SECTOR_SIZE, PHYSICAL_SECTOR_SIZE);
+            fc.used[sec - fc.first + i] |= !warming;
+        } else {
+            DirSlot* slot = dir_slot(sec + i);
+            memcpy(dst, dir_slot_data(slot), PHYSICAL_SECTOR_SIZE);
+            slot->used |= !warming;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return hit;
+}
+
+/**
+ * @brief 由模拟磁盘在持有磁盘的锁时调用：[sec, sec + count) 的内容已从镜像读出或已写入镜像
+ */
+void fatcache_fill(sector_t sec, size_t count, const void* buffer) {
+    if(!fc.open) {
+        return;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    for(size_t i = 0; i < count; i++) {
+        const char* src = (const char*)buffer + i * PHYSICAL_SECTOR_SIZE;
+        sector_t s = sec + i;
+        if(in_fat(s)) {
+            size_t index = s - fc.first;
+            char* dst = fc.data + index * PHYSICAL_SECTOR_SIZE;
+            if(fc.loaded[index]) {
+                fc.free_count -= sector_free(index, dst);
+            }
+            fc.loaded[index] = true;
+            fc.used[index] |= !warming;
+            memcpy(dst, src, PHYSICAL_SECTOR_SIZE);
+            fc.free_count += sector_free(index, dst);
+            continue;
+        }
+        DirSlot* slot = dir_slot(s);
+        if(slot == NULL && reading_dir) {
+            slot = &fc.dir_slots[s % DIR_CACHE_SECTORS];
+            *slot = (DirSlot){ .sec = s, .valid = true };
+        }
+        if(slot != NULL) {
+            slot->used |= reading_dir && !warming;
+            memcpy(dir_slot_data(slot), src, PHYSICAL_SECTOR_SIZE);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/**
+ * @brief 读一个目录扇区，与 sector_read 相同，读出的扇区放入目录扇区缓存
+ */
+int dir_sector_read(sector_t sec, void* buffer) {
+    reading_dir = true;
+    int ret = sector_read(sec, buffer);
+    reading_dir = false;
+    return ret;
+}
+
+static bool range_loaded(size_t index, size_t count) {
+    pthread_mutex_lock(&cache_mutex);
+    bool loaded = true;
+    for(size_t i = 0; i < count && loaded; i++) {
+        loaded = fc.loaded[index + i];
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return loaded;
+}
+
+/**
+ * @brief 按磁道顺序把还没有加载的 FAT 扇区读进缓存，读出的内容由模拟磁盘放入缓存
+ *
+ * @param stop  不为 NULL 时，每读完一个磁道检查一次，为 true 时停止
+ */
+static int fatcache_load(volatile bool* stop) {
+    char* buf = malloc(SEC_PER_TRACK * PHYSICAL_SECTOR_SIZE);
+    if(buf == NULL) {
+        return -ENOMEM;
+    }
+    int ret = 0;
+    sector_t end = fc.first + fc.sectors;
+    for(sector_t sec = fc.first; sec < end && ret == 0 && !(stop != NULL && *stop); ) {
+        sector_t next = min((sec / SEC_PER_TRACK + 1) * SEC_PER_TRACK, end);
+        if(!range_loaded(sec - fc.first, next - sec)) {
+            ret = sectors_read(sec, next - sec, buf);
+        }
+        sec = next;
+    }
+    free(buf);
+    return ret;
+}
+
+// ===========================热扇区文件===============================
+
+// 镜像的版本：大小、修改时间和 inode
+static int image_generation(WarmHeader* h) {
+    struct stat st;
+    int ret = disk_stat(&st);
+    if(ret < 0) {
+        return ret;
+    }
+    h->size = st.st_size;
+    h->mtime_sec = st.st_mtim.tv_sec;
+    h->mtime_nsec = st.st_mtim.tv_nsec;
+    h->ino = st.st_ino;
+    return 0;
+}
+
+static int compare_sector(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 读出热扇区文件中的扇区号，按扇区号排序。文件不存在、损坏或版本不同时返回 0。
+ */
+static size_t warm_load(uint64_t** secs) {
+    WarmHeader h, now;
+    *secs = NULL;
+    if(warm_fd < 0 || pread(warm_fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != WARM_MAGIC) {
+        return 0;
+    }
+    if(image_generation(&now) < 0 || h.size != now.size || h.mtime_sec != now.mtime_sec
+            || h.mtime_nsec != now.mtime_nsec || h.ino != now.ino) {
+        log_info("Image changed since the warm-start file was written, ignoring it");
+        return 0;
+    }
+    *secs = malloc(h.count * sizeof(uint64_t));
+    if(*secs == NULL || pread(warm_fd, *secs, h.count * sizeof(uint64_t), sizeof(h))
+            != (ssize_t)(h.count * sizeof(uint64_t))) {
+        free(*secs);
+        *secs = NULL;
+        return 0;
+    }
+    qsort(*secs, h.count, sizeof(uint64_t), compare_sector);
+    return h.count;
+}
+
+/**
+ * @brief 按顺序读入热扇区，同一磁道上连续的扇区一次读出
+ */
+static int warm_prefetch(const uint64_t* secs, size_t count) {
+    char* buf = malloc(SEC_PER_TRACK * PHYSICAL_SECTOR_SIZE);
+    if(buf == NULL) {
+        return -ENOMEM;
+    }
+    int ret = 0;
+    reading_dir = true;         // 数据区的扇区都是上次缓存过的目录扇区
+    for(size_t i = 0; i < count && ret == 0 && !warmer_stop; ) {
+        size_t n = 1;
+        while(i + n < count && secs[i + n] == secs[i] + n && n < SEC_PER_TRACK
+                && secs[i + n] / SEC_PER_TRACK == secs[i] / SEC_PER_TRACK) {
+            n++;
+        }
+        ret = sectors_read(secs[i], n, buf);
+        i += n;
+    }
+    reading_dir = false;
+    free(buf);
+    return ret;
+}
+
+/**
+ * @brief 把本次挂载中的热扇区写入热扇区文件，需要在最后一次写镜像之后调用
+ */
+static int warm_save(void) {
+    WarmHeader h = { .magic = WARM_MAGIC };
+    uint64_t* secs = malloc((fc.sectors + DIR_CACHE_SECTORS) * sizeof(uint64_t));
+    if(secs == NULL) {
+        return -ENOMEM;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    for(size_t i = 0; i < fc.sectors; i++) {
+        if(fc.used[i]) {
+            secs[h.count++] = fc.first + i;
+        }
+    }
+    for(size_t i = 0; i < DIR_CACHE_SECTORS; i++) {
+        if(fc.dir_slots[i].valid && fc.dir_slots[i].used) {
+            secs[h.count++] = fc.dir_slots[i].sec;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    int ret = image_generation(&h);
+    size_t len = h.count * sizeof(uint64_t);
+    if(ret == 0 && (pwrite(warm_fd, &h, sizeof(h), 0) != sizeof(h)
+                    || pwrite(warm_fd, secs, len, sizeof(h)) != (ssize_t)len
+                    || ftruncate(warm_fd, sizeof(h) + len) < 0)) {
+        ret = -errno;
+    }
+    free(secs);
+    if(ret == 0) {
+        log_info("Saved %u hot sectors for the next mount", h.count);
+    }
+    return ret;
+}
+
+/**
+ * @brief 使用热扇区文件 path：挂载时按其中的扇区号预读，卸载时写入本次的热扇区。
+ *        需要在 fuse_main 之前调用（之后工作目录可能改变）。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int fatcache_set_warm_file(const char* path) {
+    warm_fd = open(path, O_RDWR | O_CREAT, 0644);
+    return warm_fd < 0 ? -errno : 0;
+}
+
+// ===========================后台加载===============================
+
+static void* warmer_main(void* arg) {
+    warming = true;
+    uint64_t* secs;
+    size_t count = warm_load(&secs);
+    int ret = warm_prefetch(secs, count);
+    free(secs);
+    if(ret == 0) {
+        ret = fatcache_load(&warmer_stop);
+    }
+    if(ret < 0) {
+        log_warn("FAT cache warm-up failed: %s", strerror(-ret));
+    } else if(!warmer_stop) {
+        log_debug("FAT cache warm-up done, %lu sectors, %lu prefetched", fc.sectors, count);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 为从 first 开始的 sectors 个扇区的 FAT 表建立缓存，并启动后台线程加载。不读磁盘，立即返回。
+ *
+ * @param entries   有效的表项数（簇数 + 2）
+ * @return int      成功返回0，失败返回POSIX错误代码的负值（此时不使用缓存）
+ */
+int fatcache_open(sector_t first, size_t sectors, int fat_bits, size_t entries) {
+    fatcache_close();
+    // calloc 得到的大块内存在第一次写入时才真正分配，与 FAT 表大小无关
+    FatCache c = { .open = true, .first = first, .sectors = sectors, .fat_bits = fat_bits,
+                   .entries = entries };
+    c.data = calloc(sectors, PHYSICAL_SECTOR_SIZE);
+    c.loaded = calloc(sectors, 1);
+    c.used = calloc(sectors, 1);
+    c.dir_slots = calloc(DIR_CACHE_SECTORS, sizeof(DirSlot));
+    c.dir_data = calloc(DIR_CACHE_SECTORS, PHYSICAL_SECTOR_SIZE);
+    if(c.data == NULL || c.loaded == NULL || c.used == NULL || c.dir_slots == NULL || c.dir_data == NULL) {
+        free(c.data);
+        free(c.loaded);
+        free(c.used);
+        free(c.dir_slots);
+        free(c.dir_data);
+        return -ENOMEM;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    fc = c;
+    pthread_mutex_unlock(&cache_mutex);
+    warmer_stop = false;
+    warmer_running = pthread_create(&warmer, NULL, warmer_main, NULL) == 0;
+    if(!warmer_running) {
+        log_warn("Start FAT cache warm-up thread failed, loading sectors on demand");
+    }
+    return 0;
+}
+
+/**
+ * @brief 停止后台加载，写热扇区文件并释放缓存，需要在最后一次写镜像之后调用
+ */
+void fatcache_close(void) {
+    if(warmer_running) {
+        warmer_stop = true;
+        pthread_join(warmer, NULL);
+        warmer_running = false;
+    }
+    if(!fc.open) {
+        return;
+    }
+    int ret;
+    if(warm_fd >= 0 && (ret = warm_save()) < 0) {
+        log_warn("Write warm-start file failed: %s", strerror(-ret));
+    }
+    pthread_mutex_lock(&cache_mutex);
+    free(fc.data);
+    free(fc.loaded);
+    free(fc.used);
+    free(fc.dir_slots);
+    free(fc.dir_data);
+    fc = (FatCache){ .open = false };
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/**
+ * @brief 镜像中 FAT 表的空闲簇数。后台线程还没有加载完时，在当前线程中加载剩下的扇区。
+ *
+ * @return long 空闲簇数，没有缓存或读取失败时返回POSIX错误代码的负值
+ */
+long fatcache_free_count(void) {
+    if(!fc.open) {
+        return -ENODATA;
+    }
+    warming = true;         // 只为计数读入的扇区不算热扇区
+    int ret = fatcache_load(NULL);
+    warming = false;
+    if(ret < 0) {
+        return ret;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    long count = fc.free_count;
+    pthread_mutex_unlock(&cache_mutex);
+    return count;
+}
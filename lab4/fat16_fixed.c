@@ -2,108 +2,509 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <math.h>
+#include <sys/prctl.h>
 #include "fat16.h"
+#include "fat16_journal.h"
 
-static int fd;
+/**
+ * 模拟磁盘的时间模型：
+ *   linear      每移动一个磁道花费 seek_time（原来的模型）
+ *   curve       短距离寻道按 sqrt 增长（加速阶段），超过 seek_knee 个磁道后线性增长，另加 settle_time
+ *   rotational  curve 的寻道时间，加上按 rpm 计算的旋转等待和传输时间；读取时整个磁道进入磁盘缓存，
+ *               之后读同一磁道不需要等待旋转；写总要等待旋转
+ *   ssd         每次访问固定 ssd_latency，按 4KB 页把扇区分散到 ssd_channels 个通道上，不同通道可以并行
+ *
+ * 每次访问在持有成员的 mutex 时计算完成时刻（磁盘或通道忙时需要排队），释放 mutex 后睡眠到该时刻，
+ * 不再忙等占用 CPU。
+ *
+ * 条带化：--img 指定了多个镜像时，逻辑扇区每 stripe 个一组（条带），轮流放在各个成员镜像上，
+ * 第 k 个条带在第 k % n 个成员的第 k / n 个条带处。每个成员有自己的镜像文件、锁、磁头和请求队列，
+ * 访问不同成员的请求互不等待；一次跨越多个成员的连续读写拆成每个成员上的一段，各自排队计时，
+ * 等最晚的一段完成，所以顺序读写和并发的读写都能同时用上所有成员。只有一个成员时就是原来的单个镜像。
+ * 成员镜像用 fat16_stripe 从普通镜像拆分得到，挂载时的 --stripe_kb 必须与拆分时相同。
+ */
+enum DiskModel { MODEL_LINEAR, MODEL_CURVE, MODEL_ROTATIONAL, MODEL_SSD };
+static const char* MODEL_NAMES[] = { "linear", "curve", "rotational", "ssd" };
+
+#define SSD_PAGE_SECTORS 8          // SSD 一页 4KB
+
+#define MAX_MEMBERS 16
+
+typedef struct {
+    int fd;
+    char* path;                 // disk_set_dsync 重新打开镜像时使用
+    pthread_mutex_t mutex;
+    long last_track;            // 成员镜像中的磁道号
+    long buffered_track;        // rotational 模型中磁盘缓存的磁道，-1 表示没有
+    uint64_t busy_until;        // 磁盘空闲的时刻（ns）
+    uint64_t* channel_busy;     // ssd 模型中每个通道空闲的时刻（ns）
+} Member;
 
 struct disk_info {
+    int model;
     uint64_t seek_time_us;      // 磁头移动一个磁道所需时间
-    long last_track;
-    long total_track;
+    uint64_t settle_time_us;    // 每次寻道后磁头稳定的时间
+    uint64_t seek_knee;         // curve 模型中 sqrt 与线性的分界（磁道数）
+    uint64_t rpm;
+    uint64_t ssd_latency_us;
+    uint64_t ssd_channels;
+    long total_track;           // 逻辑卷的磁道数
+    Member members[MAX_MEMBERS];
+    size_t nmembers;
+    sector_t stripe;            // 条带的扇区数
 };
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static struct disk_info di;
 
-void busywait(long us) {
-    struct timespec s, t;
-    clock_gettime(CLOCK_MONOTONIC, &s);
-    while (true) {
-        clock_gettime(CLOCK_MONOTONIC, &t);
-        long dus = (long)(t.tv_sec - s.tv_sec) * 1000000 + (t.tv_nsec - s.tv_nsec) / 1000;
-        if (dus >= us) {
-            break;
+/**
+ * 可选的 I/O 热力图：每个磁道被各类扇区读写的次数，以及寻道距离的分布。
+ * 读和写、以及扇区所属的区域（FAT 表、根目录、数据区）分开统计。
+ * 磁道按逻辑扇区计算，寻道距离是成员镜像中磁头移动的距离。
+ * 由 --heatmap=file 打开，卸载时写入该文件，运行中可以随时读取挂载点下的 /.heatmap。
+ * 所有计数都在持有 hm_mutex 时修改。
+ */
+enum IoCategory { IO_RESERVED, IO_FAT, IO_ROOT, IO_DATA, IO_CATEGORIES };
+static const char* IO_CATEGORY_NAMES[IO_CATEGORIES] = { "reserved", "fat", "root", "data" };
+
+#define SEEK_BUCKETS 33     // 第 0 个桶是不需要寻道的访问，第 i 个桶是距离在 [2^(i-1), 2^i) 磁道的寻道
+
+struct heatmap {
+    bool enabled;
+    FILE* file;                         // 卸载时写入的文件
+    sector_t fat_sec, root_sec, data_sec;
+    uint64_t* tracks;                   // [磁道][读/写][区域]
+    uint64_t seeks[2][IO_CATEGORIES][SEEK_BUCKETS];
+};
+static struct heatmap hm;
+static pthread_mutex_t hm_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int io_category(sector_t sec) {
+    if(sec >= hm.data_sec) {
+        return IO_DATA;
+    }
+    if(sec >= hm.root_sec) {
+        return IO_ROOT;
+    }
+    if(sec >= hm.fat_sec) {
+        return IO_FAT;
+    }
+    return IO_RESERVED;
+}
+
+static void heatmap_record(sector_t sec, long delta, bool write) {
+    long track = sec / SEC_PER_TRACK;
+    int bucket = delta == 0 ? 0 : min(64 - __builtin_clzl(delta), SEEK_BUCKETS - 1);
+    pthread_mutex_lock(&hm_mutex);
+    int cat = io_category(sec);
+    if(track <= di.total_track) {
+        hm.tracks[(track * 2 + write) * IO_CATEGORIES + cat]++;
+    }
+    hm.seeks[write][cat][bucket]++;
+    pthread_mutex_unlock(&hm_mutex);
+}
+
+/**
+ * @brief 逻辑扇区 sec 所在的成员，*msec 为它在成员镜像中的扇区号，
+ *        *run 为从 sec 开始在同一个成员上连续的扇区数（到条带末尾）
+ */
+static Member* map_sector(sector_t sec, sector_t* msec, size_t* run) {
+    if(di.nmembers == 1) {
+        *msec = sec;
+        *run = SIZE_MAX;
+        return &di.members[0];
+    }
+    sector_t stripe = sec / di.stripe;
+    *msec = stripe / di.nmembers * di.stripe + sec % di.stripe;
+    *run = di.stripe - sec % di.stripe;
+    return &di.members[stripe % di.nmembers];
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+    if(ns <= now_ns()) {
+        return;
+    }
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+// 移动 delta 个磁道所需的时间（ns）
+static uint64_t seek_ns(long delta) {
+    if(delta == 0) {
+        return 0;
+    }
+    if(di.model == MODEL_LINEAR) {
+        return delta * di.seek_time_us * 1000;
+    }
+    double tracks = (uint64_t)delta < di.seek_knee ? sqrt((double)delta * di.seek_knee) : delta;
+    return (uint64_t)((di.settle_time_us + tracks * di.seek_time_us) * 1000);
+}
+
+// 磁头到达时刻为 arrive 时，等待成员中的扇区 sec 转到磁头下方再读写完该扇区所需的时间（ns）
+static uint64_t rotation_ns(sector_t sec, uint64_t arrive) {
+    uint64_t rotation = 60000000000ull / di.rpm;
+    uint64_t per_sector = rotation / SEC_PER_TRACK;
+    uint64_t angle = arrive % rotation;
+    uint64_t target = (sec % SEC_PER_TRACK) * per_sector;
+    uint64_t wait = target >= angle ? target - angle : rotation - angle + target;
+    return wait + per_sector;
+}
+
+/**
+ * @brief 按时间模型计算成员 m 上一次访问的完成时刻（CLOCK_MONOTONIC，ns），需要持有 m->mutex
+ *
+ * @param sec   成员镜像中的扇区号
+ */
+static uint64_t access_done(Member* m, sector_t sec, long delta, bool write) {
+    uint64_t now = now_ns();
+    if(di.model == MODEL_SSD) {
+        uint64_t ch = (sec / SSD_PAGE_SECTORS) % di.ssd_channels;
+        uint64_t start = max(now, m->channel_busy[ch]);
+        m->channel_busy[ch] = start + di.ssd_latency_us * 1000;
+        return m->channel_busy[ch];
+    }
+
+    uint64_t done = max(now, m->busy_until) + seek_ns(delta);
+    if(di.model == MODEL_ROTATIONAL) {
+        long track = sec / SEC_PER_TRACK;
+        if(write || track != m->buffered_track) {
+            done += rotation_ns(sec, done);
         }
-        if (dus < 0) {
-            printf("fetal: time error\n");
-            break;
+        if(!write) {
+            m->buffered_track = track;
         }
     }
+    m->busy_until = done;
+    return done;
 }
 
-void seek_to(sector_t sec) {
-    long track = sec / SEC_PER_TRACK;
-    long delta = labs(track - di.last_track);
-    busywait(delta * di.seek_time_us);
-    di.last_track = track;
+/**
+ * @brief 在当前的时间模型下，读完 from 之后接着读不相邻的 to 需要多花的时间（ns），不考虑排队：
+ *        寻道时间，rotational 模型换磁道时再加平均半圈的旋转等待；ssd 模型是多一次访问的延迟。
+ *        条带化时两个扇区在不同成员上，本来就要换一个磁头，不计额外的时间。
+ */
+uint64_t disk_seek_estimate(sector_t from, sector_t to) {
+    if(di.model == MODEL_SSD) {
+        return di.ssd_latency_us * 1000;
+    }
+    sector_t mfrom, mto;
+    size_t run;
+    if(map_sector(from, &mfrom, &run) != map_sector(to, &mto, &run)) {
+        return 0;
+    }
+    long delta = labs((long)(mto / SEC_PER_TRACK) - (long)(mfrom / SEC_PER_TRACK));
+    uint64_t ns = seek_ns(delta);
+    if(di.model == MODEL_ROTATIONAL && delta != 0) {
+        ns += 30000000000ull / di.rpm;
+    }
+    return ns;
 }
 
-int sector_read(sector_t sec_num, void *buffer) {
-    if(pthread_mutex_lock(&mutex) != 0) {
-        printf("read sector %lu error: lock failed.\n", sec_num);
-        return 1;
+/**
+ * @brief 移动成员 m 的磁头到 msec 所在磁道，返回移动的磁道数，需要持有 m->mutex。
+ *        sec 是对应的逻辑扇区，*done 更新为这次访问与之前访问中最晚的完成时刻；charge 为假时只统计，不计时，*done 不变。
+ */
+static long seek_to(Member* m, sector_t sec, sector_t msec, bool write, bool charge, uint64_t* done) {
+    long track = msec / SEC_PER_TRACK;
+    long delta = labs(track - m->last_track);
+    if(hm.enabled) {
+        heatmap_record(sec, delta, write);
+    }
+    if(charge) {
+        // ssd 模型中各通道的完成时刻不是单调的，取最晚的一个
+        uint64_t t = access_done(m, msec, delta, write);
+        *done = max(*done, t);
+    }
+    m->last_track = track;
+    return delta;
+}
+
+/**
+ * @brief 在成员 m 上读写逻辑扇区 sec 开始的 count 个扇区（在成员中从 msec 开始连续）：
+ *        只加一次锁，只发起一次系统调用。模拟磁盘仍按扇区逐个计时和统计，连续扇区之间不需要寻道；
+ *        ssd 模型按页计时，与上一个扇区在同一页中的扇区属于同一次页访问，不再计延迟。
+ *        不睡眠，*done 为最晚的完成时刻（命中缓存时为 0）。
+ */
+static int member_io(Member* m, sector_t sec, sector_t msec, size_t count, void* buffer, bool write,
+                     uint64_t* done) {
+    *done = 0;
+    if(pthread_mutex_lock(&m->mutex) != 0) {
+        log_error("%s sectors %lu+%lu error: lock failed.", write ? "write" : "read", sec, count);
+        return -EIO;
+    }
+    if(!write && fatcache_lookup(sec, count, buffer)) {
+        pthread_mutex_unlock(&m->mutex);
+        return 0;
     }
-    seek_to(sec_num);
-    ssize_t ret = pread(fd, buffer, PHYSICAL_SECTOR_SIZE, sec_num * PHYSICAL_SECTOR_SIZE);
-    pthread_mutex_unlock(&mutex);
-    if(ret != PHYSICAL_SECTOR_SIZE) {
-        printf("read sector %lu error: image read failed.\n", sec_num);
-        return 1;
+    for(size_t i = 0; i < count; i++) {
+        bool same_page = di.model == MODEL_SSD && i > 0
+                         && (msec + i) / SSD_PAGE_SECTORS == (msec + i - 1) / SSD_PAGE_SECTORS;
+        stats_disk_io(write, seek_to(m, sec + i, msec + i, write, !same_page, done));
+    }
+    size_t len = count * PHYSICAL_SECTOR_SIZE;
+    ssize_t ret = write ? pwrite(m->fd, buffer, len, msec * PHYSICAL_SECTOR_SIZE)
+                        : pread(m->fd, buffer, len, msec * PHYSICAL_SECTOR_SIZE);
+    if(ret == (ssize_t)len) {
+        fatcache_fill(sec, count, buffer);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    if(ret != (ssize_t)len) {
+        log_error("%s sectors %lu+%lu error: image %s failed.", write ? "write" : "read", sec, count,
+                  write ? "write" : "read");
+        return -EIO;
     }
     return 0;
 }
 
+/**
+ * @brief 读写从 sec 开始的连续 count 个扇区，按成员拆成几段，各段都发出后再等待最晚完成的一段
+ */
+static int sectors_io(sector_t sec, size_t count, void* buffer, bool write) {
+    if(write && journal_capture(sec, count, buffer)) {
+        return 0;
+    }
+    uint64_t done = 0;
+    int ret = 0;
+    for(size_t pos = 0; pos < count && ret == 0; ) {
+        sector_t msec;
+        size_t run;
+        Member* m = map_sector(sec + pos, &msec, &run);
+        run = min(run, count - pos);
+        uint64_t piece_done;
+        ret = member_io(m, sec + pos, msec, run, (char*)buffer + pos * PHYSICAL_SECTOR_SIZE, write, &piece_done);
+        done = max(done, piece_done);
+        pos += run;
+    }
+    sleep_until(done);
+    if(ret == 0 && !write) {
+        journal_overlay(sec, count, buffer);
+    }
+    return ret;
+}
+
+int sector_read(sector_t sec_num, void *buffer) {
+    return sectors_io(sec_num, 1, buffer, false) < 0 ? 1 : 0;
+}
+
 int sector_write(sector_t sec_num, const void *buffer) {
-    if(pthread_mutex_lock(&mutex) != 0) {
-        printf("write sector %lu error: lock failed.\n", sec_num);
-        return 1;
+    return sectors_io(sec_num, 1, (void*)buffer, true) < 0 ? 1 : 0;
+}
+
+int sectors_read(sector_t sec, size_t count, void* buffer) {
+    return sectors_io(sec, count, buffer, false);
+}
+
+int sectors_write(sector_t sec, size_t count, const void* buffer) {
+    return sectors_io(sec, count, (void*)buffer, true);
+}
+
+void init_disk(const char* path, uint64_t seek_time_us) {
+    init_disk_striped(&path, 1, 0, seek_time_us);
+}
+
+/**
+ * @brief 打开 count 个成员镜像，组成按 stripe_sectors 个扇区条带化的逻辑卷，count 为 1 时 stripe_sectors 不使用。
+ *        逻辑卷的大小取决于最小的成员，打开失败时退出。
+ */
+void init_disk_striped(const char* const* paths, size_t count, size_t stripe_sectors, uint64_t seek_time_us) {
+    if(count == 0 || count > MAX_MEMBERS || (count > 1 && stripe_sectors == 0)) {
+        fprintf(stderr, "Bad stripe: %lu images of %lu sectors\n", count, stripe_sectors);
+        exit(EINVAL);
     }
-    seek_to(sec_num);
-    ssize_t ret = pwrite(fd, buffer, PHYSICAL_SECTOR_SIZE, sec_num * PHYSICAL_SECTOR_SIZE);
-    pthread_mutex_unlock(&mutex);
-    if(ret != PHYSICAL_SECTOR_SIZE) {
-        printf("write sector %lu error: image write failed.\n", sec_num);
-        return 1;
+    sector_t smallest = UINT64_MAX;
+    for(size_t i = 0; i < count; i++) {
+        Member* m = &di.members[i];
+        m->fd = open(paths[i], O_RDWR | O_DSYNC);
+        if(m->fd < 0) {
+            fprintf(stderr, "Open image file %s failed: %s\n", paths[i], strerror(errno));
+            exit(ENOENT);
+        }
+        m->path = strdup(paths[i]);
+        pthread_mutex_init(&m->mutex, NULL);
+        m->last_track = 0;
+        m->buffered_track = -1;
+        smallest = min(smallest, (sector_t)lseek(m->fd, 0, SEEK_END) / PHYSICAL_SECTOR_SIZE);
+    }
+    di.nmembers = count;
+    di.stripe = count > 1 ? stripe_sectors : 1;
+    di.model = MODEL_LINEAR;
+    di.seek_time_us = seek_time_us;
+    di.total_track = smallest / di.stripe * di.stripe * count / SEC_PER_TRACK;
+    // 默认的 timer slack 是 50us，会让短的睡眠明显变长；之后创建的线程会继承这个设置
+    prctl(PR_SET_TIMERSLACK, 1, 0, 0, 0);
+}
+
+/**
+ * @brief 重新打开镜像，打开或关闭 O_DSYNC。有写前日志时每个扇区不需要同步写，由日志调用 disk_flush。
+ *        需要在 fuse_main 之前调用（之后工作目录可能改变）。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int disk_set_dsync(bool dsync) {
+    for(size_t i = 0; i < di.nmembers; i++) {
+        Member* m = &di.members[i];
+        int nfd = open(m->path, O_RDWR | (dsync ? O_DSYNC : 0));
+        if(nfd < 0) {
+            return -errno;
+        }
+        pthread_mutex_lock(&m->mutex);
+        close(m->fd);
+        m->fd = nfd;
+        pthread_mutex_unlock(&m->mutex);
     }
     return 0;
 }
 
-void init_disk(const char* path, uint64_t seek_time_ns) {
-    fd = open(path, O_RDWR | O_DSYNC);
-    if(fd < 0) {
-        fprintf(stderr, "Open image file %s failed: %s\n", path, strerror(errno));
-        exit(ENOENT);
+/**
+ * @brief 把镜像中已写入的数据同步到存储设备
+ */
+int disk_flush(void) {
+    for(size_t i = 0; i < di.nmembers; i++) {
+        if(fdatasync(di.members[i].fd) < 0) {
+            return -errno;
+        }
     }
-    di.seek_time_us = seek_time_ns;
-    di.last_track = 0;
-    di.total_track = lseek(fd, 0, SEEK_END) / PHYSICAL_SECTOR_SIZE / SEC_PER_TRACK;
+    return 0;
 }
 
-typedef struct {
-    const char* image_path;
-    uint64_t seek_time_us;
-} Options;
-
-#define OPTION(t, p) { t, offsetof(Options, p), 1 }
-static const struct fuse_opt option_spec[] = {
-    OPTION("--img=%s", image_path),
-    OPTION("--seek_time=%lu", seek_time_us),
-    FUSE_OPT_END
-};
+/**
+ * @brief 镜像文件的 fstat。条带化时是第一个成员的 fstat，st_size 为所有成员的大小之和，
+ *        st_mtim 为最晚修改的成员的修改时间。
+ */
+int disk_stat(struct stat* st) {
+    for(size_t i = 0; i < di.nmembers; i++) {
+        struct stat ms;
+        if(fstat(di.members[i].fd, &ms) < 0) {
+            return -errno;
+        }
+        if(i == 0) {
+            *st = ms;
+            continue;
+        }
+        st->st_size += ms.st_size;
+        if(ms.st_mtim.tv_sec > st->st_mtim.tv_sec
+                || (ms.st_mtim.tv_sec == st->st_mtim.tv_sec && ms.st_mtim.tv_nsec > st->st_mtim.tv_nsec)) {
+            st->st_mtim = ms.st_mtim;
+        }
+    }
+    return 0;
+}
 
-extern struct fuse_operations fat16_oper;
-
-int main(int argc, char *argv[])
-{   
-    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
-    Options opts;
-    opts.image_path = strdup(DEFAULT_IMAGE);
-    opts.seek_time_us = 0;
-    int ret = fuse_opt_parse(&args, &opts, option_spec, NULL);
-    if(ret < 0) {
-        return EXIT_FAILURE;
-    }
-    init_disk(opts.image_path, opts.seek_time_us);
-    ret = fuse_main(args.argc, args.argv, &fat16_oper, NULL);
-    fuse_opt_free_args(&args);
-    return ret;
-}
\ No newline at end of file
+/**
+ * @brief 选择时间模型，需要在 init_disk 之后、开始读写之前调用。参数为 0 的项使用默认值。
+ *
+ * @return int 成功返回0，模型名未知返回 -EINVAL
+ */
+int disk_set_timing(const DiskTiming* timing) {
+    int model = -1;
+    for(int i = 0; i < (int)(sizeof(MODEL_NAMES) / sizeof(MODEL_NAMES[0])); i++) {
+        if(strcmp(timing->model, MODEL_NAMES[i]) == 0) {
+            model = i;
+        }
+    }
+    if(model < 0) {
+        return -EINVAL;
+    }
+    di.model = model;
+    di.seek_time_us = timing->seek_time_us;
+    di.settle_time_us = timing->settle_time_us;
+    di.seek_knee = timing->seek_knee ? timing->seek_knee : 16;
+    di.rpm = timing->rpm ? timing->rpm : 7200;
+    di.ssd_latency_us = timing->ssd_latency_us ? timing->ssd_latency_us : 50;
+    di.ssd_channels = timing->ssd_channels ? timing->ssd_channels : 8;
+    for(size_t i = 0; i < di.nmembers; i++) {
+        free(di.members[i].channel_busy);
+        di.members[i].channel_busy = calloc(di.ssd_channels, sizeof(uint64_t));
+    }
+    return 0;
+}
+
+/**
+ * @brief 告诉模拟磁盘各区域的起始扇区，用于把 I/O 归类，在文件系统初始化时调用
+ */
+void disk_set_layout(sector_t fat_sec, sector_t root_sec, sector_t data_sec) {
+    pthread_mutex_lock(&hm_mutex);
+    hm.fat_sec = fat_sec;
+    hm.root_sec = root_sec;
+    hm.data_sec = data_sec;
+    pthread_mutex_unlock(&hm_mutex);
+}
+
+/**
+ * @brief 开始记录热力图，卸载时由 disk_heatmap_dump 写入 path。需要在 init_disk 之后调用。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int disk_enable_heatmap(const char* path) {
+    // 在这里打开文件：fuse_main 转入后台后工作目录会变成 /
+    FILE* f = fopen(path, "w");
+    if(f == NULL) {
+        return -errno;
+    }
+    pthread_mutex_lock(&hm_mutex);
+    hm.file = f;
+    hm.tracks = calloc((di.total_track + 1) * 2 * IO_CATEGORIES, sizeof(uint64_t));
+    hm.enabled = true;
+    pthread_mutex_unlock(&hm_mutex);
+    return 0;
+}
+
+/**
+ * @brief 以 CSV 输出热力图，返回 malloc 分配的字符串。
+ *
+ * 每行是 type,rw,category,key,count：type 为 track 时 key 是磁道号，count 是访问该磁道的扇区数；
+ * type 为 seek 时 key 是寻道距离所在区间的下界（0 表示没有寻道），count 是该区间的寻道次数。
+ */
+char* disk_heatmap_render(size_t* len) {
+    char* buf;
+    FILE* out = open_memstream(&buf, len);
+    fprintf(out, "type,rw,category,key,count\n");
+    pthread_mutex_lock(&hm_mutex);
+    if(hm.enabled) {
+        for(long t = 0; t <= di.total_track; t++) {
+            for(int w = 0; w < 2; w++) {
+                for(int c = 0; c < IO_CATEGORIES; c++) {
+                    uint64_t n = hm.tracks[(t * 2 + w) * IO_CATEGORIES + c];
+                    if(n != 0) {
+                        fprintf(out, "track,%s,%s,%ld,%lu\n", w ? "write" : "read", IO_CATEGORY_NAMES[c], t, n);
+                    }
+                }
+            }
+        }
+        for(int w = 0; w < 2; w++) {
+            for(int c = 0; c < IO_CATEGORIES; c++) {
+                for(int b = 0; b < SEEK_BUCKETS; b++) {
+                    uint64_t n = hm.seeks[w][c][b];
+                    if(n != 0) {
+                        fprintf(out, "seek,%s,%s,%lu,%lu\n", w ? "write" : "read", IO_CATEGORY_NAMES[c],
+                                b == 0 ? 0ul : 1ul << (b - 1), n);
+                    }
+                }
+            }
+        }
+    }
+    pthread_mutex_unlock(&hm_mutex);
+    fclose(out);
+    return buf;
+}
+
+/**
+ * @brief 把热力图写入 --heatmap 指定的文件，卸载时调用
+ */
+void disk_heatmap_dump(void) {
+    if(hm.file == NULL) {
+        return;
+    }
+    size_t len;
+    char* csv = disk_heatmap_render(&len);
+    fwrite(csv, 1, len, hm.file);
+    fclose(hm.file);
+    hm.file = NULL;
+    free(csv);
+}
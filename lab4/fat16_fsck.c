@@ -0,0 +1,528 @@
+/**
+ * fat16_fsck: 离线检查 FAT16/FAT32 镜像的一致性。
+ *
+ * 用法: fat16_fsck [-r] [-v] [-c] [-j 线程数] <镜像>
+ *   -r  修复：释放丢失的簇链（FAT 中已分配、但没有任何目录项引用的簇）
+ *   -v  打印每一个被检查的目录
+ *   -c  读出每个文件的内容，打印校验和、大小和路径（顺序不固定），用于比较整理等操作前后的内容
+ *   -j  遍历目录树所用的线程数，默认为 CPU 核数
+ *
+ * 检查内容：
+ *   1. 所有 FAT 副本是否一致
+ *   2. 目录树中每条簇链是否合法（越界、指向空闲簇、成环）
+ *   3. 是否有簇同时属于多条簇链（交叉链接）
+ *   4. 文件大小与簇链长度是否匹配
+ *   5. 是否有丢失的簇链
+ *   6. FAT32 的 FSInfo 中的空闲簇数是否准确（只是提示，不算错误，-r 时更新）
+ *
+ * 返回值与 fsck 约定相同：0 无错误，1 错误已修复，4 仍有错误，8 运行失败。
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fat16_image.h"
+
+#define FSCK_OK         0
+#define FSCK_FIXED      1
+#define FSCK_UNCORRECTED 4
+#define FSCK_ERROR      8
+
+/* 目录遍历任务，每个任务对应一个待检查的目录 */
+typedef struct DirJob {
+    cluster_t clus;             // 目录第一个簇，FAT16 的根目录为 0
+    cluster_t parent;           // 父目录第一个簇，父目录为根目录时为 0
+    char* path;
+    struct DirJob* next;
+} DirJob;
+
+typedef struct {
+    Fat16Image img;
+    bool verbose;
+    bool checksum;
+
+    uint32_t* owner;            // 每个簇所属簇链的编号，0 表示未被引用
+
+    pthread_mutex_t lock;       // 保护任务队列和簇链名表
+    pthread_cond_t cond;
+    DirJob* jobs;
+    size_t pending;             // 尚未完成的任务数（含正在处理的）
+
+    char** chain_names;         // 簇链编号 -> 路径
+    uint32_t chain_count;
+    uint32_t chain_capacity;
+
+    pthread_mutex_t print_lock;
+
+    // 统计
+    uint32_t files;
+    uint32_t dirs;
+    uint32_t errors;
+    bool crosslinked;           // 存在交叉链接时不释放丢失的簇链，以免误删仍在使用的数据
+} Checker;
+
+static Checker ck;
+
+static void report(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+static void report(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    pthread_mutex_lock(&ck.print_lock);
+    vprintf(fmt, ap);
+    pthread_mutex_unlock(&ck.print_lock);
+    va_end(ap);
+    __atomic_fetch_add(&ck.errors, 1, __ATOMIC_RELAXED);
+}
+
+static uint32_t new_chain(const char* path) {
+    pthread_mutex_lock(&ck.lock);
+    if(ck.chain_count == ck.chain_capacity) {
+        ck.chain_capacity = ck.chain_capacity ? ck.chain_capacity * 2 : 1024;
+        ck.chain_names = realloc(ck.chain_names, ck.chain_capacity * sizeof(char*));
+    }
+    uint32_t id = ++ck.chain_count;     // 编号从 1 开始
+    ck.chain_names[id - 1] = strdup(path);
+    pthread_mutex_unlock(&ck.lock);
+    return id;
+}
+
+static const char* chain_name(uint32_t id) {
+    pthread_mutex_lock(&ck.lock);
+    const char* name = ck.chain_names[id - 1];
+    pthread_mutex_unlock(&ck.lock);
+    return name;
+}
+
+/**
+ * @brief 沿 FAT 表认领从 first 开始的簇链。已被其它链认领的簇视为交叉链接，
+ *        但仍会继续沿链走下去，保证交叉链接的目录中的内容也能被检查到。
+ *
+ * @param first     簇链的第一个簇
+ * @param path      簇链所属文件/目录的路径，用于报告
+ * @param clusters  输出参数，若不为 NULL，依次存入链上的簇号（调用者负责释放）
+ * @param head_taken 输出参数，若不为 NULL，第一个簇已被其它链认领时置为 true，此时不再沿链走下去
+ * @return size_t   簇链长度
+ */
+static size_t claim_chain(cluster_t first, const char* path, cluster_t** clusters, bool* head_taken) {
+    Fat16Image* img = &ck.img;
+    uint32_t id = new_chain(path);
+    size_t len = 0, cap = 0;
+    bool crossed = false;
+    if(clusters != NULL) {
+        *clusters = NULL;
+    }
+    if(head_taken != NULL) {
+        *head_taken = false;
+    }
+
+    cluster_t clus = first;
+    while(true) {
+        if(!image_cluster_valid(img, clus)) {
+            report("%s: chain references invalid cluster %u\n", path, clus);
+            break;
+        }
+        if(len >= img->clusters) {
+            report("%s: chain loops back to cluster %u\n", path, clus);
+            break;
+        }
+        uint32_t expected = 0;
+        if(!__atomic_compare_exchange_n(&ck.owner[clus], &expected, id, false,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            if(expected == id) {
+                report("%s: chain loops back to cluster %u\n", path, clus);
+                break;
+            }
+            if(!crossed) {
+                report("%s: cluster %u is cross-linked with %s\n", path, clus, chain_name(expected));
+                crossed = true;
+                __atomic_store_n(&ck.crosslinked, true, __ATOMIC_RELAXED);
+            }
+            if(len == 0 && head_taken != NULL) {
+                *head_taken = true;
+                break;
+            }
+        }
+        if(clusters != NULL) {
+            if(len == cap) {
+                cap = cap ? cap * 2 : 16;
+                *clusters = realloc(*clusters, cap * sizeof(cluster_t));
+            }
+            (*clusters)[len] = clus;
+        }
+        len++;
+
+        cluster_t next = img->fat[clus];
+        if(next >= CLUSTER_END_BOUND) {
+            break;
+        }
+        if(next == CLUSTER_FREE) {
+            report("%s: cluster %u links to a free cluster\n", path, clus);
+            break;
+        }
+        if(next == CLUSTER_BAD) {
+            report("%s: cluster %u links to a bad cluster\n", path, clus);
+            break;
+        }
+        clus = next;
+    }
+    return len;
+}
+
+static void push_job(cluster_t clus, cluster_t parent, char* path) {
+    DirJob* job = malloc(sizeof(DirJob));
+    job->clus = clus;
+    job->parent = parent;
+    job->path = path;
+    pthread_mutex_lock(&ck.lock);
+    job->next = ck.jobs;
+    ck.jobs = job;
+    ck.pending++;
+    pthread_cond_signal(&ck.cond);
+    pthread_mutex_unlock(&ck.lock);
+}
+
+/**
+ * @brief 打印文件前 size 字节的 FNV-1a 校验和
+ */
+static void print_checksum(const cluster_t* clusters, size_t n, uint32_t size, const char* path) {
+    Fat16Image* img = &ck.img;
+    char* buffer = malloc(img->cluster_size);
+    uint64_t h = 0xcbf29ce484222325ull;
+    size_t left = size;
+    for(size_t i = 0; i < n && left > 0; i++) {
+        if(image_read(img, image_cluster_sector(img, clusters[i]), img->sec_per_clus, buffer) < 0) {
+            report("%s: failed to read cluster %u\n", path, clusters[i]);
+            break;
+        }
+        size_t len = min(left, (size_t)img->cluster_size);
+        for(size_t k = 0; k < len; k++) {
+            h = (h ^ (uint8_t)buffer[k]) * 0x100000001b3ull;
+        }
+        left -= len;
+    }
+    free(buffer);
+    pthread_mutex_lock(&ck.print_lock);
+    printf("%016lx %10u %s\n", h, size, path);
+    pthread_mutex_unlock(&ck.print_lock);
+}
+
+static void check_file(const DIR_ENTRY* dir, const char* path) {
+    Fat16Image* img = &ck.img;
+    cluster_t first = dir_entry_cluster(dir);
+    size_t expected = (dir->DIR_FileSize + img->cluster_size - 1) / img->cluster_size;
+    size_t len = 0;
+    cluster_t* clusters = NULL;
+    if(first != CLUSTER_FREE) {
+        len = claim_chain(first, path, ck.checksum ? &clusters : NULL, NULL);
+    }
+    if(len != expected) {
+        report("%s: file size %u needs %zu clusters, but chain has %zu\n",
+               path, dir->DIR_FileSize, expected, len);
+    }
+    if(ck.checksum) {
+        print_checksum(clusters, len, dir->DIR_FileSize, path);
+        free(clusters);
+    }
+    __atomic_fetch_add(&ck.files, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 检查一个目录扇区中的所有目录项，子目录作为新任务加入队列。
+ *
+ * @return bool 遇到空项（目录结束）时返回 false
+ */
+static bool check_entries(const DirJob* job, const char* buffer, size_t size) {
+    char name[FAT_NAME_LEN + 2];
+    for(size_t off = 0; off < size; off += DIR_ENTRY_SIZE) {
+        const DIR_ENTRY* dir = (const DIR_ENTRY*)(buffer + off);
+        if(dir->DIR_Name[0] == NAME_FREE) {
+            return false;
+        }
+        if(dir->DIR_Name[0] == NAME_DELETED || dir->DIR_Attr == ATTR_LFN
+                || (dir->DIR_Attr & ATTR_VOLUME) != 0) {
+            continue;
+        }
+
+        if(memcmp(dir->DIR_Name, ".          ", FAT_NAME_LEN) == 0) {
+            if(dir_entry_cluster(dir) != job->clus) {
+                report("%s: '.' points to cluster %u instead of %u\n",
+                       job->path, dir_entry_cluster(dir), job->clus);
+            }
+            continue;
+        }
+        if(memcmp(dir->DIR_Name, "..         ", FAT_NAME_LEN) == 0) {
+            if(dir_entry_cluster(dir) != job->parent) {
+                report("%s: '..' points to cluster %u instead of %u\n",
+                       job->path, dir_entry_cluster(dir), job->parent);
+            }
+            continue;
+        }
+
+        fat_name_to_str(dir->DIR_Name, name);
+        char* path = join_path(job->path, name);
+        if((dir->DIR_Attr & ATTR_DIRECTORY) != 0) {
+            if(dir_entry_cluster(dir) == CLUSTER_FREE) {
+                report("%s: directory has no cluster\n", path);
+                free(path);
+                continue;
+            }
+            // 按约定，根目录的子目录中 .. 指向 0（FAT32 也是如此）
+            push_job(dir_entry_cluster(dir), job->clus == ck.img.root_clus ? 0 : job->clus, path);
+        } else {
+            check_file(dir, path);
+            free(path);
+        }
+    }
+    return true;
+}
+
+static void check_dir(const DirJob* job) {
+    Fat16Image* img = &ck.img;
+    if(ck.verbose) {
+        pthread_mutex_lock(&ck.print_lock);
+        printf("checking %s\n", job->path);
+        pthread_mutex_unlock(&ck.print_lock);
+    }
+    __atomic_fetch_add(&ck.dirs, 1, __ATOMIC_RELAXED);
+
+    if(job->clus == 0) {
+        // FAT16 的根目录位于固定区域
+        size_t size = (size_t)img->root_sectors * img->sector_size;
+        char* buffer = malloc(size);
+        if(image_read(img, img->root_sec, img->root_sectors, buffer) < 0) {
+            report("%s: failed to read root directory\n", job->path);
+        } else {
+            check_entries(job, buffer, size);
+        }
+        free(buffer);
+        return;
+    }
+
+    // 第一个簇已被认领的目录（例如指向祖先目录的项）不再重复检查，避免无限递归
+    cluster_t* clusters;
+    bool head_taken;
+    size_t n = claim_chain(job->clus, job->path, &clusters, &head_taken);
+    char* buffer = malloc(img->cluster_size);
+    for(size_t i = 0; i < n; i++) {
+        if(image_read(img, image_cluster_sector(img, clusters[i]), img->sec_per_clus, buffer) < 0) {
+            report("%s: failed to read cluster %u\n", job->path, clusters[i]);
+            break;
+        }
+        if(!check_entries(job, buffer, img->cluster_size)) {
+            break;
+        }
+    }
+    free(buffer);
+    free(clusters);
+}
+
+static void* worker(void* arg) {
+    pthread_mutex_lock(&ck.lock);
+    while(true) {
+        while(ck.jobs == NULL && ck.pending > 0) {
+            pthread_cond_wait(&ck.cond, &ck.lock);
+        }
+        if(ck.jobs == NULL) {
+            break;      // 没有待处理任务，也没有正在处理的任务
+        }
+        DirJob* job = ck.jobs;
+        ck.jobs = job->next;
+        pthread_mutex_unlock(&ck.lock);
+
+        check_dir(job);
+        free(job->path);
+        free(job);
+
+        pthread_mutex_lock(&ck.lock);
+        if(--ck.pending == 0) {
+            pthread_cond_broadcast(&ck.cond);
+        }
+    }
+    pthread_mutex_unlock(&ck.lock);
+    return NULL;
+}
+
+static void check_fat_copies(void) {
+    Fat16Image* img = &ck.img;
+    size_t size = (size_t)img->sec_per_fat * img->sector_size;
+    char* first = malloc(size);
+    char* buffer = malloc(size);
+    if(image_read(img, img->fat_sec, img->sec_per_fat, first) < 0) {
+        report("failed to read the first FAT\n");
+    } else {
+        for(size_t i = 1; i < img->fats; i++) {
+            if(image_read(img, img->fat_sec + i * img->sec_per_fat, img->sec_per_fat, buffer) < 0) {
+                report("failed to read FAT copy %zu\n", i);
+                continue;
+            }
+            if(memcmp(buffer, first, size) != 0) {
+                report("FAT copy %zu differs from the first FAT\n", i);
+            }
+        }
+    }
+    free(first);
+    free(buffer);
+}
+
+/**
+ * @brief 找出所有丢失的簇（已分配但没有被认领），repair 为真时将其释放。
+ *
+ * @return uint32_t 丢失的簇数
+ */
+static uint32_t check_lost_chains(bool repair, uint32_t* lost_chains) {
+    Fat16Image* img = &ck.img;
+    cluster_t last = img->clusters + CLUSTER_MIN;
+    uint8_t* referenced = calloc(last, 1);
+    uint32_t lost = 0;
+
+    for(cluster_t clus = CLUSTER_MIN; clus < last; clus++) {
+        cluster_t next = img->fat[clus];
+        if(ck.owner[clus] == 0 && next != CLUSTER_FREE && next != CLUSTER_BAD
+                && image_cluster_valid(img, next)) {
+            referenced[next] = 1;
+        }
+    }
+    *lost_chains = 0;
+    for(cluster_t clus = CLUSTER_MIN; clus < last; clus++) {
+        cluster_t next = img->fat[clus];
+        if(ck.owner[clus] != 0 || next == CLUSTER_FREE || next == CLUSTER_BAD) {
+            continue;
+        }
+        lost++;
+        if(!referenced[clus]) {
+            (*lost_chains)++;
+        }
+        if(repair) {
+            img->fat[clus] = CLUSTER_FREE;
+        }
+    }
+    free(referenced);
+    return lost;
+}
+
+/**
+ * @brief 检查 FAT32 FSInfo 中的空闲簇数，repair 为真时更新为实际值。
+ *
+ * @return bool FSInfo 被更新时返回 true
+ */
+static bool check_fsinfo(bool repair) {
+    Fat16Image* img = &ck.img;
+    FSINFO info;
+    if(img->fsinfo_sec == 0 || image_read(img, img->fsinfo_sec, 1, &info) < 0
+            || info.FSI_LeadSig != FSINFO_LEAD_SIG || info.FSI_StrucSig != FSINFO_STRUC_SIG) {
+        return false;
+    }
+    uint32_t actual = image_count_free(img);
+    if(info.FSI_Free_Count == actual) {
+        return false;
+    }
+    if(info.FSI_Free_Count == FSINFO_UNKNOWN) {
+        printf("FSInfo free count is unknown, actual %u%s\n", actual, repair ? ", updated" : "");
+    } else {
+        printf("FSInfo free count %u, actual %u%s\n", info.FSI_Free_Count, actual, repair ? ", updated" : "");
+    }
+    if(!repair) {
+        return false;
+    }
+    info.FSI_Free_Count = actual;
+    return image_write(img, img->fsinfo_sec, 1, &info) == 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-r] [-v] [-c] [-j threads] <image>\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    bool repair = false;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while((opt = getopt(argc, argv, "rvcj:")) != -1) {
+        switch(opt) {
+        case 'r': repair = true; break;
+        case 'v': ck.verbose = true; break;
+        case 'c': ck.checksum = true; break;
+        case 'j': threads = atol(optarg); break;
+        default: usage(argv[0]); return FSCK_ERROR;
+        }
+    }
+    if(optind != argc - 1 || threads <= 0) {
+        usage(argv[0]);
+        return FSCK_ERROR;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Fat16Image* img = &ck.img;
+    const char* path = argv[optind];
+    int ret = image_open(img, path, repair);
+    if(ret == 0) {
+        ret = image_load_fat(img);
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot load FAT image: %s\n", path, strerror(-ret));
+        return FSCK_ERROR;
+    }
+
+    pthread_mutex_init(&ck.lock, NULL);
+    pthread_mutex_init(&ck.print_lock, NULL);
+    pthread_cond_init(&ck.cond, NULL);
+    ck.owner = calloc(img->clusters + CLUSTER_MIN, sizeof(uint32_t));
+
+    check_fat_copies();
+    uint32_t fat_errors = ck.errors;
+
+    // 从根目录开始，由线程池并行遍历整棵目录树
+    push_job(img->root_clus, 0, strdup("/"));
+    pthread_t* tids = malloc(threads * sizeof(pthread_t));
+    for(long i = 0; i < threads; i++) {
+        pthread_create(&tids[i], NULL, worker, NULL);
+    }
+    for(long i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+
+    uint32_t lost_chains;
+    bool free_lost = repair && !ck.crosslinked;
+    uint32_t lost = check_lost_chains(free_lost, &lost_chains);
+    if(lost > 0) {
+        printf("%u lost clusters in %u chains%s\n", lost, lost_chains,
+               free_lost ? ", freed" : (repair ? ", not freed because of cross-links" : ""));
+    }
+    // 写回 FAT 时所有副本都会被同步
+    bool fixed = (free_lost && lost > 0) || (repair && fat_errors > 0);
+    if(fixed) {
+        ret = image_flush_fat(img);
+        if(ret < 0) {
+            fprintf(stderr, "%s: failed to write FAT: %s\n", path, strerror(-ret));
+            image_close(img);
+            return FSCK_ERROR;
+        }
+    }
+
+    // FSInfo 只是提示，不一致不算错误
+    bool fsinfo_fixed = check_fsinfo(repair);
+
+    uint32_t used = img->clusters - image_count_free(img);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%s: %u files, %u directories, %u/%u clusters, %.3fs\n",
+           path, ck.files, ck.dirs, used, img->clusters, elapsed);
+
+    image_close(img);
+
+    // 除了丢失簇链和 FAT 副本不一致，其它错误都不会被修复
+    uint32_t remaining = ck.errors - (fixed ? fat_errors : 0);
+    if(remaining > 0) {
+        return FSCK_UNCORRECTED;
+    }
+    if(lost > 0) {
+        return free_lost ? FSCK_FIXED : FSCK_UNCORRECTED;
+    }
+    return fixed || fsinfo_fixed ? FSCK_FIXED : FSCK_OK;
+}
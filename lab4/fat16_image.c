@@ -0,0 +1,195 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fat16_image.h"
+
+/**
+ * @brief 打开镜像并读取 BPB，计算各区域的位置。FAT 表需要另外调用 image_load_fat 读入。
+ *
+ * @param img       输出参数，卷信息
+ * @param path      镜像路径
+ * @param writable  是否以读写方式打开
+ * @return int      成功返回0，失败返回POSIX错误代码的负值
+ */
+int image_open(Fat16Image* img, const char* path, bool writable) {
+    memset(img, 0, sizeof(Fat16Image));
+    img->path = path;
+    img->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if(img->fd < 0) {
+        return -errno;
+    }
+
+    if(pread(img->fd, &img->bpb, sizeof(BPB_BS), 0) != sizeof(BPB_BS)) {
+        close(img->fd);
+        return -EIO;
+    }
+
+    BPB_BS* bpb = &img->bpb;
+    img->sector_size = bpb->BPB_BytsPerSec;
+    img->sec_per_clus = bpb->BPB_SecPerClus;
+    img->reserved = bpb->BPB_RsvdSecCnt;
+    img->fats = bpb->BPB_NumFATS;
+    img->dir_entries = bpb->BPB_RootEntCnt;
+    img->sectors = bpb->BPB_TotSec16 != 0 ? bpb->BPB_TotSec16 : bpb->BPB_TotSec32;
+    img->sec_per_fat = bpb->BPB_FATSz16;
+    img->fat_bits = 16;
+    if(bpb->BPB_FATSz16 == 0) {
+        // 与 Linux 相同，BPB_FATSz16 为 0 的卷是 FAT32，根目录是普通的簇链
+        const BPB32_BS* bpb32 = (const BPB32_BS*)bpb;
+        img->fat_bits = 32;
+        img->sec_per_fat = bpb32->BPB_FATSz32;
+        img->root_clus = bpb32->BPB_RootClus;
+        img->fsinfo_sec = bpb32->BPB_FSInfo;
+        img->dir_entries = 0;
+    }
+
+    // 只支持与模拟磁盘相同的 512 字节扇区
+    if(img->sector_size != PHYSICAL_SECTOR_SIZE || img->sec_per_clus == 0
+            || (img->sec_per_clus & (img->sec_per_clus - 1)) != 0
+            || img->fats == 0 || img->sec_per_fat == 0) {
+        close(img->fd);
+        return -EINVAL;
+    }
+
+    img->fat_sec = img->reserved;
+    img->root_sec = img->fat_sec + (img->fats * img->sec_per_fat);
+    img->root_sectors = (img->dir_entries * DIR_ENTRY_SIZE + img->sector_size - 1) / img->sector_size;
+    img->data_sec = img->root_sec + img->root_sectors;
+    if(img->data_sec >= img->sectors) {
+        close(img->fd);
+        return -EINVAL;
+    }
+    img->clusters = (img->sectors - img->data_sec) / img->sec_per_clus;
+    img->cluster_size = img->sec_per_clus * img->sector_size;
+
+    // FAT 表必须能容纳所有簇，FAT32 的根目录必须在数据区内
+    if((size_t)(img->clusters + 2) * (img->fat_bits / 8) > (size_t)img->sec_per_fat * img->sector_size
+            || (img->fat_bits == 32 && !image_cluster_valid(img, img->root_clus))) {
+        close(img->fd);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void image_close(Fat16Image* img) {
+    free(img->fat);
+    img->fat = NULL;
+    if(img->fd >= 0) {
+        close(img->fd);
+    }
+    img->fd = -1;
+}
+
+int image_read(Fat16Image* img, sector_t sec, size_t count, void* buffer) {
+    size_t len = count * img->sector_size;
+    ssize_t ret = pread(img->fd, buffer, len, sec * img->sector_size);
+    if(ret != (ssize_t)len) {
+        return ret < 0 ? -errno : -EIO;
+    }
+    return 0;
+}
+
+int image_write(Fat16Image* img, sector_t sec, size_t count, const void* buffer) {
+    size_t len = count * img->sector_size;
+    ssize_t ret = pwrite(img->fd, buffer, len, sec * img->sector_size);
+    if(ret != (ssize_t)len) {
+        return ret < 0 ? -errno : -EIO;
+    }
+    return 0;
+}
+
+/**
+ * @brief 一次性读入第一个 FAT 表，并把表项换算为 cluster_t。
+ */
+int image_load_fat(Fat16Image* img) {
+    size_t entries = (size_t)img->clusters + CLUSTER_MIN;
+    void* raw = malloc((size_t)img->sec_per_fat * img->sector_size);
+    free(img->fat);
+    img->fat = malloc(entries * sizeof(cluster_t));
+    if(raw == NULL || img->fat == NULL) {
+        free(raw);
+        return -ENOMEM;
+    }
+    int ret = image_read(img, img->fat_sec, img->sec_per_fat, raw);
+    for(size_t i = 0; ret == 0 && i < entries; i++) {
+        uint32_t v = img->fat_bits == 32 ? ((uint32_t*)raw)[i] : ((uint16_t*)raw)[i];
+        img->fat[i] = i < CLUSTER_MIN ? v : fat_entry_decode(v, img->fat_bits);
+    }
+    free(raw);
+    return ret;
+}
+
+/**
+ * @brief 将内存中的 FAT 表写回所有 FAT 副本，每个副本只写一次。
+ *        FAT32 表项的高 4 位和 FAT 表末尾多余的部分保持第一个副本中原来的内容。
+ */
+int image_flush_fat(Fat16Image* img) {
+    void* raw = malloc((size_t)img->sec_per_fat * img->sector_size);
+    if(raw == NULL) {
+        return -ENOMEM;
+    }
+    int ret = image_read(img, img->fat_sec, img->sec_per_fat, raw);
+    for(size_t i = 0; ret == 0 && i < (size_t)img->clusters + CLUSTER_MIN; i++) {
+        if(img->fat_bits == 32) {
+            uint32_t* entry = (uint32_t*)raw + i;
+            *entry = (*entry & ~FAT32_ENTRY_MASK) | fat_entry_encode(img->fat[i], 32);
+        } else {
+            ((uint16_t*)raw)[i] = fat_entry_encode(img->fat[i], 16);
+        }
+    }
+    for(size_t i = 0; ret == 0 && i < img->fats; i++) {
+        ret = image_write(img, img->fat_sec + i * img->sec_per_fat, img->sec_per_fat, raw);
+    }
+    free(raw);
+    return ret;
+}
+
+/**
+ * @brief 内存中的 FAT 表里空闲簇的个数。解码后的表项与 FAT32 的原始表项一样按 32 位向量化扫描。
+ */
+uint32_t image_count_free(const Fat16Image* img) {
+    return fat_count_free(img->fat + CLUSTER_MIN, img->clusters, sizeof(cluster_t) * 8);
+}
+
+sector_t image_cluster_sector(const Fat16Image* img, cluster_t clus) {
+    return img->data_sec + (sector_t)(clus - CLUSTER_MIN) * img->sec_per_clus;
+}
+
+/**
+ * @brief 簇号是否落在该卷的数据区内
+ */
+bool image_cluster_valid(const Fat16Image* img, cluster_t clus) {
+    return CLUSTER_MIN <= clus && clus < img->clusters + CLUSTER_MIN && clus <= CLUSTER_MAX;
+}
+
+/**
+ * @brief 将 8+3 文件名转换为可读的文件名，与 simple_fat16.c 中的 to_longname 相同
+ *
+ * @param res 输出，至少 FAT_NAME_LEN + 2 字节
+ */
+void fat_name_to_str(const uint8_t fat_name[FAT_NAME_LEN], char* res) {
+    size_t i = 0;
+    for(size_t j = 0; j < FAT_NAME_BASE_LEN && fat_name[j] != ' '; j++) {
+        res[i++] = tolower(fat_name[j]);
+    }
+    if(fat_name[FAT_NAME_BASE_LEN] != ' ') {
+        res[i++] = '.';
+        for(size_t j = FAT_NAME_BASE_LEN; j < FAT_NAME_LEN && fat_name[j] != ' '; j++) {
+            res[i++] = tolower(fat_name[j]);
+        }
+    }
+    res[i] = '\0';
+}
+
+/**
+ * @brief 拼接目录路径和文件名，返回的字符串由调用者 free
+ */
+char* join_path(const char* dir, const char* name) {
+    size_t len = strlen(dir) + strlen(name) + 2;
+    char* path = malloc(len);
+    snprintf(path, len, "%s%s%s", dir, strcmp(dir, "/") == 0 ? "" : "/", name);
+    return path;
+}
@@ -0,0 +1,57 @@
+#ifndef FAT16_IMAGE_H
+#define FAT16_IMAGE_H
+
+#include "fat16.h"
+
+/**
+ * 离线工具（fsck、mkfs 等）直接访问镜像文件时使用的卷信息。
+ * 与 simple_fat16.c 中的 FAT16 结构体含义相同，但不经过模拟磁盘（没有寻道延迟）。
+ */
+typedef struct {
+    int fd;
+    const char* path;
+    BPB_BS bpb;
+
+    uint32_t sector_size;           // 逻辑扇区大小（字节）
+    uint32_t sec_per_clus;          // 每簇扇区数
+    uint32_t reserved;              // 保留扇区数
+    uint32_t fats;                  // FAT表的数量
+    uint32_t dir_entries;           // 根目录项数量
+    uint32_t sectors;               // 文件系统总扇区数
+    uint32_t sec_per_fat;           // 每个FAT表所占扇区数
+
+    sector_t fat_sec;               // FAT表开始扇区
+    sector_t root_sec;              // 根目录区域开始扇区
+    uint32_t root_sectors;          // 根目录区域扇区数
+    sector_t data_sec;              // 数据区域开始扇区
+
+    uint32_t clusters;              // 文件系统簇数
+    uint32_t cluster_size;          // 簇大小（字节）
+
+    int fat_bits;                   // FAT 表项的位数，16 或 32
+    cluster_t root_clus;            // FAT32 根目录的第一个簇，FAT16 为 0
+    sector_t fsinfo_sec;            // FAT32 FSInfo 扇区，0 表示没有
+
+    // 内存中的 FAT 表（第一个副本），共 clusters + 2 项，已用 fat_entry_decode 换算；
+    // 第 0、1 项是保留项，保存磁盘上的原值
+    cluster_t* fat;
+} Fat16Image;
+
+int image_open(Fat16Image* img, const char* path, bool writable);
+void image_close(Fat16Image* img);
+
+int image_read(Fat16Image* img, sector_t sec, size_t count, void* buffer);
+int image_write(Fat16Image* img, sector_t sec, size_t count, const void* buffer);
+
+int image_load_fat(Fat16Image* img);
+int image_flush_fat(Fat16Image* img);
+
+uint32_t image_count_free(const Fat16Image* img);
+
+sector_t image_cluster_sector(const Fat16Image* img, cluster_t clus);
+bool image_cluster_valid(const Fat16Image* img, cluster_t clus);
+
+void fat_name_to_str(const uint8_t fat_name[FAT_NAME_LEN], char* res);
+char* join_path(const char* dir, const char* name);
+
+#endif
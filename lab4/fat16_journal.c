@@ -0,0 +1,386 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fat16.h"
+#include "fat16_journal.h"
+
+/**
+ * 写前意图日志（--journal=file）。
+ *
+ * 没有日志时镜像以 O_DSYNC 打开，每写一个扇区同步一次；即便如此，alloc_clusters 中途崩溃仍会留下
+ * 只连了一半的簇链。打开日志后，每个修改文件系统的 FUSE 操作是一个事务：
+ *   1. 操作中写的扇区先留在线程局部的事务里，同一线程之后读这些扇区时读到的是新内容；
+ *   2. 操作结束时把所有扇区作为一条记录顺序追加到日志，同步一次日志（提交）；
+ *   3. 再按扇区号顺序把这些扇区写回镜像，镜像不再同步写。
+ * 日志超过 JOURNAL_CHECKPOINT_BYTES 时同步镜像并清空日志（检查点）。挂载时重放日志中所有完整的记录。
+ *
+ * 目录簇和文件数据都在数据区，磁盘层分不出来，所以事务包括操作写的所有扇区，而不只是 FAT 和目录项。
+ * 一个事务超过 TXN_MAX_SECTORS 个扇区时提前提交一部分，这时崩溃最多留下未被引用的簇，不会留下坏链。
+ */
+
+#define JOURNAL_CHECKPOINT_BYTES (4 << 20)
+#define TXN_MAX_SECTORS 4096
+
+typedef struct {
+    int depth;                  // 嵌套的事务层数，为 0 时不在事务中
+    bool applying;              // 正在把事务写回镜像，这时的写直接进入镜像
+    size_t count;
+    size_t cap;
+    sector_t* secs;
+    char* data;                 // 第 i 个扇区的内容在 data + i * PHYSICAL_SECTOR_SIZE
+    uint32_t* slots;            // 开放寻址哈希表：扇区号 -> 下标 + 1，0 表示空
+    size_t slot_cap;            // 2 的幂
+} Txn;
+
+static __thread Txn txn;
+static int journal_fd = -1;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t journal_size;   // 日志文件当前长度
+static uint64_t journal_seq;
+static struct fuse_operations inner;
+
+static uint64_t fnv1a(uint64_t h, const void* data, size_t len) {
+    const uint8_t* p = data;
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
+static uint64_t record_checksum(const JournalRecord* rec, const void* payload, size_t len) {
+    JournalRecord r = *rec;
+    r.checksum = 0;
+    return fnv1a(fnv1a(0xcbf29ce484222325ull, &r, sizeof(r)), payload, len);
+}
+
+static size_t slot_of(sector_t sec) {
+    return (sec * 0x9E3779B97F4A7C15ull >> 32) & (txn.slot_cap - 1);
+}
+
+// 返回事务中 sec 的下标，不在事务中返回 -1
+static long txn_find(sector_t sec) {
+    if(txn.count == 0) {
+        return -1;
+    }
+    for(size_t s = slot_of(sec); txn.slots[s] != 0; s = (s + 1) & (txn.slot_cap - 1)) {
+        if(txn.secs[txn.slots[s] - 1] == sec) {
+            return txn.slots[s] - 1;
+        }
+    }
+    return -1;
+}
+
+static void txn_rehash(size_t slot_cap) {
+    free(txn.slots);
+    txn.slot_cap = slot_cap;
+    txn.slots = calloc(slot_cap, sizeof(uint32_t));
+    for(size_t i = 0; i < txn.count; i++) {
+        size_t s = slot_of(txn.secs[i]);
+        while(txn.slots[s] != 0) {
+            s = (s + 1) & (slot_cap - 1);
+        }
+        txn.slots[s] = i + 1;
+    }
+}
+
+static void txn_put(sector_t sec, const void* buffer) {
+    long i = txn_find(sec);
+    if(i < 0) {
+        if(txn.count == txn.cap) {
+            txn.cap = txn.cap ? txn.cap * 2 : 64;
+            txn.secs = realloc(txn.secs, txn.cap * sizeof(sector_t));
+            txn.data = realloc(txn.data, txn.cap * PHYSICAL_SECTOR_SIZE);
+        }
+        i = txn.count++;
+        txn.secs[i] = sec;
+        if(txn.count * 2 > txn.slot_cap) {
+            txn_rehash(max(txn.slot_cap * 2, (size_t)256));
+        } else {
+            size_t s = slot_of(sec);
+            while(txn.slots[s] != 0) {
+                s = (s + 1) & (txn.slot_cap - 1);
+            }
+            txn.slots[s] = i + 1;
+        }
+    }
+    memcpy(txn.data + i * PHYSICAL_SECTOR_SIZE, buffer, PHYSICAL_SECTOR_SIZE);
+}
+
+static int compare_index(const void* a, const void* b) {
+    sector_t x = txn.secs[*(const uint32_t*)a];
+    sector_t y = txn.secs[*(const uint32_t*)b];
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief 按扇区号顺序把事务写回镜像，扇区号连续的合并成一次写
+ */
+static int txn_apply(void) {
+    uint32_t* order = malloc(txn.count * sizeof(uint32_t));
+    char* run = malloc(min(txn.count, (size_t)256) * PHYSICAL_SECTOR_SIZE);
+    for(size_t i = 0; i < txn.count; i++) {
+        order[i] = i;
+    }
+    qsort(order, txn.count, sizeof(uint32_t), compare_index);
+    int ret = 0;
+    txn.applying = true;
+    for(size_t i = 0; i < txn.count && ret == 0; ) {
+        size_t n = 0;
+        do {
+            memcpy(run + n * PHYSICAL_SECTOR_SIZE, txn.data + order[i + n] * PHYSICAL_SECTOR_SIZE,
+                   PHYSICAL_SECTOR_SIZE);
+            n++;
+        } while(i + n < txn.count && n < 256 && txn.secs[order[i + n]] == txn.secs[order[i]] + n);
+        ret = sectors_write(txn.secs[order[i]], n, run);
+        i += n;
+    }
+    txn.applying = false;
+    free(run);
+    free(order);
+    return ret;
+}
+
+/**
+ * @brief 提交当前线程的事务：追加一条记录并同步日志，再写回镜像，必要时做检查点
+ */
+static int txn_commit(void) {
+    if(txn.count == 0) {
+        return 0;
+    }
+    size_t payload = txn.count * (sizeof(uint64_t) + PHYSICAL_SECTOR_SIZE);
+    char* buf = malloc(sizeof(JournalRecord) + payload);
+    char* p = buf + sizeof(JournalRecord);
+    memcpy(p, txn.secs, txn.count * sizeof(uint64_t));
+    memcpy(p + txn.count * sizeof(uint64_t), txn.data, txn.count * PHYSICAL_SECTOR_SIZE);
+
+    pthread_mutex_lock(&journal_mutex);
+    JournalRecord rec = { .magic = JOURNAL_MAGIC, .count = txn.count, .seq = journal_seq++ };
+    rec.checksum = record_checksum(&rec, p, payload);
+    memcpy(buf, &rec, sizeof(rec));
+    size_t len = sizeof(JournalRecord) + payload;
+    bool logged = pwrite(journal_fd, buf, len, journal_size) == (ssize_t)len && fdatasync(journal_fd) == 0;
+    if(logged) {
+        journal_size += len;
+    } else {
+        log_error("journal: append failed: %s, writing through", strerror(errno));
+    }
+    int ret = txn_apply();
+    if(ret == 0 && (!logged || journal_size > JOURNAL_CHECKPOINT_BYTES)) {
+        ret = disk_flush();
+        if(ret == 0 && ftruncate(journal_fd, 0) == 0) {
+            journal_size = 0;
+        }
+    }
+    pthread_mutex_unlock(&journal_mutex);
+
+    free(buf);
+    txn.count = 0;
+    memset(txn.slots, 0, txn.slot_cap * sizeof(uint32_t));
+    return ret;
+}
+
+void journal_begin(void) {
+    txn.depth++;
+}
+
+int journal_end(void) {
+    if(--txn.depth > 0) {
+        return 0;
+    }
+    return txn_commit();
+}
+
+bool journal_capture(sector_t sec, size_t count, const void* buffer) {
+    if(journal_fd < 0 || txn.depth == 0 || txn.applying) {
+        return false;
+    }
+    for(size_t i = 0; i < count; i++) {
+        txn_put(sec + i, (const char*)buffer + i * PHYSICAL_SECTOR_SIZE);
+    }
+    if(txn.count >= TXN_MAX_SECTORS) {
+        txn_commit();
+    }
+    return true;
+}
+
+void journal_overlay(sector_t sec, size_t count, void* buffer) {
+    if(txn.count == 0) {
+        return;
+    }
+    for(size_t i = 0; i < count; i++) {
+        long j = txn_find(sec + i);
+        if(j >= 0) {
+            memcpy((char*)buffer + i * PHYSICAL_SECTOR_SIZE, txn.data + j * PHYSICAL_SECTOR_SIZE,
+                   PHYSICAL_SECTOR_SIZE);
+        }
+    }
+}
+
+/**
+ * @brief 把日志中所有完整的记录写回镜像，返回重放的记录数，出错返回POSIX错误代码的负值
+ */
+static int journal_replay(int fd) {
+    struct stat st;
+    if(fstat(fd, &st) < 0) {
+        return -errno;
+    }
+    char* buf = malloc(st.st_size + 1);
+    if(pread(fd, buf, st.st_size, 0) != st.st_size) {
+        free(buf);
+        return -EIO;
+    }
+    int records = 0;
+    size_t sectors = 0;
+    int ret = 0;
+    for(size_t off = 0; off + sizeof(JournalRecord) <= (size_t)st.st_size && ret == 0; ) {
+        JournalRecord rec;
+        memcpy(&rec, buf + off, sizeof(rec));
+        size_t payload = (size_t)rec.count * (sizeof(uint64_t) + PHYSICAL_SECTOR_SIZE);
+        char* p = buf + off + sizeof(JournalRecord);
+        if(rec.magic != JOURNAL_MAGIC || payload > st.st_size - off - sizeof(JournalRecord)
+                || rec.checksum != record_checksum(&rec, p, payload)) {
+            log_warn("journal: discarding incomplete record at offset %lu", off);
+            break;
+        }
+        const char* data = p + rec.count * sizeof(uint64_t);
+        for(uint32_t i = 0; i < rec.count && ret == 0; i++) {
+            uint64_t sec;
+            memcpy(&sec, p + i * sizeof(uint64_t), sizeof(sec));
+            ret = sectors_write(sec, 1, data + i * PHYSICAL_SECTOR_SIZE);
+        }
+        journal_seq = rec.seq + 1;
+        records++;
+        sectors += rec.count;
+        off += sizeof(JournalRecord) + payload;
+    }
+    free(buf);
+    if(ret < 0) {
+        return ret;
+    }
+    if(records > 0) {
+        log_info("journal: replayed %d records, %lu sectors", records, sectors);
+    }
+    return records;
+}
+
+/**
+ * @brief 打开日志：重放其中的记录，之后镜像不再以 O_DSYNC 打开。
+ *        需要在 init_disk 之后、fuse_main 之前调用，再用 journal_wrap_operations 包装回调。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int journal_open(const char* path) {
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        return -errno;
+    }
+    int ret = journal_replay(fd);
+    if(ret >= 0) {
+        ret = disk_flush();
+    }
+    if(ret == 0 && ftruncate(fd, 0) < 0) {
+        ret = -errno;
+    }
+    if(ret == 0) {
+        ret = disk_set_dsync(false);
+    }
+    if(ret < 0) {
+        close(fd);
+        return ret;
+    }
+    journal_fd = fd;
+    journal_size = 0;
+    return 0;
+}
+
+/**
+ * @brief 同步镜像并清空、关闭日志，卸载时调用
+ */
+void journal_close(void) {
+    if(journal_fd < 0) {
+        return;
+    }
+    if(disk_flush() == 0) {
+        ftruncate(journal_fd, 0);
+    }
+    close(journal_fd);
+    journal_fd = -1;
+}
+
+// ===========================包装后的回调===============================
+
+// 把一个回调作为一个事务执行
+#define JOURNAL_CALL(type, call) do {   \
+        journal_begin();                \
+        type ret_ = (call);             \
+        int jret_ = journal_end();      \
+        return ret_ < 0 ? ret_ : jret_ < 0 ? jret_ : ret_; \
+    } while(0)
+
+static void journal_destroy(void* data) {
+    if(inner.destroy) {
+        inner.destroy(data);
+    }
+    journal_close();
+}
+
+static int journal_mknod(const char* path, mode_t mode, dev_t dev) {
+    JOURNAL_CALL(int, inner.mknod(path, mode, dev));
+}
+
+static int journal_unlink(const char* path) {
+    JOURNAL_CALL(int, inner.unlink(path));
+}
+
+static int journal_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    JOURNAL_CALL(int, inner.utimens(path, tv, fi));
+}
+
+static int journal_mkdir(const char* path, mode_t mode) {
+    JOURNAL_CALL(int, inner.mkdir(path, mode));
+}
+
+static int journal_rmdir(const char* path) {
+    JOURNAL_CALL(int, inner.rmdir(path));
+}
+
+static int journal_rename(const char* from, const char* to, unsigned int flags) {
+    JOURNAL_CALL(int, inner.rename(from, to, flags));
+}
+
+static int journal_write(const char* path, const char* data, size_t size, off_t offset,
+                         struct fuse_file_info* fi) {
+    JOURNAL_CALL(int, inner.write(path, data, size, offset, fi));
+}
+
+static int journal_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    JOURNAL_CALL(int, inner.truncate(path, size, fi));
+}
+
+static ssize_t journal_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                                       const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                                       size_t size, int flags) {
+    JOURNAL_CALL(ssize_t, inner.copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out,
+                                                size, flags));
+}
+
+/**
+ * @brief 把 ops 中修改文件系统的回调包装成事务，需要在 journal_open 之后、stats_wrap_operations 之前调用
+ */
+void journal_wrap_operations(struct fuse_operations* ops) {
+    inner = *ops;
+    ops->destroy = journal_destroy;
+    ops->mknod = journal_mknod;
+    ops->unlink = journal_unlink;
+    ops->utimens = journal_utimens;
+    ops->mkdir = journal_mkdir;
+    ops->rmdir = journal_rmdir;
+    ops->rename = journal_rename;
+    ops->write = journal_write;
+    ops->truncate = journal_truncate;
+    ops->copy_file_range = journal_copy_file_range;
+}
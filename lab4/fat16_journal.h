@@ -0,0 +1,38 @@
+#ifndef FAT16_JOURNAL_H
+#define FAT16_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * --journal=file 的日志文件格式：若干条记录依次追加，每条记录是一个 FUSE 操作写的所有扇区：
+ *   JournalRecord，之后是 count 个 uint64_t 扇区号，再之后是 count 个扇区的内容。
+ * checksum 是整条记录（checksum 字段视为 0）的 FNV-1a 校验和，用于丢弃崩溃时写了一半的记录。
+ * 检查点之后日志被清空，seq 继续递增。所有字段都是小端序。
+ */
+
+#define JOURNAL_MAGIC 0x4a363146u      // "F16J"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;             // 扇区数
+    uint64_t seq;               // 记录的序号
+    uint64_t checksum;
+} __attribute__((packed)) JournalRecord;
+
+struct fuse_operations;
+
+int journal_open(const char* path);
+void journal_close(void);
+void journal_wrap_operations(struct fuse_operations* ops);
+
+// 在 FUSE 回调之外修改文件系统时（如后台回收），把修改作为一个事务；可以嵌套
+void journal_begin(void);
+int journal_end(void);
+
+// 由模拟磁盘调用：事务中的写留在事务里，读时用事务中的新内容覆盖
+bool journal_capture(uint64_t sec, size_t count, const void* buffer);
+void journal_overlay(uint64_t sec, size_t count, void* buffer);
+
+#endif
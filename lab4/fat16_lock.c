@@ -0,0 +1,130 @@
+#include <pthread.h>
+
+#include "fat16.h"
+
+/**
+ * 回调之间的互斥。
+ *
+ * 两个线程并发修改 FAT 会丢失更新、交叉链接（打开日志时回调的修改在提交前只在线程局部的事务中，
+ * 后提交的 FAT 扇区覆盖先提交的），所以修改文件系统的回调和后台回收的每一批都持有 fs_lock 的写锁，
+ * 彼此串行执行；只读的回调（getattr / readdir / open / read / ioctl）持有读锁，可以并发执行，
+ * 并且只会看到已经提交的修改。
+ *
+ * 与是否打开日志、是否启用后台回收无关，simple_fat16 和 fat16_harness 总是安装这一层。
+ */
+
+static struct fuse_operations inner;
+static pthread_rwlock_t fs_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/**
+ * @brief 在 FUSE 回调之外修改文件系统（如后台回收）之前加写锁，与所有回调互斥
+ */
+void fs_lock_write(void) {
+    pthread_rwlock_wrlock(&fs_lock);
+}
+
+void fs_unlock(void) {
+    pthread_rwlock_unlock(&fs_lock);
+}
+
+// ===========================包装后的回调===============================
+
+// 持有 fs_lock 的写锁执行一个修改文件系统的回调
+#define LOCKED_CALL(type, call) do {        \
+        pthread_rwlock_wrlock(&fs_lock);    \
+        type ret_ = (call);                 \
+        pthread_rwlock_unlock(&fs_lock);    \
+        return ret_;                        \
+    } while(0)
+
+// 持有 fs_lock 的读锁执行一个只读的回调
+#define SHARED_CALL(type, call) do {        \
+        pthread_rwlock_rdlock(&fs_lock);    \
+        type ret_ = (call);                 \
+        pthread_rwlock_unlock(&fs_lock);    \
+        return ret_;                        \
+    } while(0)
+
+static int lock_getattr(const char* path, struct stat* st, struct fuse_file_info* fi) {
+    SHARED_CALL(int, inner.getattr(path, st, fi));
+}
+
+static int lock_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                        struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    SHARED_CALL(int, inner.readdir(path, buf, filler, offset, fi, flags));
+}
+
+static int lock_open(const char* path, struct fuse_file_info* fi) {
+    SHARED_CALL(int, inner.open(path, fi));
+}
+
+static int lock_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    SHARED_CALL(int, inner.read(path, buf, size, offset, fi));
+}
+
+static int lock_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi,
+                      unsigned int flags, void* data) {
+    SHARED_CALL(int, inner.ioctl(path, cmd, arg, fi, flags, data));
+}
+
+static int lock_mknod(const char* path, mode_t mode, dev_t dev) {
+    LOCKED_CALL(int, inner.mknod(path, mode, dev));
+}
+
+static int lock_unlink(const char* path) {
+    LOCKED_CALL(int, inner.unlink(path));
+}
+
+static int lock_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    LOCKED_CALL(int, inner.utimens(path, tv, fi));
+}
+
+static int lock_mkdir(const char* path, mode_t mode) {
+    LOCKED_CALL(int, inner.mkdir(path, mode));
+}
+
+static int lock_rmdir(const char* path) {
+    LOCKED_CALL(int, inner.rmdir(path));
+}
+
+static int lock_rename(const char* from, const char* to, unsigned int flags) {
+    LOCKED_CALL(int, inner.rename(from, to, flags));
+}
+
+static int lock_write(const char* path, const char* data, size_t size, off_t offset,
+                      struct fuse_file_info* fi) {
+    LOCKED_CALL(int, inner.write(path, data, size, offset, fi));
+}
+
+static int lock_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    LOCKED_CALL(int, inner.truncate(path, size, fi));
+}
+
+static ssize_t lock_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                                    const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                                    size_t size, int flags) {
+    LOCKED_CALL(ssize_t, inner.copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out,
+                                               size, flags));
+}
+
+/**
+ * @brief 修改文件系统的回调彼此之间互斥，只读的回调可以并发。
+ *        需要在 journal_wrap_operations 之后调用，使回调的事务在释放锁之前提交。
+ */
+void lock_wrap_operations(struct fuse_operations* ops) {
+    inner = *ops;
+    ops->getattr = lock_getattr;
+    ops->readdir = lock_readdir;
+    ops->open = lock_open;
+    ops->read = lock_read;
+    ops->ioctl = lock_ioctl;
+    ops->mknod = lock_mknod;
+    ops->unlink = lock_unlink;
+    ops->utimens = lock_utimens;
+    ops->mkdir = lock_mkdir;
+    ops->rmdir = lock_rmdir;
+    ops->rename = lock_rename;
+    ops->write = lock_write;
+    ops->truncate = lock_truncate;
+    ops->copy_file_range = lock_copy_file_range;
+}
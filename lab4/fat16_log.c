@@ -0,0 +1,24 @@
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "fat16_log.h"
+
+#ifdef FAT16_DEBUG
+int fat16_log_level = LOG_LEVEL_DEBUG;
+#else
+int fat16_log_level = LOG_LEVEL_WARN;
+#endif
+
+static const char* LEVEL_NAMES[] = { "error", "warn", "info", "debug", "trace" };
+
+void fat16_log(int level, const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    // 多个 FUSE 线程同时写日志时保证每条日志完整
+    flockfile(stderr);
+    fprintf(stderr, "[%s] ", LEVEL_NAMES[level]);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+    funlockfile(stderr);
+    va_end(ap);
+}
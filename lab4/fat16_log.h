@@ -0,0 +1,49 @@
+#ifndef FAT16_LOG_H
+#define FAT16_LOG_H
+
+/**
+ * 分级日志。ERROR / WARN / INFO 总是编译进来，运行时按 fat16_log_level 过滤；
+ * DEBUG / TRACE 只在定义了 FAT16_DEBUG 时（make trace）编译，否则整条语句被编译器去掉，
+ * 热路径上没有任何开销。
+ *
+ * 日志输出到 stderr，每条日志自动换行。
+ */
+
+enum {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,    // 每个 FUSE 操作的参数
+    LOG_LEVEL_TRACE,    // 函数内部的执行过程
+};
+
+extern int fat16_log_level;
+
+void fat16_log(int level, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#define LOG_AT(level, ...) do {                     \
+        if((level) <= fat16_log_level) {            \
+            fat16_log(level, __VA_ARGS__);          \
+        }                                           \
+    } while(0)
+
+// 保留格式检查，但不生成任何代码
+#define LOG_NONE(...) do {                          \
+        if(0) {                                     \
+            fat16_log(LOG_LEVEL_TRACE, __VA_ARGS__);\
+        }                                           \
+    } while(0)
+
+#define log_error(...)  LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define log_warn(...)   LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define log_info(...)   LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+
+#ifdef FAT16_DEBUG
+#define log_debug(...)  LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define log_trace(...)  LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define log_debug(...)  LOG_NONE(__VA_ARGS__)
+#define log_trace(...)  LOG_NONE(__VA_ARGS__)
+#endif
+
+#endif
@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "fat16.h"
+#include "fat16_cache.h"
+#include "fat16_journal.h"
+#include "fat16_trace.h"
+
+typedef struct {
+    const char** images;        // 多个镜像时按条带组成一个逻辑卷
+    size_t nimages;
+    unsigned long stripe_kb;
+    DiskTiming timing;
+    int log_level;
+    const char* trace_path;     // 为 NULL 时不记录跟踪
+    const char* heatmap_path;   // 为 NULL 时不记录热力图
+    const char* journal_path;   // 为 NULL 时不使用日志，镜像以 O_DSYNC 打开
+    const char* warm_path;      // 为 NULL 时不保存缓存内容，每次挂载从冷缓存开始
+    CacheOptions cache;
+} Options;
+
+enum { KEY_IMAGE };
+
+#define OPTION(t, p) { t, offsetof(Options, p), 1 }
+static const struct fuse_opt option_spec[] = {
+    FUSE_OPT_KEY("--img=", KEY_IMAGE),
+    OPTION("--stripe_kb=%lu", stripe_kb),
+    OPTION("--seek_time=%lu", timing.seek_time_us),
+    OPTION("--disk_model=%s", timing.model),
+    OPTION("--settle_time=%lu", timing.settle_time_us),
+    OPTION("--seek_knee=%lu", timing.seek_knee),
+    OPTION("--rpm=%lu", timing.rpm),
+    OPTION("--ssd_latency=%lu", timing.ssd_latency_us),
+    OPTION("--ssd_channels=%lu", timing.ssd_channels),
+    OPTION("--log_level=%d", log_level),
+    OPTION("--trace=%s", trace_path),
+    OPTION("--heatmap=%s", heatmap_path),
+    OPTION("--journal=%s", journal_path),
+    OPTION("--warm=%s", warm_path),
+    OPTION("--cache_timeout=%lf", cache.entry_timeout),
+    OPTION("--negative_timeout=%lf", cache.negative_timeout),
+    FUSE_OPT_END
+};
+
+// 收集可以出现多次的 --img=，其余参数留给 fuse_main
+static int option_proc(void* data, const char* arg, int key, struct fuse_args* outargs) {
+    if(key != KEY_IMAGE) {
+        return 1;
+    }
+    Options* opts = data;
+    opts->images = realloc(opts->images, (opts->nimages + 1) * sizeof(char*));
+    opts->images[opts->nimages++] = strdup(arg + strlen("--img="));
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{   
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    Options opts;
+    opts.images = NULL;
+    opts.nimages = 0;
+    opts.stripe_kb = 64;
+    memset(&opts.timing, 0, sizeof(DiskTiming));
+    opts.timing.model = "linear";
+    opts.log_level = fat16_log_level;
+    opts.trace_path = NULL;
+    opts.heatmap_path = NULL;
+    opts.journal_path = NULL;
+    opts.warm_path = NULL;
+    opts.cache.entry_timeout = CACHE_DEFAULT_TIMEOUT;
+    opts.cache.negative_timeout = CACHE_DEFAULT_NEGATIVE_TIMEOUT;
+    int ret = fuse_opt_parse(&args, &opts, option_spec, option_proc);
+    if(ret < 0) {
+        return EXIT_FAILURE;
+    }
+    fat16_log_level = opts.log_level;
+    if(opts.nimages == 0) {
+        init_disk(DEFAULT_IMAGE, opts.timing.seek_time_us);
+    } else {
+        init_disk_striped(opts.images, opts.nimages, opts.stripe_kb * 1024 / PHYSICAL_SECTOR_SIZE,
+                          opts.timing.seek_time_us);
+    }
+    if(disk_set_timing(&opts.timing) < 0) {
+        fprintf(stderr, "Unknown disk model %s\n", opts.timing.model);
+        return EXIT_FAILURE;
+    }
+    if(opts.journal_path != NULL) {
+        if((ret = journal_open(opts.journal_path)) < 0) {
+            fprintf(stderr, "Open journal %s failed: %s\n", opts.journal_path, strerror(-ret));
+            return EXIT_FAILURE;
+        }
+        journal_wrap_operations(&fat16_oper);
+    }
+    lock_wrap_operations(&fat16_oper);
+    reclaim_wrap_operations(&fat16_oper);
+    cache_wrap_operations(&fat16_oper, &opts.cache);
+    stats_wrap_operations(&fat16_oper);
+    if(opts.trace_path != NULL && (ret = trace_open(opts.trace_path)) < 0) {
+        fprintf(stderr, "Open trace file %s failed: %s\n", opts.trace_path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if(opts.heatmap_path != NULL && (ret = disk_enable_heatmap(opts.heatmap_path)) < 0) {
+        fprintf(stderr, "Open heatmap file %s failed: %s\n", opts.heatmap_path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if(opts.warm_path != NULL && (ret = fatcache_set_warm_file(opts.warm_path)) < 0) {
+        fprintf(stderr, "Open warm file %s failed: %s\n", opts.warm_path, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    ret = fuse_main(args.argc, args.argv, &fat16_oper, NULL);
+    disk_heatmap_dump();
+    fuse_opt_free_args(&args);
+    return ret;
+}
\ No newline at end of file
@@ -0,0 +1,480 @@
+/**
+ * fat16_mkfs: 不依赖 mkfs.fat 和 loop 挂载，直接生成 FAT16/FAT32 镜像，并可导入宿主机上的目录树。
+ *
+ * 用法: fat16_mkfs [-F 16|32] [-s 每簇扇区数] [-r 根目录项数] [-R 保留扇区数] [-f FAT数量] [-n 卷标]
+ *                  [-d 要导入的目录] <镜像> <大小(KiB)>
+ *
+ * 参数含义与 mkfs.fat 相同，例如 run_bench.sh 中的
+ *   mkfs.fat -C -F 16 -r 512 -R 32 -s 4 -S 512 fat16.img 32768
+ * 对应
+ *   fat16_mkfs -r 512 -R 32 -s 4 fat16.img 32768
+ *
+ * FAT32 没有固定的根目录区域（-r 无效），根目录是从第一个簇开始的簇链；保留区中
+ * 扇区 1 为 FSInfo，保留扇区足够时扇区 6、7 为引导扇区和 FSInfo 的备份。
+ *
+ * 导入时每个目录紧跟着它的内容按深度优先顺序分配，每个文件的簇都是连续的。
+ * FAT 表在内存中构建，最后每个副本只写一次。
+ */
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fat16_image.h"
+
+#define FAT16_MIN_CLUSTERS  4085u       // 少于该簇数的卷按规范应为 FAT12
+#define FAT32_BACKUP_SEC    6           // 引导扇区备份的位置，FSInfo 的备份紧随其后
+
+typedef struct {
+    Fat16Image img;
+    cluster_t next_free;                // 下一个未分配的簇，所有分配都是连续的
+    char* io_buffer;                    // 复制文件数据用的缓冲区，大小为一个簇
+} Builder;
+
+static Builder b;
+
+/**
+ * @brief 计算卷的布局，FAT 表大小需要迭代求解（FAT 表越大，数据区簇数越少）。
+ */
+static int compute_layout(Fat16Image* img) {
+    img->sector_size = PHYSICAL_SECTOR_SIZE;
+    size_t entry_size = img->fat_bits / 8;
+    img->root_sectors = (img->dir_entries * DIR_ENTRY_SIZE + img->sector_size - 1) / img->sector_size;
+    img->fat_sec = img->reserved;
+
+    uint32_t sec_per_fat = 1;
+    while(true) {
+        uint32_t meta_sectors = img->reserved + img->fats * sec_per_fat + img->root_sectors;
+        if(meta_sectors >= img->sectors) {
+            return -ENOSPC;
+        }
+        uint32_t clusters = (img->sectors - meta_sectors) / img->sec_per_clus;
+        uint32_t need = ((clusters + 2) * entry_size + img->sector_size - 1) / img->sector_size;
+        if(need <= sec_per_fat) {
+            img->clusters = clusters;
+            break;
+        }
+        sec_per_fat = need;
+    }
+    img->sec_per_fat = sec_per_fat;
+    img->root_sec = img->fat_sec + img->fats * img->sec_per_fat;
+    img->data_sec = img->root_sec + img->root_sectors;
+    img->cluster_size = img->sec_per_clus * img->sector_size;
+    if(img->clusters > (img->fat_bits == 32 ? CLUSTER_MAX - 1 : FAT16_MAX_CLUSTERS)) {
+        return -EFBIG;
+    }
+    return 0;
+}
+
+static void fill_bpb(Fat16Image* img, const char* label) {
+    BPB_BS* bpb = &img->bpb;
+    memset(bpb, 0, sizeof(BPB_BS));
+    memcpy(bpb->BS_jmpBoot, "\xEB\x3C\x90", 3);
+    memcpy(bpb->BS_OEMName, "OSLABFAT", 8);
+    bpb->BPB_BytsPerSec = img->sector_size;
+    bpb->BPB_SecPerClus = img->sec_per_clus;
+    bpb->BPB_RsvdSecCnt = img->reserved;
+    bpb->BPB_NumFATS = img->fats;
+    bpb->BPB_RootEntCnt = img->dir_entries;
+    if(img->sectors < 0x10000) {
+        bpb->BPB_TotSec16 = img->sectors;
+    } else {
+        bpb->BPB_TotSec32 = img->sectors;
+    }
+    bpb->BPB_Media = 0xF8;
+    bpb->BPB_SecPerTrk = 32;
+    bpb->BPB_NumHeads = 64;
+    bpb->Signature_word = 0xAA55;
+
+    if(img->fat_bits == 32) {
+        // BPB_FATSz16、BPB_RootEntCnt、BPB_TotSec16 都为 0，扩展字段的位置与 FAT16 不同
+        BPB32_BS* bpb32 = (BPB32_BS*)bpb;
+        memcpy(bpb->BS_jmpBoot, "\xEB\x58\x90", 3);
+        bpb->BPB_TotSec16 = 0;
+        bpb->BPB_TotSec32 = img->sectors;
+        bpb32->BPB_FATSz32 = img->sec_per_fat;
+        bpb32->BPB_RootClus = img->root_clus;
+        bpb32->BPB_FSInfo = img->fsinfo_sec;
+        bpb32->BPB_BkBootSec = img->reserved > FAT32_BACKUP_SEC + 1 ? FAT32_BACKUP_SEC : 0;
+        bpb32->BS_DrvNum = 0x80;
+        bpb32->BS_BootSig = 0x29;
+        bpb32->BS_VollID = (DWORD)time(NULL);
+        memset(bpb32->BS_VollLab, ' ', sizeof(bpb32->BS_VollLab));
+        memcpy(bpb32->BS_VollLab, label, min(strlen(label), sizeof(bpb32->BS_VollLab)));
+        memcpy(bpb32->BS_FilSysType, "FAT32   ", 8);
+        return;
+    }
+    bpb->BPB_FATSz16 = img->sec_per_fat;
+    bpb->BS_DrvNum = 0x80;
+    bpb->BS_BootSig = 0x29;
+    bpb->BS_VollID = (DWORD)time(NULL);
+    memset(bpb->BS_VollLab, ' ', sizeof(bpb->BS_VollLab));
+    memcpy(bpb->BS_VollLab, label, min(strlen(label), sizeof(bpb->BS_VollLab)));
+    memcpy(bpb->BS_FilSysType, "FAT16   ", 8);
+}
+
+/**
+ * @brief 写入 FAT32 的引导扇区、FSInfo 以及它们的备份
+ */
+static int write_boot_sectors(Fat16Image* img) {
+    int ret = image_write(img, 0, 1, &img->bpb);
+    if(ret < 0 || img->fat_bits != 32) {
+        return ret;
+    }
+    FSINFO info;
+    memset(&info, 0, sizeof(info));
+    info.FSI_LeadSig = FSINFO_LEAD_SIG;
+    info.FSI_StrucSig = FSINFO_STRUC_SIG;
+    info.FSI_Free_Count = img->clusters + CLUSTER_MIN - b.next_free;
+    info.FSI_Nxt_Free = b.next_free;
+    info.FSI_TrailSig = FSINFO_TRAIL_SIG;
+    ret = image_write(img, img->fsinfo_sec, 1, &info);
+    WORD backup = ((BPB32_BS*)&img->bpb)->BPB_BkBootSec;
+    if(ret == 0 && backup != 0) {
+        ret = image_write(img, backup, 1, &img->bpb);
+    }
+    if(ret == 0 && backup != 0) {
+        ret = image_write(img, backup + img->fsinfo_sec, 1, &info);
+    }
+    return ret;
+}
+
+/**
+ * @brief 连续分配 n 个簇并在内存中的 FAT 表里把它们连起来
+ */
+static int alloc_run(size_t n, cluster_t* first) {
+    Fat16Image* img = &b.img;
+    if(b.next_free + n > img->clusters + CLUSTER_MIN) {
+        return -ENOSPC;
+    }
+    *first = b.next_free;
+    for(size_t i = 0; i < n; i++) {
+        cluster_t clus = b.next_free + i;
+        img->fat[clus] = (i + 1 == n) ? CLUSTER_END : clus + 1;
+    }
+    b.next_free += n;
+    return 0;
+}
+
+/**
+ * @brief 将文件名转换为 8+3 格式，规则与 simple_fat16.c 中的 to_shortname 相同。
+ *        无法无损表示的文件名（过长、含非法字符）返回 false。
+ */
+static bool make_shortname(const char* name, char res[FAT_NAME_LEN]) {
+    size_t len = strlen(name);
+    const char* dot = strrchr(name, '.');
+    if(dot == name) {
+        dot = NULL;
+    }
+    size_t base_len = dot ? (size_t)(dot - name) : len;
+    size_t ext_len = dot ? len - base_len - 1 : 0;
+
+    memset(res, ' ', FAT_NAME_LEN);
+    bool exact = base_len <= FAT_NAME_BASE_LEN && ext_len <= FAT_NAME_EXT_LEN && base_len > 0;
+    for(size_t i = 0; i < len; i++) {
+        const char INVALID_CHARS[] = "*?<>|\"+=,; :\\";
+        if(strchr(INVALID_CHARS, name[i]) != NULL || (name[i] == '.' && name + i != dot)) {
+            exact = false;
+        }
+    }
+    for(size_t i = 0; i < base_len && i < FAT_NAME_BASE_LEN; i++) {
+        res[i] = toupper(name[i]);
+    }
+    res[0] = ((uint8_t)res[0] == NAME_DELETED) ? 0x05 : res[0];
+    for(size_t i = 0; i < ext_len && i < FAT_NAME_EXT_LEN; i++) {
+        res[FAT_NAME_BASE_LEN + i] = toupper(dot[1 + i]);
+    }
+    return exact;
+}
+
+static void time_to_fat(time_t t, WORD* date, WORD* time) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    if(tm.tm_year < 80) {
+        tm.tm_year = 80;    // FAT 最早只能表示 1980 年
+    }
+    *date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+    *time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+}
+
+static void make_entry(DIR_ENTRY* dir, const char shortname[FAT_NAME_LEN], attr_t attr,
+                       cluster_t first_clus, uint32_t size, time_t mtime) {
+    memset(dir, 0, sizeof(DIR_ENTRY));
+    memcpy(dir->DIR_Name, shortname, FAT_NAME_LEN);
+    dir->DIR_Attr = attr;
+    dir_entry_set_cluster(dir, first_clus);
+    dir->DIR_FileSize = size;
+    time_to_fat(mtime, &dir->DIR_WrtDate, &dir->DIR_WrtTime);
+    dir->DIR_CrtDate = dir->DIR_LstAccDate = dir->DIR_WrtDate;
+    dir->DIR_CrtTime = dir->DIR_WrtTime;
+}
+
+static int import_file(const char* path, const struct stat* st, cluster_t* first) {
+    Fat16Image* img = &b.img;
+    *first = CLUSTER_FREE;
+    if(st->st_size == 0) {
+        return 0;
+    }
+    if(st->st_size > UINT32_MAX) {
+        return -EFBIG;
+    }
+    size_t n = (st->st_size + img->cluster_size - 1) / img->cluster_size;
+    int ret = alloc_run(n, first);
+    if(ret < 0) {
+        return ret;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return -errno;
+    }
+    // 簇是连续的，按簇大小顺序复制即可，最后一个簇的剩余部分本来就是 0
+    off_t pos = 0;
+    sector_t sec = image_cluster_sector(img, *first);
+    while(pos < st->st_size) {
+        ssize_t len = read(fd, b.io_buffer, img->cluster_size);
+        if(len <= 0) {
+            ret = len < 0 ? -errno : -EIO;
+            break;
+        }
+        memset(b.io_buffer + len, 0, img->cluster_size - len);
+        ret = image_write(img, sec, img->sec_per_clus, b.io_buffer);
+        if(ret < 0) {
+            break;
+        }
+        pos += len;
+        sec += img->sec_per_clus;
+    }
+    close(fd);
+    return ret;
+}
+
+static int skip_dots(const struct dirent* d) {
+    return strcmp(d->d_name, ".") != 0 && strcmp(d->d_name, "..") != 0;
+}
+
+/**
+ * @brief 将宿主机目录 host 中的内容导入到镜像中。
+ *
+ * @param host      宿主机目录路径
+ * @param clus      输出参数，该目录在镜像中分配到的第一个簇（FAT16 的根目录不分配）
+ * @param parent    父目录的第一个簇，父目录为根目录时为 0
+ * @param root      是否为根目录，FAT16 根目录的目录项写入固定的根目录区域；根目录没有 . 和 ..
+ * @return int      成功返回0，失败返回POSIX错误代码的负值
+ */
+static int import_dir(const char* host, cluster_t* clus, cluster_t parent, bool root) {
+    Fat16Image* img = &b.img;
+    struct dirent** names;
+    int n = scandir(host, &names, skip_dots, alphasort);
+    if(n < 0) {
+        fprintf(stderr, "%s: %s\n", host, strerror(errno));
+        return -errno;
+    }
+
+    // 簇链中的目录多留一个空项，这样 simple_fat16 不需要扩展目录就能在其中创建文件
+    size_t count = root ? 0 : 2;
+    size_t capacity;
+    size_t nclus = 0;
+    if(root && img->fat_bits == 16) {
+        capacity = img->dir_entries;
+    } else {
+        nclus = ((n + count + 1) * DIR_ENTRY_SIZE + img->cluster_size - 1) / img->cluster_size;
+        capacity = nclus * img->cluster_size / DIR_ENTRY_SIZE;
+    }
+    DIR_ENTRY* entries = calloc(capacity, sizeof(DIR_ENTRY));
+
+    int ret = 0;
+    struct stat st;
+    if((size_t)n > capacity) {
+        fprintf(stderr, "%s: too many entries for the root directory\n", host);
+        ret = -ENOSPC;
+    } else if(nclus > 0) {
+        // 目录自己的簇在内容之前分配，使目录项与其中的文件相邻
+        ret = alloc_run(nclus, clus);
+        if(ret == 0 && !root && stat(host, &st) == 0) {
+            make_entry(&entries[0], ".          ", ATTR_DIRECTORY, *clus, 0, st.st_mtime);
+            make_entry(&entries[1], "..         ", ATTR_DIRECTORY, parent, 0, st.st_mtime);
+        }
+    }
+
+    char path[PATH_MAX];
+    char shortname[FAT_NAME_LEN];
+    for(int i = 0; i < n && ret == 0; i++) {
+        const char* name = names[i]->d_name;
+        snprintf(path, sizeof(path), "%s/%s", host, name);
+        if(stat(path, &st) < 0) {
+            ret = -errno;
+            break;
+        }
+        if(!make_shortname(name, shortname)) {
+            fprintf(stderr, "warning: %s is not a valid 8.3 name, truncated\n", path);
+        }
+        for(size_t j = 0; j < count; j++) {
+            if(memcmp(entries[j].DIR_Name, shortname, FAT_NAME_LEN) == 0) {
+                fprintf(stderr, "%s: 8.3 name collides with another entry\n", path);
+                ret = -EEXIST;
+            }
+        }
+        if(ret < 0) {
+            break;
+        }
+
+        cluster_t first = CLUSTER_FREE;
+        if(S_ISDIR(st.st_mode)) {
+            ret = import_dir(path, &first, root ? 0 : *clus, false);
+            make_entry(&entries[count++], shortname, ATTR_DIRECTORY, first, 0, st.st_mtime);
+        } else if(S_ISREG(st.st_mode)) {
+            ret = import_file(path, &st, &first);
+            make_entry(&entries[count++], shortname, ATTR_REGULAR, first, st.st_size, st.st_mtime);
+        } else {
+            fprintf(stderr, "warning: %s is not a regular file or directory, skipped\n", path);
+        }
+    }
+
+    if(ret == 0) {
+        if(nclus == 0) {
+            ret = image_write(img, img->root_sec, img->root_sectors, entries);
+        } else {
+            ret = image_write(img, image_cluster_sector(img, *clus), nclus * img->sec_per_clus, entries);
+        }
+    }
+    for(int i = 0; i < n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(entries);
+    return ret;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-F 16|32] [-s sectors_per_cluster] [-r root_entries] [-R reserved_sectors]\n"
+                    "          [-f fats] [-n label] [-d import_dir] <image> <size_kb>\n", prog);
+}
+
+int main(int argc, char* argv[]) {
+    Fat16Image* img = &b.img;
+    img->fats = 2;
+    img->dir_entries = 512;
+    img->reserved = 0;          // 0 表示默认值：FAT16 为 1，FAT32 为 32
+    img->sec_per_clus = 0;      // 0 表示自动选择
+    img->fat_bits = 16;
+    const char* label = "NO NAME";
+    const char* import = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "F:s:r:R:f:n:d:")) != -1) {
+        switch(opt) {
+        case 'F': img->fat_bits = atoi(optarg); break;
+        case 's': img->sec_per_clus = atoi(optarg); break;
+        case 'r': img->dir_entries = atoi(optarg); break;
+        case 'R': img->reserved = atoi(optarg); break;
+        case 'f': img->fats = atoi(optarg); break;
+        case 'n': label = optarg; break;
+        case 'd': import = optarg; break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc - 2) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[optind];
+    uint64_t size_kb = strtoull(argv[optind + 1], NULL, 0);
+    uint64_t sectors = size_kb * 1024 / PHYSICAL_SECTOR_SIZE;
+    if(img->reserved == 0) {
+        img->reserved = img->fat_bits == 32 ? 32 : 1;
+    }
+    if(img->fat_bits == 32) {
+        img->dir_entries = 0;
+        img->fsinfo_sec = 1;
+    }
+    if(sectors == 0 || sectors > UINT32_MAX || img->fats == 0
+            || (img->fat_bits != 16 && img->fat_bits != 32)
+            || (img->fat_bits == 16 && img->dir_entries == 0)
+            || img->reserved <= img->fsinfo_sec || img->sec_per_clus > 128
+            || (img->sec_per_clus & (img->sec_per_clus - 1)) != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    img->sectors = sectors;
+    // 根目录区域按扇区对齐
+    img->dir_entries = (img->dir_entries * DIR_ENTRY_SIZE + PHYSICAL_SECTOR_SIZE - 1)
+                       / PHYSICAL_SECTOR_SIZE * PHYSICAL_SECTOR_SIZE / DIR_ENTRY_SIZE;
+
+    int ret;
+    if(img->sec_per_clus == 0 && img->fat_bits == 32) {
+        // 与 mkfs.fat 的默认值相近：卷越大簇越大，但远小于同样大小的 FAT16 所需的簇
+        uint64_t mb = sectors * PHYSICAL_SECTOR_SIZE >> 20;
+        img->sec_per_clus = mb < 260 ? 1 : mb < 8192 ? 8 : mb < 16384 ? 16 : mb < 32768 ? 32 : 64;
+        ret = compute_layout(img);
+    } else if(img->sec_per_clus == 0) {
+        // 自动选择能让簇数不超过 FAT16 上限的最小簇
+        for(img->sec_per_clus = 1; img->sec_per_clus <= 128; img->sec_per_clus *= 2) {
+            if((ret = compute_layout(img)) != -EFBIG) {
+                break;
+            }
+        }
+    } else {
+        ret = compute_layout(img);
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: cannot lay out a FAT%d volume with these parameters: %s\n",
+                path, img->fat_bits, strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    if(img->fat_bits == 16 && img->clusters < FAT16_MIN_CLUSTERS) {
+        fprintf(stderr, "warning: only %u clusters, a standard driver would treat this as FAT12\n",
+                img->clusters);
+    }
+    if(img->fat_bits == 32 && img->clusters <= FAT16_MAX_CLUSTERS) {
+        fprintf(stderr, "warning: only %u clusters, a standard driver would treat this as FAT16\n",
+                img->clusters);
+    }
+
+    img->path = path;
+    img->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if(img->fd < 0 || ftruncate(img->fd, (off_t)img->sectors * img->sector_size) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    // 新文件是稀疏的，全部为 0，只需写入非 0 的部分
+    const BYTE media = 0xF8;
+    img->fat = calloc(img->clusters + CLUSTER_MIN, sizeof(cluster_t));
+    img->fat[0] = (img->fat_bits == 32 ? 0x0FFFFF00u : 0xFF00u) | media;
+    img->fat[1] = CLUSTER_END;
+    b.next_free = CLUSTER_MIN;
+    b.io_buffer = malloc(img->cluster_size);
+
+    // FAT32 的根目录是第一个分配的簇链，引导扇区在导入之后才能写入
+    ret = 0;
+    if(import != NULL) {
+        ret = import_dir(import, &img->root_clus, 0, true);
+    } else if(img->fat_bits == 32) {
+        ret = alloc_run(1, &img->root_clus);
+    }
+    if(ret == 0) {
+        fill_bpb(img, label);
+        ret = write_boot_sectors(img);
+    }
+    if(ret == 0) {
+        ret = image_flush_fat(img);
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: failed to build image: %s\n", path, strerror(-ret));
+        image_close(img);
+        return EXIT_FAILURE;
+    }
+
+    printf("%s: FAT%d, %u sectors, %u clusters of %u bytes, %u used, FAT %u sectors x %u\n",
+           path, img->fat_bits, img->sectors, img->clusters, img->cluster_size,
+           b.next_free - CLUSTER_MIN, img->sec_per_fat, img->fats);
+    free(b.io_buffer);
+    image_close(img);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "fat16.h"
+#include "fat16_journal.h"
+
+/**
+ * 后台回收被删除文件的簇链。
+ *
+ * unlink / rmdir / 被 rename 覆盖的文件 / 截断掉的部分：目录项先写回磁盘，不再引用的簇链交给 reclaim_chain，
+ * 回调立即返回。后台线程每次从队列中释放最多 RECLAIM_BATCH 个簇，作为一个日志事务，
+ * 同一个 FAT 扇区只读写一次。回收完成前崩溃，簇链仍标记为已用但没有目录项引用，
+ * 磁盘上的结构始终是一致的，fat16_fsck -r 会把它们作为丢失的簇链释放。
+ *
+ * 后台线程的每一批都持有 fs_lock（fat16_lock.c）的写锁，与修改文件系统的回调互斥。
+ * 分配簇时空间不足，alloc_clusters 调用 reclaim_drain 在当前线程中释放所有等待回收的簇链；
+ * 卸载时也同步释放剩下的簇链。
+ *
+ * 没有调用 reclaim_wrap_operations（如单线程的 fat16_harness）时没有后台线程，reclaim_chain 直接释放簇链。
+ */
+
+#define RECLAIM_BATCH 8192      // 后台线程每个事务最多释放的簇数
+
+typedef struct Chain {
+    struct Chain* next;
+    cluster_t clus;             // 下一个要释放的簇
+} Chain;
+
+static struct fuse_operations inner;
+
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static Chain* queue_head;
+static Chain** queue_tail = &queue_head;
+static bool reclaimer_running;
+static bool reclaimer_stop;
+static pthread_t reclaimer;
+
+/**
+ * @brief 回收一条已经没有目录项引用的簇链：有后台线程时放入队列，否则直接释放
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int reclaim_chain(cluster_t clus) {
+    if(!is_cluster_inuse(clus)) {
+        return 0;
+    }
+    if(!reclaimer_running) {
+        return free_clusters(clus);
+    }
+    Chain* c = malloc(sizeof(Chain));
+    if(c == NULL) {
+        return free_clusters(clus);
+    }
+    c->clus = clus;
+    c->next = NULL;
+    pthread_mutex_lock(&queue_mutex);
+    *queue_tail = c;
+    queue_tail = &c->next;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return 0;
+}
+
+// 从队列中取出所有簇链
+static Chain* queue_take_all(void) {
+    pthread_mutex_lock(&queue_mutex);
+    Chain* list = queue_head;
+    queue_head = NULL;
+    queue_tail = &queue_head;
+    pthread_mutex_unlock(&queue_mutex);
+    return list;
+}
+
+/**
+ * @brief 在当前线程中释放所有等待回收的簇链，需要持有 fs_lock 的写锁
+ *
+ * @return long 释放的簇数
+ */
+long reclaim_drain(void) {
+    long total = 0;
+    for(Chain* c = queue_take_all(); c != NULL; ) {
+        long n = free_clusters_batch(&c->clus, SIZE_MAX);
+        if(n < 0) {
+            log_error("reclaim: free chain at cluster %u failed: %s", c->clus, strerror(-n));
+        } else {
+            total += n;
+        }
+        Chain* next = c->next;
+        free(c);
+        c = next;
+    }
+    return total;
+}
+
+// 释放队列头部的簇链中最多 RECLAIM_BATCH 个簇，需要持有 fs_lock 的写锁
+static void reclaim_batch(void) {
+    size_t total = 0;
+    journal_begin();
+    while(total < RECLAIM_BATCH) {
+        pthread_mutex_lock(&queue_mutex);
+        Chain* c = queue_head;
+        pthread_mutex_unlock(&queue_mutex);
+        if(c == NULL) {
+            break;
+        }
+        long n = free_clusters_batch(&c->clus, RECLAIM_BATCH - total);
+        if(n < 0) {
+            log_error("reclaim: free chain at cluster %u failed: %s", c->clus, strerror(-n));
+        } else {
+            total += n;
+        }
+        if(n >= 0 && is_cluster_inuse(c->clus)) {
+            continue;
+        }
+        pthread_mutex_lock(&queue_mutex);
+        queue_head = c->next;
+        if(queue_head == NULL) {
+            queue_tail = &queue_head;
+        }
+        pthread_mutex_unlock(&queue_mutex);
+        free(c);
+    }
+    journal_end();
+    log_debug("reclaim: freed %lu clusters", total);
+}
+
+static void* reclaimer_main(void* arg) {
+    pthread_mutex_lock(&queue_mutex);
+    while(true) {
+        while(queue_head == NULL && !reclaimer_stop) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        }
+        if(reclaimer_stop) {
+            break;      // 剩下的簇链由 destroy 释放
+        }
+        pthread_mutex_unlock(&queue_mutex);
+        fs_lock_write();
+        reclaim_batch();
+        fs_unlock();
+        pthread_mutex_lock(&queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+    return NULL;
+}
+
+// ===========================包装后的回调===============================
+
+static void* reclaim_init(struct fuse_conn_info* conn, struct fuse_config* config) {
+    void* ret = inner.init ? inner.init(conn, config) : NULL;
+    reclaimer_stop = false;
+    reclaimer_running = pthread_create(&reclaimer, NULL, reclaimer_main, NULL) == 0;
+    if(!reclaimer_running) {
+        log_warn("Start reclaim thread failed, freeing chains synchronously");
+    }
+    return ret;
+}
+
+static void reclaim_destroy(void* data) {
+    if(reclaimer_running) {
+        pthread_mutex_lock(&queue_mutex);
+        reclaimer_stop = true;
+        pthread_cond_signal(&queue_cond);
+        pthread_mutex_unlock(&queue_mutex);
+        pthread_join(reclaimer, NULL);
+        reclaimer_running = false;
+    }
+    journal_begin();
+    long n = reclaim_drain();
+    journal_end();
+    if(n > 0) {
+        log_info("reclaim: freed %ld clusters at unmount", n);
+    }
+    if(inner.destroy) {
+        inner.destroy(data);
+    }
+}
+
+/**
+ * @brief 启用后台回收：init 时启动回收线程，destroy 时停止并同步释放剩下的簇链
+ */
+void reclaim_wrap_operations(struct fuse_operations* ops) {
+    inner = *ops;
+    ops->init = reclaim_init;
+    ops->destroy = reclaim_destroy;
+}
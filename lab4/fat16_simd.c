@@ -0,0 +1,341 @@
+#include <string.h>
+
+#include "fat16.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+/**
+ * 扫描目录扇区的向量化实现。每个目录项的前 12 字节是 11 字节的文件名和属性字节，
+ * 把 4 个（AVX2 为 8 个）目录项的前 16 字节按 32 位转置后，同一个向量中是这些目录项的
+ * 文件名第 0~3 字节、第 4~7 字节、第 8~10 字节和属性，几次比较就得到这一组目录项的
+ * 空项、删除项、LFN 项和文件名匹配的位图，没有分支。
+ *
+ * FAT 表的扫描（统计空闲簇、找连续的空闲簇、生成空闲位图）都建立在一个核心函数上：
+ * 把 64 个 16 位或 32 位的原始 FAT 表项与 0 比较，压缩成一个 64 位的空闲位图。
+ *
+ * 每种扫描都有 scalar / sse2 / avx2 三种实现，加载时按 CPU 支持的指令集选择最快的一种，
+ * 也可以用环境变量 FAT16_SIMD=scalar|sse2|avx2 指定（用于测试和比较）。
+ */
+
+typedef void (*DirScanFn)(const void* sector, const char* name, DirScanMask* mask);
+typedef uint64_t (*FatMaskFn)(const void* fat, int bits);   // 64 个表项的空闲位图
+
+static const char* simd_name = "scalar";
+static DirScanFn dir_scan_impl;
+static FatMaskFn fat_mask_impl;
+
+// 文件名按小端序拆成 3 个 32 位字，第 3 个字只有 3 字节；name 为 NULL 时返回 false
+static bool name_words(const char* name, uint32_t words[3]) {
+    if(name == NULL) {
+        return false;
+    }
+    uint8_t bytes[12] = { 0 };
+    memcpy(bytes, name, FAT_NAME_LEN);
+    memcpy(words, bytes, sizeof(bytes));
+    return true;
+}
+
+static void dir_scan_scalar(const void* sector, const char* name, DirScanMask* mask) {
+    memset(mask, 0, sizeof(DirScanMask));
+    const uint8_t* p = sector;
+    for(int i = 0; i < DIR_ENTRIES_PER_SECTOR; i++, p += DIR_ENTRY_SIZE) {
+        uint32_t bit = 1u << i;
+        if(p[0] == NAME_FREE) {
+            mask->free |= bit;
+        } else if(p[0] == NAME_DELETED) {
+            mask->deleted |= bit;
+        }
+        if(p[FAT_NAME_LEN] == ATTR_LFN) {
+            mask->lfn |= bit;
+        }
+        if(name != NULL && memcmp(p, name, FAT_NAME_LEN) == 0) {
+            mask->match |= bit;
+        }
+    }
+}
+
+static uint64_t fat_mask_scalar(const void* fat, int bits) {
+    uint64_t mask = 0;
+    for(int i = 0; i < 64; i++) {
+        uint32_t entry = bits == 32 ? ((const uint32_t*)fat)[i] & FAT32_ENTRY_MASK : ((const uint16_t*)fat)[i];
+        mask |= (uint64_t)(entry == CLUSTER_FREE) << i;
+    }
+    return mask;
+}
+
+#ifdef SIMD_X86
+// 4x4 转置：输入每个向量是一个目录项的前 16 字节，输出 w[j] 是 4 个目录项的第 j 个 32 位字
+#define TRANSPOSE4(type, unpacklo32, unpackhi32, unpacklo64, unpackhi64, x0, x1, x2, x3, w) do { \
+        type t0_ = unpacklo32(x0, x1), t1_ = unpacklo32(x2, x3);                            \
+        type t2_ = unpackhi32(x0, x1), t3_ = unpackhi32(x2, x3);                            \
+        w[0] = unpacklo64(t0_, t1_);                                                        \
+        w[1] = unpackhi64(t0_, t1_);                                                        \
+        w[2] = unpacklo64(t2_, t3_);                                                        \
+    } while(0)
+
+__attribute__((target("sse2")))
+static void dir_scan_sse2(const void* sector, const char* name, DirScanMask* mask) {
+    uint32_t words[3] = { 0 };
+    bool want_name = name_words(name, words);
+    const __m128i low8 = _mm_set1_epi32(0xFF);
+    const __m128i low24 = _mm_set1_epi32(0xFFFFFF);
+    const __m128i probe0 = _mm_set1_epi32(words[0]);
+    const __m128i probe1 = _mm_set1_epi32(words[1]);
+    const __m128i probe2 = _mm_set1_epi32(words[2]);
+    const __m128i deleted = _mm_set1_epi32(NAME_DELETED);
+    const __m128i lfn = _mm_set1_epi32(ATTR_LFN);
+    uint32_t m_free = 0, m_deleted = 0, m_lfn = 0, m_match = 0;
+    const uint8_t* p = sector;
+    for(int i = 0; i < DIR_ENTRIES_PER_SECTOR; i += 4, p += 4 * DIR_ENTRY_SIZE) {
+        __m128i w[3];
+        __m128i x0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(p + DIR_ENTRY_SIZE));
+        __m128i x2 = _mm_loadu_si128((const __m128i*)(p + 2 * DIR_ENTRY_SIZE));
+        __m128i x3 = _mm_loadu_si128((const __m128i*)(p + 3 * DIR_ENTRY_SIZE));
+        TRANSPOSE4(__m128i, _mm_unpacklo_epi32, _mm_unpackhi_epi32, _mm_unpacklo_epi64, _mm_unpackhi_epi64,
+                   x0, x1, x2, x3, w);
+        __m128i first = _mm_and_si128(w[0], low8);
+        m_free |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(first, _mm_setzero_si128()))) << i;
+        m_deleted |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(first, deleted))) << i;
+        m_lfn |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_srli_epi32(w[2], 24), lfn))) << i;
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi32(w[0], probe0), _mm_cmpeq_epi32(w[1], probe1));
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi32(_mm_and_si128(w[2], low24), probe2));
+        m_match |= _mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+    }
+    mask->free = m_free;
+    mask->deleted = m_deleted;
+    mask->lfn = m_lfn;
+    mask->match = want_name ? m_match : 0;
+}
+
+// 同 dir_scan_sse2，每次处理 8 个目录项：第 i~i+3 项在低 128 位，第 i+4~i+7 项在高 128 位
+__attribute__((target("avx2")))
+static void dir_scan_avx2(const void* sector, const char* name, DirScanMask* mask) {
+    uint32_t words[3] = { 0 };
+    bool want_name = name_words(name, words);
+    const __m256i low8 = _mm256_set1_epi32(0xFF);
+    const __m256i low24 = _mm256_set1_epi32(0xFFFFFF);
+    const __m256i probe0 = _mm256_set1_epi32(words[0]);
+    const __m256i probe1 = _mm256_set1_epi32(words[1]);
+    const __m256i probe2 = _mm256_set1_epi32(words[2]);
+    const __m256i deleted = _mm256_set1_epi32(NAME_DELETED);
+    const __m256i lfn = _mm256_set1_epi32(ATTR_LFN);
+    uint32_t m_free = 0, m_deleted = 0, m_lfn = 0, m_match = 0;
+    const uint8_t* p = sector;
+    for(int i = 0; i < DIR_ENTRIES_PER_SECTOR; i += 8, p += 8 * DIR_ENTRY_SIZE) {
+        __m256i x[4], w[3];
+        for(int j = 0; j < 4; j++) {
+            x[j] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + j * DIR_ENTRY_SIZE))),
+                _mm_loadu_si128((const __m128i*)(p + (j + 4) * DIR_ENTRY_SIZE)), 1);
+        }
+        TRANSPOSE4(__m256i, _mm256_unpacklo_epi32, _mm256_unpackhi_epi32, _mm256_unpacklo_epi64,
+                   _mm256_unpackhi_epi64, x[0], x[1], x[2], x[3], w);
+        __m256i first = _mm256_and_si256(w[0], low8);
+        m_free |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(first, _mm256_setzero_si256()))) << i;
+        m_deleted |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(first, deleted))) << i;
+        m_lfn |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_srli_epi32(w[2], 24), lfn))) << i;
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi32(w[0], probe0), _mm256_cmpeq_epi32(w[1], probe1));
+        eq = _mm256_and_si256(eq, _mm256_cmpeq_epi32(_mm256_and_si256(w[2], low24), probe2));
+        m_match |= _mm256_movemask_ps(_mm256_castsi256_ps(eq)) << i;
+    }
+    mask->free = m_free;
+    mask->deleted = m_deleted;
+    mask->lfn = m_lfn;
+    mask->match = want_name ? m_match : 0;
+}
+
+// 比较结果压缩成字节后 movemask，每次得到 16 个表项的位图
+__attribute__((target("sse2")))
+static uint64_t fat_mask_sse2(const void* fat, int bits) {
+    const __m128i zero = _mm_setzero_si128();
+    uint64_t mask = 0;
+    if(bits == 32) {
+        const __m128i entry_mask = _mm_set1_epi32(FAT32_ENTRY_MASK);
+        const __m128i* p = fat;
+        for(int i = 0; i < 64; i += 16, p += 4) {
+            __m128i c[4];
+            for(int j = 0; j < 4; j++) {
+                c[j] = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(p + j), entry_mask), zero);
+            }
+            __m128i b = _mm_packs_epi16(_mm_packs_epi32(c[0], c[1]), _mm_packs_epi32(c[2], c[3]));
+            mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(b) << i;
+        }
+    } else {
+        const __m128i* p = fat;
+        for(int i = 0; i < 64; i += 16, p += 2) {
+            __m128i a = _mm_cmpeq_epi16(_mm_loadu_si128(p), zero);
+            __m128i b = _mm_cmpeq_epi16(_mm_loadu_si128(p + 1), zero);
+            mask |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_packs_epi16(a, b)) << i;
+        }
+    }
+    return mask;
+}
+
+__attribute__((target("avx2")))
+static uint64_t fat_mask_avx2(const void* fat, int bits) {
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t mask = 0;
+    if(bits == 32) {
+        const __m256i entry_mask = _mm256_set1_epi32(FAT32_ENTRY_MASK);
+        const __m256i* p = fat;
+        for(int i = 0; i < 64; i += 8, p++) {
+            __m256i c = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(p), entry_mask), zero);
+            mask |= (uint64_t)(uint8_t)_mm256_movemask_ps(_mm256_castsi256_ps(c)) << i;
+        }
+    } else {
+        const __m256i* p = fat;
+        for(int i = 0; i < 64; i += 32, p += 2) {
+            __m256i a = _mm256_cmpeq_epi16(_mm256_loadu_si256(p), zero);
+            __m256i b = _mm256_cmpeq_epi16(_mm256_loadu_si256(p + 1), zero);
+            // packs 按 128 位分别打包，结果的 64 位块顺序是 a 低、b 低、a 高、b 高，需要调整
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xD8);
+            mask |= (uint64_t)(uint32_t)_mm256_movemask_epi8(packed) << i;
+        }
+    }
+    return mask;
+}
+#endif
+
+__attribute__((constructor))
+static void simd_select(void) {
+    const char* want = getenv("FAT16_SIMD");
+    dir_scan_impl = dir_scan_scalar;
+    fat_mask_impl = fat_mask_scalar;
+    simd_name = "scalar";
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if(want != NULL && strcmp(want, "scalar") == 0) {
+        return;
+    }
+    if(__builtin_cpu_supports("sse2")) {
+        dir_scan_impl = dir_scan_sse2;
+        fat_mask_impl = fat_mask_sse2;
+        simd_name = "sse2";
+    }
+    if(__builtin_cpu_supports("avx2") && (want == NULL || strcmp(want, "sse2") != 0)) {
+        dir_scan_impl = dir_scan_avx2;
+        fat_mask_impl = fat_mask_avx2;
+        simd_name = "avx2";
+    }
+#endif
+}
+
+/**
+ * @brief 返回正在使用的向量化实现：scalar、sse2 或 avx2
+ */
+const char* simd_variant(void) {
+    return simd_name;
+}
+
+/**
+ * @brief 一次扫描一个物理扇区中的 DIR_ENTRIES_PER_SECTOR 个目录项，第 i 项对应各位图的第 i 位
+ *
+ * @param sector    扇区内容
+ * @param name      要匹配的 8.3 文件名（11 字节），为 NULL 时 mask->match 为 0
+ * @param mask      输出：空项、删除项、LFN 项和文件名匹配的位图。match 不排除 LFN 项和删除项
+ */
+void dir_scan(const void* sector, const char* name, DirScanMask* mask) {
+    dir_scan_impl(sector, name, mask);
+}
+
+/**
+ * @brief 生成 FAT 表的空闲位图：表项 i 为 0（FAT32 不计高 4 位）时 bitmap 第 i 位为 1
+ *
+ * @param fat       原始的 FAT 表项，小端序
+ * @param n         表项数
+ * @param bits      表项的位数，16 或 32
+ * @param bitmap    输出，至少 (n + 63) / 64 个字，最后一个字中多余的位为 0
+ */
+void fat_free_bitmap(const void* fat, size_t n, int bits, uint64_t* bitmap) {
+    size_t entry_size = bits / 8;
+    const char* p = fat;
+    size_t i = 0;
+    for(; i + 64 <= n; i += 64) {
+        bitmap[i / 64] = fat_mask_impl(p + i * entry_size, bits);
+    }
+    if(i < n) {
+        // 最后不足 64 项的部分复制到补 0xFF 的缓冲区中，多出的表项不是空闲的
+        uint8_t tail[64 * sizeof(uint32_t)];
+        memset(tail, 0xFF, sizeof(tail));
+        memcpy(tail, p + i * entry_size, (n - i) * entry_size);
+        bitmap[i / 64] = fat_mask_impl(tail, bits);
+    }
+}
+
+#define FAT_SCAN_WORDS 64       // 计数和找连续空闲簇时每次生成的位图长度（4096 个表项）
+
+/**
+ * @brief 统计 FAT 表中空闲的表项数
+ */
+size_t fat_count_free(const void* fat, size_t n, int bits) {
+    uint64_t bitmap[FAT_SCAN_WORDS];
+    size_t count = 0;
+    for(size_t i = 0; i < n; i += FAT_SCAN_WORDS * 64) {
+        size_t len = min(n - i, (size_t)FAT_SCAN_WORDS * 64);
+        fat_free_bitmap((const char*)fat + i * (bits / 8), len, bits, bitmap);
+        for(size_t w = 0; w < (len + 63) / 64; w++) {
+            count += __builtin_popcountll(bitmap[w]);
+        }
+    }
+    return count;
+}
+
+// 位图字 w 中从某一位开始连续 len 个 1 的起始位的集合（1 <= len <= 64）
+static uint64_t runs_of(uint64_t w, size_t len) {
+    size_t have = 1;
+    while(have < len && w != 0) {
+        size_t shift = min(have, len - have);
+        w &= w >> shift;
+        have += shift;
+    }
+    return w;
+}
+
+/**
+ * @brief 找第一段连续 want 个空闲的表项，可以分多次调用扫描一个大的 FAT 表
+ *
+ * @param carry     输入：紧接在 fat 之前的连续空闲表项数（小于 want）；输出：fat 末尾的连续空闲表项数
+ * @return size_t   找到时返回这一段最后一个表项在 fat 中的下标（这一段可能从 fat 之前开始），
+ *                  找不到返回 SIZE_MAX
+ */
+size_t fat_find_free_run(const void* fat, size_t n, int bits, size_t want, size_t* carry) {
+    uint64_t bitmap[FAT_SCAN_WORDS];
+    size_t run = *carry;
+    for(size_t i = 0; i < n; i += FAT_SCAN_WORDS * 64) {
+        size_t len = min(n - i, (size_t)FAT_SCAN_WORDS * 64);
+        fat_free_bitmap((const char*)fat + i * (bits / 8), len, bits, bitmap);
+        for(size_t w = 0; w < (len + 63) / 64; w++) {
+            size_t base = i + w * 64;
+            size_t valid = min(len - w * 64, (size_t)64);
+            uint64_t word = bitmap[w];
+            uint64_t all = valid == 64 ? UINT64_MAX : (UINT64_C(1) << valid) - 1;
+            if(word == all) {
+                if(run + valid >= want) {
+                    return base + (want - run) - 1;
+                }
+                run += valid;
+                continue;
+            }
+            // 与之前的连续空闲表项相接的一段
+            size_t lead = __builtin_ctzll(~word);
+            if(run + lead >= want) {
+                return base + (want - run) - 1;
+            }
+            // 完全在这个字中的一段
+            if(want <= 64) {
+                uint64_t starts = runs_of(word, want);
+                if(starts != 0) {
+                    return base + __builtin_ctzll(starts) + want - 1;
+                }
+            }
+            // 末尾的一段：把第 valid - 1 位移到最高位后数前导的 1
+            run = __builtin_clzll(~(word << (64 - valid)));
+        }
+    }
+    *carry = run;
+    return SIZE_MAX;
+}
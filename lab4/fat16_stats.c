@@ -0,0 +1,402 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fat16.h"
+#include "fat16_trace.h"
+
+/**
+ * 每个 FUSE 操作的调用次数、延迟直方图和磁盘 I/O 统计，通过挂载点下只读的虚拟文件 /.stats 查看。
+ * 同一层还提供其他只读虚拟文件（见 VIRTUAL_FILES）。
+ *
+ * fat16_oper 中的每个回调都被替换为一个包装函数：包装函数记录耗时，并把当前线程正在执行的操作
+ * 记在线程局部变量里，sector_read / sector_write 据此把扇区读写和寻道计入对应的操作。
+ * 所有计数器都是用原子操作累加的，不需要加锁。
+ *
+ * 如果用 --trace 打开了跟踪，包装函数同时把每次调用的参数、返回值和时间记录到跟踪文件（fat16_trace.c）。
+ */
+
+#define LATENCY_BUCKETS 32      // 第 i 个桶统计耗时在 [2^i, 2^(i+1)) 微秒的调用，第 0 个桶包括不足 1 微秒的调用
+
+const char* const OP_NAMES[OP_COUNT] = {
+    "other", "init", "destroy", "getattr", "readdir", "read", "mknod", "unlink",
+    "utimens", "mkdir", "rmdir", "write", "truncate", "open", "release", "rename",
+    "copy_range", "ioctl"
+};
+
+typedef struct {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t total_ns;
+    uint64_t latency[LATENCY_BUCKETS];
+    uint64_t sector_reads;
+    uint64_t sector_writes;
+    uint64_t seeks;             // 磁头移动过的次数
+    uint64_t tracks;            // 磁头移动过的磁道总数
+} OpStats;
+
+static OpStats stats[OP_COUNT];
+static __thread int current_op = OP_OTHER;
+static struct fuse_operations inner;     // 被包装的原始回调
+
+// 挂载点根目录下的只读虚拟文件，内容在打开时生成
+typedef struct {
+    const char* path;
+    char* (*render)(size_t* len);
+} VirtualFile;
+
+static const VirtualFile VIRTUAL_FILES[] = {
+    { "/.stats", stats_render },
+    { "/.heatmap", disk_heatmap_render },   // 模拟磁盘的 I/O 热力图（CSV），需要 --heatmap
+};
+
+// 打开虚拟文件时生成的内容，保存在 fi->fh 中
+typedef struct {
+    char* text;
+    size_t len;
+} Snapshot;
+
+static void counter_add(uint64_t* counter, uint64_t v) {
+    __atomic_fetch_add(counter, v, __ATOMIC_RELAXED);
+}
+
+static uint64_t counter_get(const uint64_t* counter) {
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief 由模拟磁盘在每次扇区读写时调用，计入当前线程正在执行的操作
+ *
+ * @param write     是否为写
+ * @param tracks    本次读写前磁头移动的磁道数
+ */
+void stats_disk_io(bool write, long tracks) {
+    OpStats* s = &stats[current_op];
+    counter_add(write ? &s->sector_writes : &s->sector_reads, 1);
+    if(tracks != 0) {
+        counter_add(&s->seeks, 1);
+        counter_add(&s->tracks, tracks);
+    }
+}
+
+static uint64_t op_begin(int op) {
+    current_op = op;
+    return now_ns();
+}
+
+// 返回本次调用的耗时（纳秒）
+static uint64_t op_end(int op, uint64_t start, long ret) {
+    uint64_t ns = now_ns() - start;
+    uint64_t us = ns / 1000;
+    int bucket = us == 0 ? 0 : min(63 - __builtin_clzll(us), LATENCY_BUCKETS - 1);
+    OpStats* s = &stats[op];
+    counter_add(&s->calls, 1);
+    counter_add(&s->total_ns, ns);
+    counter_add(&s->latency[bucket], 1);
+    if(ret < 0) {
+        counter_add(&s->errors, 1);
+    }
+    current_op = OP_OTHER;
+    return ns;
+}
+
+// 包装一个返回 int 的回调，path、arg1、arg2 记录到跟踪文件
+#define STATS_CALL(op, call, path, arg1, arg2) do {                     \
+        uint64_t start_ = op_begin(op);                                 \
+        int ret_ = (call);                                              \
+        uint64_t ns_ = op_end(op, start_, ret_);                        \
+        trace_record(op, start_, ns_, ret_, path, NULL, arg1, arg2, 0); \
+        return ret_;                                                    \
+    } while(0)
+
+static const VirtualFile* virtual_file(const char* path) {
+    for(size_t i = 0; i < sizeof(VIRTUAL_FILES) / sizeof(VIRTUAL_FILES[0]); i++) {
+        if(strcmp(path, VIRTUAL_FILES[i].path) == 0) {
+            return &VIRTUAL_FILES[i];
+        }
+    }
+    return NULL;
+}
+
+// 估算直方图中第 p 百分位所在的桶，返回桶的上界（微秒）
+static uint64_t percentile_us(const uint64_t* hist, uint64_t total, double p) {
+    uint64_t target = (uint64_t)(total * p);
+    uint64_t seen = 0;
+    for(int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += hist[i];
+        if(seen > target) {
+            return 1ull << (i + 1);
+        }
+    }
+    return 1ull << LATENCY_BUCKETS;
+}
+
+/**
+ * @brief 生成 /.stats 的内容，返回 malloc 分配的字符串
+ */
+char* stats_render(size_t* len) {
+    size_t cap = 8192;
+    char* buf = malloc(cap);
+    size_t pos = 0;
+#define EMIT(...) do {                                                  \
+        int n_ = snprintf(buf + pos, cap - pos, __VA_ARGS__);           \
+        if(pos + n_ >= cap) {                                           \
+            cap = (pos + n_) * 2;                                       \
+            buf = realloc(buf, cap);                                    \
+            n_ = snprintf(buf + pos, cap - pos, __VA_ARGS__);           \
+        }                                                               \
+        pos += n_;                                                      \
+    } while(0)
+
+    EMIT("%-10s %10s %8s %10s %8s %8s %12s %12s %10s %12s\n", "op", "calls", "errors", "avg_us",
+         "p50_us", "p99_us", "sec_reads", "sec_writes", "seeks", "tracks");
+    uint64_t hist[OP_COUNT][LATENCY_BUCKETS];
+    for(int op = 0; op < OP_COUNT; op++) {
+        OpStats* s = &stats[op];
+        uint64_t calls = counter_get(&s->calls);
+        uint64_t reads = counter_get(&s->sector_reads);
+        uint64_t writes = counter_get(&s->sector_writes);
+        for(int i = 0; i < LATENCY_BUCKETS; i++) {
+            hist[op][i] = counter_get(&s->latency[i]);
+        }
+        if(calls == 0 && reads == 0 && writes == 0) {
+            continue;
+        }
+        EMIT("%-10s %10lu %8lu %10.1f %8lu %8lu %12lu %12lu %10lu %12lu\n", OP_NAMES[op], calls,
+             counter_get(&s->errors), calls ? counter_get(&s->total_ns) / 1000.0 / calls : 0.0,
+             calls ? percentile_us(hist[op], calls, 0.5) : 0, calls ? percentile_us(hist[op], calls, 0.99) : 0,
+             reads, writes, counter_get(&s->seeks), counter_get(&s->tracks));
+    }
+
+    EMIT("\nlatency histogram (us, log2 buckets):\n");
+    for(int op = 0; op < OP_COUNT; op++) {
+        bool any = false;
+        for(int i = 0; i < LATENCY_BUCKETS; i++) {
+            if(hist[op][i] == 0) {
+                continue;
+            }
+            if(!any) {
+                EMIT("%-10s", OP_NAMES[op]);
+                any = true;
+            }
+            EMIT(" [%llu,%llu):%lu", i == 0 ? 0ull : 1ull << i, 1ull << (i + 1), hist[op][i]);
+        }
+        if(any) {
+            EMIT("\n");
+        }
+    }
+#undef EMIT
+    *len = pos;
+    return buf;
+}
+
+/**
+ * @brief 清零所有计数器
+ */
+void stats_reset(void) {
+    uint64_t* words = (uint64_t*)stats;
+    for(size_t i = 0; i < sizeof(stats) / (sizeof(uint64_t)); i++) {
+        __atomic_store_n(&words[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+// ===========================包装后的回调===============================
+
+static void* stats_init(struct fuse_conn_info* conn, struct fuse_config* config) {
+    uint64_t start = op_begin(OP_INIT);
+    void* ret = inner.init ? inner.init(conn, config) : NULL;
+    trace_record(OP_INIT, start, op_end(OP_INIT, start, 0), 0, NULL, NULL, 0, 0, 0);
+    return ret;
+}
+
+static void stats_destroy(void* data) {
+    uint64_t start = op_begin(OP_DESTROY);
+    if(inner.destroy) {
+        inner.destroy(data);
+    }
+    trace_record(OP_DESTROY, start, op_end(OP_DESTROY, start, 0), 0, NULL, NULL, 0, 0, 0);
+    trace_close();
+}
+
+static int stats_getattr(const char* path, struct stat* stbuf, struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        memset(stbuf, 0, sizeof(struct stat));
+        stbuf->st_mode = S_IFREG | S_IRUGO;
+        stbuf->st_nlink = 1;
+        stbuf->st_uid = getuid();
+        stbuf->st_gid = getgid();
+        return 0;
+    }
+    STATS_CALL(OP_GETATTR, inner.getattr(path, stbuf, fi), path, 0, 0);
+}
+
+static int stats_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset,
+                         struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
+    STATS_CALL(OP_READDIR, inner.readdir(path, buf, filler, offset, fi, flags), path, offset, 0);
+}
+
+static int stats_open(const char* path, struct fuse_file_info* fi) {
+    const VirtualFile* vf = virtual_file(path);
+    if(vf != NULL) {
+        if((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
+        }
+        // 打开时生成快照，读取期间内容不变；文件大小未知，所以绕过内核页缓存
+        Snapshot* snapshot = malloc(sizeof(Snapshot));
+        snapshot->text = vf->render(&snapshot->len);
+        fi->fh = (uint64_t)(uintptr_t)snapshot;
+        fi->direct_io = 1;
+        return 0;
+    }
+    STATS_CALL(OP_OPEN, inner.open ? inner.open(path, fi) : 0, path, 0, fi->flags);
+}
+
+static int stats_release(const char* path, struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        Snapshot* snapshot = (Snapshot*)(uintptr_t)fi->fh;
+        free(snapshot->text);
+        free(snapshot);
+        return 0;
+    }
+    STATS_CALL(OP_RELEASE, inner.release ? inner.release(path, fi) : 0, path, 0, 0);
+}
+
+static int stats_read(const char* path, char* buffer, size_t size, off_t offset,
+                      struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        Snapshot* snapshot = (Snapshot*)(uintptr_t)fi->fh;
+        if((size_t)offset >= snapshot->len) {
+            return 0;
+        }
+        size = min(size, snapshot->len - offset);
+        memcpy(buffer, snapshot->text + offset, size);
+        return size;
+    }
+    STATS_CALL(OP_READ, inner.read(path, buffer, size, offset, fi), path, offset, size);
+}
+
+static int stats_mknod(const char* path, mode_t mode, dev_t dev) {
+    if(virtual_file(path) != NULL) {
+        return -EEXIST;
+    }
+    STATS_CALL(OP_MKNOD, inner.mknod(path, mode, dev), path, 0, mode);
+}
+
+static int stats_unlink(const char* path) {
+    if(virtual_file(path) != NULL) {
+        return -EACCES;
+    }
+    STATS_CALL(OP_UNLINK, inner.unlink(path), path, 0, 0);
+}
+
+static uint64_t trace_time(const struct timespec* ts) {
+    if(ts->tv_nsec == UTIME_NOW) {
+        return TRACE_TIME_NOW;
+    }
+    if(ts->tv_nsec == UTIME_OMIT) {
+        return TRACE_TIME_OMIT;
+    }
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+static int stats_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        return -EACCES;
+    }
+    STATS_CALL(OP_UTIMENS, inner.utimens(path, tv, fi), path, trace_time(&tv[0]), trace_time(&tv[1]));
+}
+
+static int stats_mkdir(const char* path, mode_t mode) {
+    if(virtual_file(path) != NULL) {
+        return -EEXIST;
+    }
+    STATS_CALL(OP_MKDIR, inner.mkdir(path, mode), path, 0, mode);
+}
+
+static int stats_rmdir(const char* path) {
+    if(virtual_file(path) != NULL) {
+        return -ENOTDIR;
+    }
+    STATS_CALL(OP_RMDIR, inner.rmdir(path), path, 0, 0);
+}
+
+static int stats_rename(const char* from, const char* to, unsigned int flags) {
+    if(virtual_file(from) != NULL || virtual_file(to) != NULL) {
+        return -EACCES;
+    }
+    uint64_t start = op_begin(OP_RENAME);
+    int ret = inner.rename(from, to, flags);
+    trace_record(OP_RENAME, start, op_end(OP_RENAME, start, ret), ret, from, to, 0, flags, 0);
+    return ret;
+}
+
+static ssize_t stats_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                                     const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                                     size_t size, int flags) {
+    if(virtual_file(path_in) != NULL) {
+        return -EOPNOTSUPP;     // 内核退回普通的读写，从快照中读取
+    }
+    if(virtual_file(path_out) != NULL) {
+        return -EACCES;
+    }
+    uint64_t start = op_begin(OP_COPY_FILE_RANGE);
+    ssize_t ret = inner.copy_file_range(path_in, fi_in, offset_in, path_out, fi_out, offset_out, size, flags);
+    trace_record(OP_COPY_FILE_RANGE, start, op_end(OP_COPY_FILE_RANGE, start, ret), ret,
+                 path_in, path_out, offset_in, offset_out, size);
+    return ret;
+}
+
+static int stats_write(const char* path, const char* data, size_t size, off_t offset,
+                       struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        return -EACCES;
+    }
+    STATS_CALL(OP_WRITE, inner.write(path, data, size, offset, fi), path, offset, size);
+}
+
+static int stats_truncate(const char* path, off_t size, struct fuse_file_info* fi) {
+    if(virtual_file(path) != NULL) {
+        return -EACCES;
+    }
+    STATS_CALL(OP_TRUNCATE, inner.truncate(path, size, fi), path, size, 0);
+}
+
+static int stats_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi,
+                       unsigned int flags, void* data) {
+    if(virtual_file(path) != NULL) {
+        return -ENOTTY;
+    }
+    STATS_CALL(OP_IOCTL, inner.ioctl(path, cmd, arg, fi, flags, data), path, 0, (unsigned int)cmd);
+}
+
+/**
+ * @brief 用带统计的包装函数替换 ops 中的回调，需要在 fuse_main 之前调用
+ */
+void stats_wrap_operations(struct fuse_operations* ops) {
+    inner = *ops;
+    ops->init = stats_init;
+    ops->destroy = stats_destroy;
+    ops->getattr = stats_getattr;
+    ops->readdir = stats_readdir;
+    ops->open = stats_open;
+    ops->release = stats_release;
+    ops->read = stats_read;
+    ops->mknod = stats_mknod;
+    ops->unlink = stats_unlink;
+    ops->utimens = stats_utimens;
+    ops->mkdir = stats_mkdir;
+    ops->rmdir = stats_rmdir;
+    ops->rename = stats_rename;
+    ops->copy_file_range = stats_copy_file_range;
+    ops->write = stats_write;
+    ops->truncate = stats_truncate;
+    ops->ioctl = stats_ioctl;
+}
@@ -0,0 +1,125 @@
+/**
+ * fat16_stripe: 把镜像拆分为条带化逻辑卷的成员镜像，或把成员镜像合并回一个镜像。
+ *
+ * 用法: fat16_stripe [-j] [-k stripe_kb] <镜像> <成员>...
+ *   -j  合并：把成员镜像合并为 <镜像>（默认是拆分：把 <镜像> 拆分为各个成员）
+ *   -k  条带大小（KB，默认 64），挂载时 simple_fat16 --stripe_kb 必须相同
+ *
+ * 第 k 个条带写入第 k % n 个成员的第 k / n 个条带处（与 fat16_fixed.c 中的映射相同）。
+ * 拆分时各个成员补零到相同大小；合并时按引导扇区中的总扇区数截掉补上的零，
+ * 合并后的镜像可以直接交给 fat16_fsck 等离线工具。
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fat16.h"
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-j] [-k stripe_kb] <image> <member>...\n", prog);
+}
+
+// 读满 len 字节，文件末尾之后补零
+static int read_full(int fd, char* buf, size_t len, off_t offset) {
+    ssize_t n = pread(fd, buf, len, offset);
+    if(n < 0) {
+        return -errno;
+    }
+    memset(buf + n, 0, len - n);
+    return 0;
+}
+
+static int write_full(int fd, const char* buf, size_t len, off_t offset) {
+    ssize_t n = pwrite(fd, buf, len, offset);
+    return n == (ssize_t)len ? 0 : n < 0 ? -errno : -EIO;
+}
+
+/**
+ * @brief 把 image 中的 stripes 个条带依次分给 n 个成员，stripes 是 n 的整数倍
+ *
+ * @param join  为真时方向相反，从成员读出写入 image
+ */
+static int copy_stripes(int image, const int* members, size_t n, size_t stripes, size_t stripe, bool join) {
+    char* buf = malloc(stripe);
+    if(buf == NULL) {
+        return -ENOMEM;
+    }
+    int ret = 0;
+    for(size_t k = 0; k < stripes && ret == 0; k++) {
+        off_t pos = (off_t)k * stripe;
+        off_t mpos = (off_t)(k / n) * stripe;
+        int member = members[k % n];
+        ret = join ? read_full(member, buf, stripe, mpos) : read_full(image, buf, stripe, pos);
+        if(ret == 0) {
+            ret = join ? write_full(image, buf, stripe, pos) : write_full(member, buf, stripe, mpos);
+        }
+    }
+    free(buf);
+    return ret;
+}
+
+// 引导扇区中记录的文件系统大小（字节），读不出时返回 0
+static off_t fs_size(int fd) {
+    BPB_BS bpb;
+    if(pread(fd, &bpb, sizeof(bpb), 0) != sizeof(bpb)) {
+        return 0;
+    }
+    off_t sectors = bpb.BPB_TotSec16 != 0 ? bpb.BPB_TotSec16 : bpb.BPB_TotSec32;
+    return sectors * bpb.BPB_BytsPerSec;
+}
+
+int main(int argc, char* argv[]) {
+    bool join = false;
+    unsigned long stripe_kb = 64;
+    int opt;
+    while((opt = getopt(argc, argv, "jk:")) != -1) {
+        switch(opt) {
+        case 'j': join = true; break;
+        case 'k': stripe_kb = strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if(argc - optind < 2 || stripe_kb == 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* path = argv[optind];
+    size_t n = argc - optind - 1;
+    size_t stripe = stripe_kb * 1024;
+
+    int image = open(path, join ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if(image < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    int* members = malloc(n * sizeof(int));
+    off_t member_size = -1;
+    for(size_t i = 0; i < n; i++) {
+        const char* mpath = argv[optind + 1 + i];
+        members[i] = open(mpath, join ? O_RDONLY : O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if(members[i] < 0) {
+            fprintf(stderr, "%s: %s\n", mpath, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        off_t size = lseek(members[i], 0, SEEK_END);
+        member_size = member_size < 0 ? size : min(member_size, size);
+    }
+
+    // 拆分时每个成员的条带数向上取整，合并时由最小的成员决定
+    size_t per_member = join ? member_size / stripe
+                             : (lseek(image, 0, SEEK_END) + stripe * n - 1) / (stripe * n);
+    int ret = copy_stripes(image, members, n, per_member * n, stripe, join);
+    off_t size = join ? fs_size(image) : 0;
+    if(ret == 0 && size > 0 && size < (off_t)(per_member * n * stripe) && ftruncate(image, size) < 0) {
+        ret = -errno;
+    }
+    if(ret < 0) {
+        fprintf(stderr, "%s: %s failed: %s\n", path, join ? "join" : "split", strerror(-ret));
+        return EXIT_FAILURE;
+    }
+    printf("%s: %s %zu members, %zu stripes of %lu KB each\n", path, join ? "joined" : "split into", n,
+           per_member, stripe_kb);
+    return EXIT_SUCCESS;
+}
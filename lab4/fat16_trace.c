@@ -0,0 +1,78 @@
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "fat16.h"
+#include "fat16_trace.h"
+
+static FILE* trace_file;        // 为 NULL 时不记录
+static uint64_t trace_epoch;    // 开始跟踪时的 CLOCK_MONOTONIC 时间
+
+/**
+ * @brief 开始把每个 FUSE 操作记录到 path，需要在 stats_wrap_operations 之后、fuse_main 之前调用
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int trace_open(const char* path) {
+    FILE* f = fopen(path, "wb");
+    if(f == NULL) {
+        return -errno;
+    }
+    // 记录很小且频繁，用大缓冲减少系统调用
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    TraceHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record_size = sizeof(TraceRecord);
+    fwrite(&header, sizeof(header), 1, f);
+    fflush(f);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    trace_epoch = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    trace_file = f;
+    return 0;
+}
+
+void trace_close(void) {
+    if(trace_file != NULL) {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+}
+
+/**
+ * @brief 记录一次操作。start_ns 是 CLOCK_MONOTONIC 时间，path2 只有 rename 和 copy_file_range 使用，
+ *        arg1/arg2/arg3 的含义见 TraceRecord。
+ */
+void trace_record(int op, uint64_t start_ns, uint64_t duration_ns, int ret,
+                  const char* path, const char* path2, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+    FILE* f = trace_file;
+    if(f == NULL) {
+        return;
+    }
+    size_t len = path ? strlen(path) : 0;
+    size_t len2 = path2 ? strlen(path2) : 0;
+    if(len + 1 + len2 > UINT16_MAX) {
+        return;
+    }
+    TraceRecord rec = {
+        .op = op,
+        .path_len = path2 ? len + 1 + len2 : len,
+        .ret = ret,
+        .start_ns = start_ns - trace_epoch,
+        .duration_ns = duration_ns,
+        .arg1 = arg1,
+        .arg2 = arg2,
+        .arg3 = arg3,
+    };
+    // 多个 FUSE 线程同时记录时，保证记录和路径连续写入
+    flockfile(f);
+    fwrite(&rec, sizeof(rec), 1, f);
+    fwrite(path, 1, len, f);
+    if(path2 != NULL) {
+        fputc('\0', f);
+        fwrite(path2, 1, len2, f);
+    }
+    funlockfile(f);
+}
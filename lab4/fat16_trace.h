@@ -0,0 +1,44 @@
+#ifndef FAT16_TRACE_H
+#define FAT16_TRACE_H
+
+#include <stdint.h>
+
+/**
+ * --trace=file 记录的二进制跟踪文件格式：
+ *   文件头 TraceHeader，之后是若干条记录，每条记录是 TraceRecord 后接 path_len 字节的路径（不含 '\0'）。
+ *   rename 和 copy_file_range 记录两个路径，中间用一个 '\0' 分隔，都计入 path_len。
+ * 不记录写入的数据，重放时写入固定内容。所有字段都是小端序。
+ */
+
+#define TRACE_MAGIC   "F16TRACE"
+#define TRACE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;       // sizeof(TraceRecord)，用于检查格式
+} __attribute__((packed)) TraceHeader;
+
+// utimens 的时间戳为 UTIME_NOW / UTIME_OMIT 时记录的值
+#define TRACE_TIME_NOW  UINT64_MAX
+#define TRACE_TIME_OMIT (UINT64_MAX - 1)
+
+typedef struct {
+    uint8_t op;                 // enum FuseOp
+    uint8_t reserved;
+    uint16_t path_len;
+    int32_t ret;                // 回调的返回值
+    uint64_t start_ns;          // 相对于开始跟踪时刻的开始时间
+    uint64_t duration_ns;
+    uint64_t arg1;              // read/write: 偏移；truncate: 大小；utimens: atime（纳秒）
+    uint64_t arg2;              // read/write: 长度；mknod/mkdir: mode；open: flags；utimens: mtime（纳秒）；rename: flags
+                                // copy_file_range: 目标文件中的偏移
+    uint64_t arg3;              // copy_file_range: 长度（arg1 是源文件中的偏移）
+} __attribute__((packed)) TraceRecord;
+
+int trace_open(const char* path);
+void trace_close(void);
+void trace_record(int op, uint64_t start_ns, uint64_t duration_ns, int ret,
+                  const char* path, const char* path2, uint64_t arg1, uint64_t arg2, uint64_t arg3);
+
+#endif
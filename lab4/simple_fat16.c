@@ -13,6 +13,15 @@
 
 #include "fat16.h"
 
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+#ifndef RENAME_EXCHANGE
+#define RENAME_EXCHANGE (1 << 1)
+#endif
+
+#define FAT16_MAX_REQUEST (1 << 20)     // 一次 read / write 请求的最大字节数
+
 /* FAT16 volume data with a file handler of the FAT16 image file */
 // 存储 FAT 文件系统所需要的元数据的数据结构
 typedef struct {
@@ -32,6 +41,12 @@ typedef struct {
     uint32_t clusters;              // 文件系统簇数
     uint32_t cluster_size;          // 簇大小（字节）
 
+    int fat_bits;                   // FAT 表项的位数，16 或 32
+    cluster_t root_clus;            // FAT32 根目录的第一个簇，FAT16 为 0（根目录在固定区域）
+    sector_t fsinfo_sec;            // FAT32 FSInfo 扇区，0 表示没有
+    uint32_t free_count;            // 空闲簇数，FSINFO_UNKNOWN 表示未知
+    cluster_t next_free;            // 下次分配簇时开始查找的位置
+
     uid_t fs_uid;               // 可忽略，挂载FAT的用户ID，所有文件的拥有者都显示为该用户
     gid_t fs_gid;               // 可忽略，挂载FAT的组ID，所有文件的用户组都显示为该组
     struct timespec atime;      // 可忽略，访问时间
@@ -54,7 +69,7 @@ size_t sector_offset(sector_t sector) {
  * @return int        
  */
 bool is_cluster_inuse(cluster_t clus) {
-    return CLUSTER_MIN <= clus && clus <= CLUSTER_MAX;
+    return CLUSTER_MIN <= clus && clus <= CLUSTER_MAX && clus <= meta.clusters + 1;
 }
 
 sector_t cluster_first_sector(cluster_t clus) {
@@ -101,14 +116,15 @@ bool is_valid(DIR_ENTRY* dir) {
     return !is_lfn(attr) && name[0] != NAME_DELETED && name[0] != NAME_FREE;
 }
 
+static const char DOT_NAME[] =    ".          ";
+static const char DOTDOT_NAME[] = "..         ";
+
 bool is_dot(DIR_ENTRY* dir) {
     if(is_lfn(dir->DIR_Attr)) {
         return false;
     }
     const char* name = (const char *)dir->DIR_Name;
     attr_t attr = dir->DIR_Attr;
-    const char DOT_NAME[] =    ".          ";
-    const char DOTDOT_NAME[] = "..         ";
     return strncmp(name, DOT_NAME, FAT_NAME_LEN) == 0 || strncmp(name, DOTDOT_NAME, FAT_NAME_LEN) == 0;
 }
 
@@ -203,6 +219,62 @@ bool check_name(const char* name, size_t len, const DIR_ENTRY* dir) {
     return strncmp(fatname, (const char *)dir->DIR_Name, FAT_NAME_LEN) == 0;
 }
 
+// 每个 FAT 扇区中的表项数
+static size_t fat_entries_per_sector(void) {
+    return meta.sector_size / (meta.fat_bits / 8);
+}
+
+// 读取 FAT 扇区中第 index 个表项，换算为 cluster_t
+static cluster_t fat_sector_get(const char* sector_buffer, size_t index) {
+    if(meta.fat_bits == 32) {
+        return fat_entry_decode(((const uint32_t*)sector_buffer)[index], 32);
+    }
+    return fat_entry_decode(((const uint16_t*)sector_buffer)[index], 16);
+}
+
+/**
+ * @brief 修改 FAT 扇区中第 index 个表项，FAT32 保留表项的高 4 位。返回原来的值。
+ */
+static cluster_t fat_sector_set(char* sector_buffer, size_t index, cluster_t clus) {
+    cluster_t old = fat_sector_get(sector_buffer, index);
+    if(meta.fat_bits == 32) {
+        uint32_t* entry = (uint32_t*)sector_buffer + index;
+        *entry = (*entry & ~FAT32_ENTRY_MASK) | fat_entry_encode(clus, 32);
+    } else {
+        ((uint16_t*)sector_buffer)[index] = fat_entry_encode(clus, 16);
+    }
+    return old;
+}
+
+// 表项由 old 改为 clus 时更新空闲簇数
+static void free_count_update(cluster_t old, cluster_t clus) {
+    if(meta.free_count == FSINFO_UNKNOWN || (old == CLUSTER_FREE) == (clus == CLUSTER_FREE)) {
+        return;
+    }
+    meta.free_count += clus == CLUSTER_FREE ? 1 : -1;
+}
+
+#define FAT_SCAN_BYTES (32 * 1024)    // 批量扫描 FAT 表时每次读取的字节数
+
+/**
+ * @brief 批量扫描 FAT 表：读取从簇 from 开始、到簇 to 为止的一段表项，最多 FAT_SCAN_BYTES 字节
+ *
+ * @param buf       至少 FAT_SCAN_BYTES 字节（逻辑扇区更大时为一个扇区）
+ * @param entries   输出参数，指向 buf 中簇 from 的原始表项
+ * @return long     读到的表项数，失败返回错误代码负值
+ */
+static long fat_scan_chunk(size_t from, size_t to, char* buf, const void** entries) {
+    size_t per_sec = fat_entries_per_sector();
+    size_t sec = from / per_sec;
+    size_t count = min(max(FAT_SCAN_BYTES / meta.sector_size, 1), to / per_sec - sec + 1);
+    int ret = sectors_read(meta.fat_sec + sec, count, buf);
+    if(ret < 0) {
+        return ret;
+    }
+    *entries = buf + from % per_sec * (meta.fat_bits / 8);
+    return min(count * per_sec - from % per_sec, to - from + 1);
+}
+
 /**
  * @brief 读取簇号为 clus 对应的 FAT 表项
  * 
@@ -219,14 +291,12 @@ cluster_t read_fat_entry(cluster_t clus)
     // 4. 从该偏移量处读取对应表项的值，并返回
     /** Your Code Here ... **/
 
-    sector_t sec_num = meta.fat_sec + clus / (meta.sector_size / 2);
+    size_t per_sec = fat_entries_per_sector();
+    sector_t sec_num = meta.fat_sec + clus / per_sec;
     //计算对应的fat表项位于哪个sector
-    off_t offset_in_sector = (clus * 2) % (meta.sector_size);
-    //计算对应的fat表项在sector内的偏移量
 
     sector_read(sec_num, sector_buffer);
-    cluster_t *temp = (cluster_t *)(sector_buffer + offset_in_sector);
-    return *temp;
+    return fat_sector_get(sector_buffer, clus % per_sec);
 }
 
 
@@ -257,36 +327,29 @@ int find_entry_in_sectors(const char* name, size_t len,
             sector_t from_sector, size_t sectors_count, 
             DirEntrySlot* slot) {
     char buffer[PHYSICAL_SECTOR_SIZE];
+    // 文件名只转换一次；不合法的文件名不会匹配任何目录项
+    char shortname[FAT_NAME_LEN];
+    bool valid_name = to_shortname(name, len, shortname) == 0;
     // 对每一个待查找的扇区：
     for(size_t i = 0; i < sectors_count; i++) {
         // TODO1.3: 读取每一个扇区扇区，步骤如下：
         // 1. 使用 sector_read 函数读取从扇区号 from_sector 开始的第 i 个扇区
         // 2. 对该扇区中的每一个目录项，检查是否是待查找的目录项（注意检查目录项是否合法）
-        
-        sector_read(from_sector+i, buffer);
-        for(size_t off = 0; off < meta.sector_size; off += DIR_ENTRY_SIZE) {
-            DIR_ENTRY* dir = (DIR_ENTRY*)(buffer + off);
-            // 3. 如果是待查找的目录项，将该目录项的信息填入 slot 中，并返回 FIND_EXIST
-            // 4. 如果不是待查找的目录项，检查该目录项是否为空，如果为空，将该目录项的信息填入 slot 中，并返回 FIND_EMPTY
-            // 5. 如果不是待查找的目录项，且该扇区中的所有目录项都不为空，返回 FIND_FULL
-            if (is_lfn(dir->DIR_Attr)) {
-                continue;
-            }//当前目录项是lfn
-            if (!is_deleted(dir)) {
-                if (check_name(name, len, dir)) {
-                    slot->dir = *dir;
-                    slot->sector=from_sector+i;
-                    slot->offset=off;
-                    return FIND_EXIST;
-                }
-            }
-            if (is_free(dir)) {
-                slot->dir=*dir;
-                slot->sector=from_sector+i;
-                slot->offset=off;
-                return FIND_EMPTY;
-            }
+        dir_sector_read(from_sector+i, buffer);
+
+        // 一次扫描整个扇区：跳过 LFN 项，未删除且文件名匹配的项是要找的项，空项表示后面没有目录项了
+        DirScanMask mask;
+        dir_scan(buffer, valid_name ? shortname : NULL, &mask);
+        uint32_t exist = mask.match & ~mask.lfn & ~mask.deleted;
+        uint32_t empty = mask.free & ~mask.lfn;
+        if((exist | empty) == 0) {
+            continue;
         }
+        int k = __builtin_ctz(exist | empty);
+        memcpy(&slot->dir, buffer + k * DIR_ENTRY_SIZE, sizeof(DIR_ENTRY));
+        slot->sector = from_sector + i;
+        slot->offset = k * DIR_ENTRY_SIZE;
+        return (exist >> k) & 1 ? FIND_EXIST : FIND_EMPTY;
     }
     return FIND_FULL;
 }
@@ -301,22 +364,22 @@ int find_entry_in_sectors(const char* name, size_t len,
  * @return int 成功返回0，失败返回错误代码的负值，可能的错误参见brief部分。
  */
 int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remains) {
-    printf("in find_entry_internal\n");
-    printf("path %s\n",path);
+    log_trace("in find_entry_internal");
+    log_trace("path %s",path);
     *remains = path;
     *remains += strspn(*remains, "/");    // 跳过开头的'/'
 
     unsigned level = 0;
-    cluster_t clus = CLUSTER_END;   // 当前查找到的目录项开始的簇号
+    cluster_t clus = meta.root_clus;    // 当前查找到的目录项开始的簇号，FAT32 的根目录也是簇链
     int state = FIND_EXIST;
     // 如果 remains 不为空，说明还有未找到的层级
     while (**remains != '\0' && state == FIND_EXIST) {
         size_t len = strcspn(*remains, "/"); // 目前要搜索的文件名长度
         // *remains 开始的，长为 len 的字符串是当前要搜索的文件名
-        printf("remians is %s, len is %lu\n",*remains,len);
+        log_trace("remians is %s, len is %lu",*remains,len);
 
-        if(level == 0) {
-            // 如果是第一级，需要从根目录开始搜索
+        if(level == 0 && meta.root_sectors != 0) {
+            // 如果是第一级，需要从根目录开始搜索（FAT32 没有固定的根目录区域，走下面的簇链）
             // TODO1.1: 设置根目录的扇区号和扇区数（请给下面两个变量赋值，根目录的扇区号和扇区数可以在 meta 里的字段找到。）
             sector_t root_sec;
             size_t nsec;
@@ -328,11 +391,11 @@ int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remai
             state = find_entry_in_sectors(*remains, len, root_sec, nsec, slot); 
             if(state != FIND_EXIST) {
                 // 根目录项中没找到第一级路径，直接返回
-                printf("out find_entry_internal\n");
+                log_trace("out find_entry_internal");
                 return state;
             }
         } else {
-            // 不是第一级，在目录对应的簇中寻找（在上一级中已将clus设为第一个簇）
+            // 不是第一级，在目录对应的簇中寻找（在上一级中已将clus设为第一个簇，FAT32 第一级为根目录的簇）
             while (is_cluster_inuse(clus)) {    // 依次查找每个簇
                 // TODO1.2: 在 clus 对应的簇中查找每个目录项。
                 // 你可以使用 state = find_entry_in_sectors(.....)， 参数参考第一级中是如何查找的。
@@ -340,10 +403,10 @@ int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remai
                 sector_t clus_sec = cluster_first_sector(clus);
                 //当前簇的起始sector编号
                 state = find_entry_in_sectors(*remains, len, clus_sec, meta.sec_per_clus, slot);
-                printf("in clus %u, ret from find_entry_in_sectors is %d\n",clus,state);
+                log_trace("in clus %u, ret from find_entry_in_sectors is %d",clus,state);
 
                 if(state < 0) { // 出现错误
-                    printf("out find_entry_internal\n");
+                    log_trace("out find_entry_internal");
                     return state;
                 } else if(state == FIND_EXIST || state == FIND_EMPTY) {
                     break;  // 该级找到了，或者已经找完了有内容的项，不需要往后继续查找该级后面的簇
@@ -359,7 +422,7 @@ int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remai
             // 该级找到的情况，remains后移至下一级
             level++;
             *remains = next_level;
-            clus = slot->dir.DIR_FstClusLO;
+            clus = dir_entry_cluster(&slot->dir);
         }
 
         if(*next_level != '\0') {
@@ -375,7 +438,7 @@ int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remai
         }
     }
 
-    printf("out find_entry_internal\n");
+    log_trace("out find_entry_internal");
     return state;
 }
 
@@ -388,21 +451,24 @@ int find_entry_internal(const char* path, DirEntrySlot* slot, const char** remai
  */
 int find_entry(const char* path, DirEntrySlot* slot) {
     const char* remains = NULL;
-    printf("in find_entry\n");
+    log_trace("in find_entry");
     int ret = find_entry_internal(path, slot, &remains);
     if(ret < 0) {
         return ret;
     }
     if(ret == FIND_EXIST) {
-        printf("out find_entry, have found %s\n",path);
+        log_trace("out find_entry, have found %s",path);
         return 0;
     }
     return -ENOENT;
 }
 
 
+static int dir_extend(const char* path, DirEntrySlot* slot);
+
 /**
  * @brief 创建目录、创建文件时使用，找到一个空槽，并且顺便检查是否有重名文件/目录。
+ *        目录已满时扩展目录（FAT16 的根目录除外）。
  * 
  * @param path 
  * @param slot 
@@ -411,21 +477,63 @@ int find_entry(const char* path, DirEntrySlot* slot) {
  */
 int find_empty_slot(const char* path, DirEntrySlot *slot, const char** last_name) {
     int ret = find_entry_internal(path, slot, last_name);
-    printf("in find_empty_slot\n");
-    printf("ret is %d, remains is %s\n",ret,*last_name);
+    log_trace("in find_empty_slot");
+    log_trace("ret is %d, remains is %s",ret,*last_name);
     if(ret < 0) {
-        printf("out find_empty_slot\n");
+        log_trace("out find_empty_slot");
         return ret;
     }
     if(ret == FIND_EXIST) { // 找到重名文件，返回文件已存在
-        printf("out find_empty_slot\n");
+        log_trace("out find_empty_slot");
         return -EEXIST;
     }
-    if(ret == FIND_FULL) {  // 找不到空槽，返回目录已满
-        printf("out find_empty_slot\n");
-        return -ENOSPC;
+    if(ret == FIND_FULL) {  // 找不到空槽，扩展目录
+        log_trace("out find_empty_slot");
+        return dir_extend(path, slot);
+    }
+    log_trace("out find_empty_slot");
+    return 0;
+}
+
+/**
+ * @brief 将 path 的上一级目录的路径写入 parent（根目录为 "/"），parent 的长度至少为 MAX_NAME_LEN
+ *
+ * @return const char* 最后一级的名字在 path 中的位置
+ */
+const char* split_path(const char* path, char* parent) {
+    const char* name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    size_t len = name - path;
+    while(len > 1 && path[len - 1] == '/') {
+        len--;
+    }
+    if(len == 0) {
+        len = 1;
+        path = "/";
+    }
+    len = min(len, (size_t)MAX_NAME_LEN - 1);
+    memcpy(parent, path, len);
+    parent[len] = '\0';
+    return name;
+}
+
+/**
+ * @brief 获取目录 path 的第一个簇号，根目录为 0（与 .. 目录项中的约定相同）
+ */
+int dir_first_cluster(const char* path, cluster_t* clus) {
+    if(path_is_root(path)) {
+        *clus = 0;
+        return 0;
+    }
+    DirEntrySlot slot;
+    int ret = find_entry(path, &slot);
+    if(ret < 0) {
+        return ret;
+    }
+    if(!is_directory(slot.dir.DIR_Attr)) {
+        return -ENOTDIR;
     }
-    printf("out find_empty_slot\n");
+    *clus = dir_entry_cluster(&slot.dir);
     return 0;
 }
 
@@ -473,6 +581,54 @@ void time_unix_to_fat(const struct timespec* ts, uint16_t* date, uint16_t* time,
 
 // ===========================文件系统接口实现===============================
 
+/**
+ * @brief 读取 FSInfo 中的空闲簇数和下一个空闲簇的提示。FSInfo 不存在或数值不合理时空闲簇数未知，
+ *        不在挂载时扫描 FAT 表，由 FAT 缓存在后台加载时统计，卸载时再取出（见 fsinfo_store）。
+ */
+static void fsinfo_load(void) {
+    meta.free_count = FSINFO_UNKNOWN;
+    meta.next_free = CLUSTER_MIN;
+    FSINFO info;
+    if(meta.fsinfo_sec != 0 && sector_read(meta.fsinfo_sec, &info) == 0
+            && info.FSI_LeadSig == FSINFO_LEAD_SIG && info.FSI_StrucSig == FSINFO_STRUC_SIG) {
+        if(info.FSI_Free_Count <= meta.clusters) {
+            meta.free_count = info.FSI_Free_Count;
+        }
+        if(is_cluster_inuse(info.FSI_Nxt_Free)) {
+            meta.next_free = info.FSI_Nxt_Free;
+        }
+    }
+}
+
+/**
+ * @brief 把空闲簇数和下一个空闲簇的提示写回 FSInfo（仅 FAT32）
+ */
+static int fsinfo_store(void) {
+    if(meta.fsinfo_sec == 0) {
+        return 0;
+    }
+    FSINFO info;
+    int ret = sectors_read(meta.fsinfo_sec, 1, &info);
+    if(ret < 0) {
+        return ret;
+    }
+    if(info.FSI_LeadSig != FSINFO_LEAD_SIG || info.FSI_StrucSig != FSINFO_STRUC_SIG) {
+        return 0;
+    }
+    if(meta.free_count == FSINFO_UNKNOWN) {
+        long count = fatcache_free_count();
+        if(count >= 0) {
+            meta.free_count = count;
+        }
+    }
+    if(info.FSI_Free_Count == meta.free_count && info.FSI_Nxt_Free == meta.next_free) {
+        return 0;
+    }
+    info.FSI_Free_Count = meta.free_count;
+    info.FSI_Nxt_Free = meta.next_free;
+    return sectors_write(meta.fsinfo_sec, 1, &info);
+}
+
 /**
  * @brief 文件系统初始化，无需修改
  * 
@@ -494,12 +650,38 @@ void *fat16_init(struct fuse_conn_info * conn, struct fuse_config *config) {
     meta.sectors = bpb.BPB_TotSec16 != 0 ? bpb.BPB_TotSec16 : bpb.BPB_TotSec32;
     meta.sec_per_fat = bpb.BPB_FATSz16;
 
+    // 与 Linux 相同，BPB_FATSz16 为 0 的卷是 FAT32
+    meta.fat_bits = 16;
+    meta.root_clus = 0;
+    meta.fsinfo_sec = 0;
+    if(bpb.BPB_FATSz16 == 0) {
+        const BPB32_BS* bpb32 = (const BPB32_BS*)&bpb;
+        meta.fat_bits = 32;
+        meta.sec_per_fat = bpb32->BPB_FATSz32;
+        meta.root_clus = bpb32->BPB_RootClus;
+        meta.fsinfo_sec = bpb32->BPB_FSInfo;
+        meta.dir_entries = 0;
+    }
+
     meta.fat_sec = meta.reserved;
     meta.root_sec = meta.fat_sec + (meta.fats * meta.sec_per_fat);
     meta.root_sectors = (meta.dir_entries * DIR_ENTRY_SIZE) / meta.sector_size;
     meta.data_sec = meta.root_sec + meta.root_sectors;
     meta.clusters = (meta.sectors - meta.data_sec) / meta.sec_per_clus;
     meta.cluster_size = meta.sec_per_clus * meta.sector_size;
+    disk_set_layout(meta.fat_sec, meta.root_sec, meta.data_sec);
+    // FAT 表在后台读进缓存，挂载不等待
+    if(fatcache_open(meta.fat_sec, meta.sec_per_fat, meta.fat_bits, (size_t)meta.clusters + 2) < 0) {
+        log_warn("Allocate FAT cache failed, reading FAT from disk");
+    }
+    fsinfo_load();
+
+    // 守护进程是镜像唯一的写者，可以让内核缓存写入：小的追加写在页缓存中合并，以大块写下来
+    if(conn->capable & FUSE_CAP_WRITEBACK_CACHE) {
+        conn->want |= FUSE_CAP_WRITEBACK_CACHE;
+    }
+    conn->max_write = FAT16_MAX_REQUEST;     // libfuse 会限制在它的缓冲区大小以内
+    conn->max_readahead = FAT16_MAX_REQUEST;
 
     // 以下可忽略
     meta.fs_uid = getuid();
@@ -516,7 +698,10 @@ void *fat16_init(struct fuse_conn_info * conn, struct fuse_config *config) {
  * 
  * @param data 
  */
-void fat16_destroy(void *data) { }
+void fat16_destroy(void *data) {
+    fsinfo_store();
+    fatcache_close();
+}
 
 /**
  * @brief 获取path对应的文件的属性，无需修改
@@ -596,10 +781,10 @@ int fat16_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off
     //   4. 目录项中保存了 path 对应的目录的第一个簇号，我们读取簇中每个目录项的内容即可。
     //   5. 使用 filler 函数将每个目录项的文件名写入 buf 中。
     
-    bool root = path_is_root(path);
+    bool root = path_is_root(path) && meta.root_sectors != 0;    // FAT32 的根目录按簇链读取
     DIR_ENTRY dir;
-    cluster_t clus = CLUSTER_END;
-    if(!root) {
+    cluster_t clus = meta.root_clus;
+    if(!path_is_root(path)) {
         
         //printf("readdir is not root\n");
 
@@ -612,7 +797,7 @@ int fat16_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off
         if(ret < 0) {
             return ret;
         }
-        clus = dir->DIR_FstClusLO;    // 不是根目录
+        clus = dir_entry_cluster(dir);    // 不是根目录
         if(!is_directory(dir->DIR_Attr)) {
             return -ENOTDIR;
         }
@@ -621,6 +806,7 @@ int fat16_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off
     // 要读的目录项的第一个簇位于 clus，请你读取该簇中的所有目录项。
     char sector_buffer[MAX_LOGICAL_SECTOR_SIZE];
     char name[MAX_NAME_LEN];
+    bool end = false;       // 遇到空项，后面都是空项
     while (root || is_cluster_inuse(clus)) {
         sector_t first_sec;
         size_t nsec;
@@ -638,26 +824,31 @@ int fat16_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off
         // 你可以参考 find_entry_in_sectors 函数的实现。
         for(size_t i=0; i < nsec; i++) {
             sector_t sec = first_sec + i;
-            sector_read(sec, sector_buffer);
+            dir_sector_read(sec, sector_buffer);
             // TODO1.5: 对扇区中每个目录项：
             // 1. 确认其是否是表示文件或目录的项（排除 LFN、空项、删除项等不合法项的干扰）
             // 2. 从 FAT 文件名中，获得长文件名（可以使用提供的to_longname函数）
             // 3. 使用 filler 填入 buf
             // 4. 找到空项即可结束查找（说明后面均为空）。
 
-            for (size_t off = 0; off < meta.sector_size; off+=DIR_ENTRY_SIZE) {
-                DIR_ENTRY *cur_dir = (DIR_ENTRY *)(sector_buffer + off);
-                if (!(is_valid(cur_dir))) {
-                    continue;
-                }
+            DirScanMask mask;
+            dir_scan(sector_buffer, NULL, &mask);
+            uint32_t valid = ((1u << DIR_ENTRIES_PER_SECTOR) - 1) & ~(mask.free | mask.deleted | mask.lfn);
+            if(mask.free != 0) {
+                valid &= (mask.free & -mask.free) - 1;    // 只保留第一个空项之前的目录项
+                end = true;
+            }
+            for(; valid != 0; valid &= valid - 1) {
+                DIR_ENTRY *cur_dir = (DIR_ENTRY *)(sector_buffer + __builtin_ctz(valid) * DIR_ENTRY_SIZE);
                 to_longname(cur_dir->DIR_Name, name, MAX_NAME_LEN);
                 filler(buf, name, NULL, 0, 0);
-                
-                //printf("fill filename is %s\n",name);
+            }
+            if(end) {
+                break;
             }
         }
 
-        if(root) {
+        if(root || end) {
             break;
         }
 
@@ -698,6 +889,15 @@ int read_from_cluster_at_offset(cluster_t clus, off_t offset, char* data, size_t
     return size;
 }
 
+/**
+ * @brief 打开文件。镜像只由本进程修改，文件内容保留在内核页缓存中，
+ *        通过其他写法修改后由 fat16_cache.c 让缓存失效
+ */
+int fat16_open(const char *path, struct fuse_file_info *fi) {
+    fi->keep_cache = 1;
+    return 0;
+}
+
 /**
  * @brief 从path对应的文件的offset字节处开始读取size字节的数据到buffer中，并返回实际读取的字节数。
  * Hint: 文件大小属性是Dir.DIR_FileSize。
@@ -711,7 +911,7 @@ int read_from_cluster_at_offset(cluster_t clus, off_t offset, char* data, size_t
  */
 int fat16_read(const char *path, char *buffer, size_t size, off_t offset,
                struct fuse_file_info *fi) {
-    printf("read(path='%s', offset=%ld, size=%lu)\n", path, offset, size);
+    log_debug("read(path='%s', offset=%ld, size=%lu)", path, offset, size);
     if(path_is_root(path)) {
         return -EISDIR;
     }
@@ -725,13 +925,18 @@ int fat16_read(const char *path, char *buffer, size_t size, off_t offset,
     if(is_directory(dir->DIR_Attr)) {
         return -EISDIR;
     }
-    if(offset > dir->DIR_FileSize) {
+    if(offset < 0) {
         return -EINVAL;
     }
+    // 开启 writeback cache 后内核按自己的 i_size 发读请求，扩展文件的写可能还在页缓存中，
+    // 读到 DIR_FileSize 之后时与普通文件一样返回 0 字节
+    if(offset >= dir->DIR_FileSize) {
+        return 0;
+    }
     size = min(size, dir->DIR_FileSize - offset);
 
 
-    cluster_t clus = dir->DIR_FstClusLO;
+    cluster_t clus = dir_entry_cluster(dir);
     size_t p = 0;
     // TODO1.6: clus 初始为该文件第一个簇，利用 read_from_cluster_at_offset 函数，从正确的簇中读取数据。
     // Hint: 需要注意 offset 的位置，和结束读取的位置。要读取的数据可能横跨多个簇，也可能就在一个簇的内部。
@@ -802,7 +1007,7 @@ int dir_entry_write(DirEntrySlot slot) {
     //  2. 将目录项写入buffer对应的位置（Hint: 使用memcpy）
     //  3. 将整个扇区完整写回
 
-    sector_read(slot.sector, sector_buffer);
+    dir_sector_read(slot.sector, sector_buffer);
     memcpy(sector_buffer + slot.offset, &(slot.dir), sizeof(DIR_ENTRY));
     sector_write(slot.sector, sector_buffer);
 
@@ -816,8 +1021,7 @@ int dir_entry_create(DirEntrySlot slot, const char *shortname,
     
     memcpy(dir, shortname, 11);
     dir->DIR_Attr = attr;
-    dir->DIR_FstClusHI = 0;
-    dir->DIR_FstClusLO = first_clus;
+    dir_entry_set_cluster(dir, first_clus);
     dir->DIR_FileSize = file_size;
     
     struct timespec ts;
@@ -837,6 +1041,16 @@ int dir_entry_create(DirEntrySlot slot, const char *shortname,
 }
 
 
+// 把 FAT 的第 index 个扇区写入每一个 FAT 表
+static int fat_sector_store(size_t index, const char* sector_buffer) {
+    for(size_t i = 0; i < meta.fats; i++) {
+        if(sector_write(meta.fat_sec + i * meta.sec_per_fat + index, sector_buffer) != 0) {
+            return -EIO;
+        }
+    }
+    return 0;
+}
+
 /**
  * @brief 将data写入簇号为clusterN的簇对应的FAT表项，注意要对文件系统中所有FAT表都进行相同的写入。
  * 
@@ -846,33 +1060,58 @@ int dir_entry_create(DirEntrySlot slot, const char *shortname,
  */
 int write_fat_entry(cluster_t clus, cluster_t data) {
     char sector_buffer[MAX_LOGICAL_SECTOR_SIZE];
-    size_t clus_off = clus * sizeof(cluster_t);
-    sector_t clus_sec = clus_off / meta.sector_size;
-    size_t sec_off = clus_off % meta.sector_size;
-    for(size_t i = 0; i < meta.fats; i++) {
-        // TODO2.2: 修改第 i 个 FAT 表中，clus_sec 扇区中，sec_off 偏移处的表项，使其值为 data
-        //   1. 计算第 i 个 FAT 表所在扇区，进一步计算clus应的FAT表项所在扇区
-        //   2. 读取该扇区并在对应位置写入数据
-        //   3. 将该扇区写回
-
-        sector_t fat_start_sec = meta.fat_sec + i * meta.sec_per_fat;
-        sector_read(fat_start_sec + clus_sec, sector_buffer);
-        memcpy(sector_buffer + sec_off, &data, sizeof(cluster_t));
-        sector_write(fat_start_sec + clus_sec, sector_buffer);
+    size_t per_sec = fat_entries_per_sector();
+    sector_t clus_sec = clus / per_sec;
+    // TODO2.2: 修改第 i 个 FAT 表中，clus_sec 扇区中，sec_off 偏移处的表项，使其值为 data
+    //   1. 计算第 i 个 FAT 表所在扇区，进一步计算clus应的FAT表项所在扇区
+    //   2. 读取该扇区并在对应位置写入数据
+    //   3. 将该扇区写回
+
+    // 各个 FAT 表的内容相同，只读第一个（在 FAT 缓存中），改完后写入每一个 FAT 表
+    if(sector_read(meta.fat_sec + clus_sec, sector_buffer) != 0) {
+        return -EIO;
     }
-    return 0;
+    free_count_update(fat_sector_set(sector_buffer, clus % per_sec, data), data);
+    return fat_sector_store(clus_sec, sector_buffer);
 }
 
-int free_clusters(cluster_t clus) {
-    while(is_cluster_inuse(clus)) {
-        cluster_t next = read_fat_entry(clus);
-        int ret = write_fat_entry(clus, CLUSTER_FREE);
-        if(ret < 0) {
-            return ret;
+/**
+ * @brief 释放从 *clus 开始的簇链中最多 max 个簇，*clus 更新为下一个还没有释放的簇（链结束后不是有效簇号）。
+ *        沿链前进时同一个 FAT 扇区只读写一次，而不是每个簇读写一次。
+ *
+ * @return long 释放的簇数，失败返回POSIX错误代码的负值
+ */
+long free_clusters_batch(cluster_t* clus, size_t max) {
+    char sector_buffer[MAX_LOGICAL_SECTOR_SIZE];
+    size_t per_sec = fat_entries_per_sector();
+    size_t loaded = SIZE_MAX;       // sector_buffer 中是 FAT 的第几个扇区
+    size_t freed = 0;
+    int ret = 0;
+    while(freed < max && is_cluster_inuse(*clus)) {
+        size_t index = *clus / per_sec;
+        if(index != loaded) {
+            if(loaded != SIZE_MAX && (ret = fat_sector_store(loaded, sector_buffer)) < 0) {
+                return ret;
+            }
+            if(sector_read(meta.fat_sec + index, sector_buffer) != 0) {
+                return -EIO;
+            }
+            loaded = index;
         }
-        clus = next;
+        cluster_t old = fat_sector_set(sector_buffer, *clus % per_sec, CLUSTER_FREE);
+        free_count_update(old, CLUSTER_FREE);
+        *clus = old;
+        freed++;
     }
-    return 0;
+    if(loaded != SIZE_MAX && (ret = fat_sector_store(loaded, sector_buffer)) < 0) {
+        return ret;
+    }
+    return freed;
+}
+
+int free_clusters(cluster_t clus) {
+    long ret = free_clusters_batch(&clus, SIZE_MAX);
+    return ret < 0 ? ret : 0;
 }
 
 static const char ZERO_SECTOR[PHYSICAL_SECTOR_SIZE] = {0};
@@ -888,6 +1127,57 @@ int cluster_clear(cluster_t clus) {
     return 0;
 }
 
+/**
+ * 簇的放置：新文件的第一个簇从它的目录项所在的簇开始向后找，子目录从上一级目录的簇开始找，
+ * 已有簇的文件从最后一个簇之后找。遍历目录树时，目录和其中的文件挨在一起，目录中删除文件留下的
+ * 空洞也优先由这个目录中的新文件使用。
+ *
+ * 没有像 FFS 那样把根目录下的目录分散到各个柱面组：每次按路径查找和读簇链都要回到卷开头读
+ * 根目录和 FAT 表，数据放得越靠后寻道越长，所以根目录下的目录和文件从卷开头找第一个空闲簇。
+ */
+
+static int alloc_clusters_near(size_t n, cluster_t hint, cluster_t* first_clus);
+
+// 新目录的簇从哪里开始找
+static cluster_t dir_hint(cluster_t parent_clus) {
+    return is_cluster_inuse(parent_clus) ? parent_clus : CLUSTER_MIN;
+}
+
+/**
+ * @brief 文件的新簇从哪里开始找：已有簇时紧跟在最后一个簇 last 之后，否则从文件的目录项所在的簇开始
+ */
+static cluster_t file_hint(const DirEntrySlot* slot, cluster_t last) {
+    if(is_cluster_inuse(last)) {
+        return last + 1;
+    }
+    // FAT16 根目录区域中的目录项换算为簇号 0
+    return dir_hint(sector_cluster(slot->sector));
+}
+
+/**
+ * @brief 在簇 from 到 to 之间按顺序找空闲簇，追加到 clusters 中，直到共有 n 个。
+ *        FAT 表按块读取，每块生成空闲位图后逐位取出空闲簇。
+ */
+static int fat_collect_free(size_t from, size_t to, cluster_t* clusters, size_t n, size_t* allocated) {
+    char buf[max(FAT_SCAN_BYTES, MAX_LOGICAL_SECTOR_SIZE)];
+    uint64_t bitmap[max(FAT_SCAN_BYTES, MAX_LOGICAL_SECTOR_SIZE) / 2 / 64];
+    while(from <= to && *allocated < n) {
+        const void* entries;
+        long count = fat_scan_chunk(from, to, buf, &entries);
+        if(count < 0) {
+            return count;
+        }
+        fat_free_bitmap(entries, count, meta.fat_bits, bitmap);
+        for(size_t w = 0; w < (count + 63) / 64 && *allocated < n; w++) {
+            for(uint64_t bits = bitmap[w]; bits != 0 && *allocated < n; bits &= bits - 1) {
+                clusters[(*allocated)++] = from + w * 64 + __builtin_ctzll(bits);
+            }
+        }
+        from += count;
+    }
+    return 0;
+}
+
 /**
  * @brief 分配n个空闲簇，分配过程中将n个簇通过FAT表项连在一起，然后返回第一个簇的簇号。
  *        最后一个簇的FAT表项将会指向0xFFFF（即文件中止）。
@@ -896,7 +1186,14 @@ int cluster_clear(cluster_t clus) {
  * @return int      成功返回0，失败返回错误代码负值
  */
 int alloc_clusters(size_t n, cluster_t* first_clus) {
-    printf("in alloc_clusters, want to find %lu free cluster\n",n);
+    return alloc_clusters_near(n, meta.next_free, first_clus);
+}
+
+/**
+ * @brief 与 alloc_clusters 相同，但从 hint 开始向后找空闲簇，找到卷末尾后再从头找
+ */
+static int alloc_clusters_near(size_t n, cluster_t hint, cluster_t* first_clus) {
+    log_trace("in alloc_clusters, want to find %lu free cluster near %u", n, hint);
     if (n == 0)
         return CLUSTER_END;
 
@@ -907,24 +1204,25 @@ int alloc_clusters(size_t n, cluster_t* first_clus) {
     // TODO2.3: 扫描FAT表，找到n个空闲的簇，存入cluster数组。注意此时不需要修改对应的FAT表项。
     // Hint: 你可以使用 read_fat_entry 函数来读取FAT表项的值，根据该值判断簇是否空闲。
 
-    cluster_t cur_clus;
-    for (cur_clus = CLUSTER_MIN; cur_clus <= CLUSTER_MAX; cur_clus++) {
-        cluster_t fat_entry = read_fat_entry(cur_clus);
-        // printf("current cluster %u, read from it is %u\n", cur_clus, fat_entry);
-        if (fat_entry == CLUSTER_FREE) {
-            clusters[allocated] = cur_clus;
-            allocated++;
-            printf("find free cluster %u, total free num is %lu\n", cur_clus, allocated);
-        }
-
-        if (allocated == n) {
-            printf("have found %lu free cluster\n", allocated);
-            break;
-        }  //已找到n个空闲簇
+    // 从 hint 开始找，找到卷末尾后再从头找到该位置
+    cluster_t last = meta.clusters + 1;
+    cluster_t start = is_cluster_inuse(hint) ? hint : CLUSTER_MIN;
+    int ret = fat_collect_free(start, last, clusters, n, &allocated);
+    if(ret == 0 && allocated < n && start > CLUSTER_MIN) {
+        ret = fat_collect_free(CLUSTER_MIN, start - 1, clusters, n, &allocated);
     }
+    if(ret < 0) {
+        free(clusters);
+        return ret;
+    }
+    log_trace("have found %lu free cluster", allocated);
 
     if(allocated != n) {  // 找不到n个簇，分配失败
         free(clusters);
+        // 还有等待后台回收的簇链时，先在当前线程中释放它们再重试
+        if(reclaim_drain() > 0) {
+            return alloc_clusters_near(n, hint, first_clus);
+        }
         return -ENOSPC;
     }
 
@@ -948,11 +1246,112 @@ int alloc_clusters(size_t n, cluster_t* first_clus) {
     }
 
     *first_clus = clusters[0];
+    meta.next_free = clusters[n - 1] + 1;
     free(clusters);
     return 0;
 }
 
 
+/**
+ * @brief path 所在的目录已满时，在目录的簇链末尾追加一个清零的簇，slot 设为新簇中的第一项。
+ *        FAT16 的根目录区域大小固定，不能扩展，返回 -ENOSPC。
+ */
+static int dir_extend(const char* path, DirEntrySlot* slot) {
+    char parent[MAX_NAME_LEN];
+    split_path(path, parent);
+    cluster_t last;
+    int ret = dir_first_cluster(parent, &last);
+    if(ret < 0) {
+        return ret;
+    }
+    if(last == 0) {
+        last = meta.root_clus;
+    }
+    if(!is_cluster_inuse(last)) {
+        return -ENOSPC;
+    }
+    for(size_t n = 0; n < meta.clusters && is_cluster_inuse(read_fat_entry(last)); n++) {
+        last = read_fat_entry(last);
+    }
+
+    cluster_t clus;
+    ret = alloc_clusters_near(1, last + 1, &clus);
+    if(ret < 0) {
+        return ret;
+    }
+    write_fat_entry(last, clus);
+    memset(&slot->dir, 0, sizeof(DIR_ENTRY));
+    slot->sector = cluster_first_sector(clus);
+    slot->offset = 0;
+    return 0;
+}
+
+/**
+ * @brief 在所有 FAT 表中把从 first 开始地址连续的 n 个簇连成一条链，最后一个簇指向 CLUSTER_END。
+ *        同一个 FAT 扇区中的表项读写一次扇区就全部改完，而不是像 write_fat_entry 那样每个表项读写一次。
+ */
+static int fat_link_run(cluster_t first, size_t n) {
+    char sector_buffer[PHYSICAL_SECTOR_SIZE];
+    size_t per_sec = fat_entries_per_sector();
+    size_t last = first + n - 1;
+    for(size_t clus = first; clus <= last; ) {
+        size_t sec = clus / per_sec;
+        size_t end = min(last, (sec + 1) * per_sec - 1);   // 这个扇区中要修改的最后一个表项
+        // 只读第一个 FAT 表（在 FAT 缓存中），改完后写入每一个 FAT 表
+        int ret = sectors_read(meta.fat_sec + sec, 1, sector_buffer);
+        if(ret < 0) {
+            return ret;
+        }
+        for(size_t c = clus; c <= end; c++) {
+            cluster_t next = c == last ? CLUSTER_END : c + 1;
+            free_count_update(fat_sector_set(sector_buffer, c % per_sec, next), next);
+        }
+        ret = fat_sector_store(sec, sector_buffer);
+        if(ret < 0) {
+            return ret;
+        }
+        clus = end + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 分配 n 个地址连续的空闲簇并连成一条链。先从 hint 向后找，找不到再从头找。
+ *        FAT 表按块读取，用向量化的 fat_find_free_run 找连续的空闲表项。与 alloc_clusters 不同，新簇不会被清零。
+ *
+ * @param n          要分配的簇数，大于0
+ * @param hint       希望第一个簇所在的位置，比如文件最后一个簇的下一个簇
+ * @param first_clus 输出参数，第一个簇的簇号
+ * @return int       成功返回0；没有足够长的连续空闲簇时返回 -ENOSPC
+ */
+static int alloc_clusters_contiguous(size_t n, cluster_t hint, cluster_t* first_clus) {
+    char buf[max(FAT_SCAN_BYTES, MAX_LOGICAL_SECTOR_SIZE)];
+    size_t limit = min((size_t)CLUSTER_MAX, (size_t)meta.clusters + 1);    // 最后一个数据簇
+    if(hint < CLUSTER_MIN || hint > limit) {
+        hint = CLUSTER_MIN;
+    }
+    for(size_t from = hint; ; from = CLUSTER_MIN) {
+        size_t run = 0;
+        for(size_t clus = from; clus <= limit; ) {
+            const void* entries;
+            long count = fat_scan_chunk(clus, limit, buf, &entries);
+            if(count < 0) {
+                return count;
+            }
+            size_t end = fat_find_free_run(entries, count, meta.fat_bits, n, &run);
+            if(end != SIZE_MAX) {
+                *first_clus = clus + end - n + 1;
+                meta.next_free = clus + end + 1;
+                return fat_link_run(*first_clus, n);
+            }
+            clus += count;
+        }
+        if(from == CLUSTER_MIN) {
+            return -ENOSPC;
+        }
+    }
+}
+
 /**
  * @brief 在path对应的路径创建新文件 （请阅读函数的逻辑，补全find_empty_slot和dir_entry_create两个函数）
  * 
@@ -962,15 +1361,15 @@ int alloc_clusters(size_t n, cluster_t* first_clus) {
  * @return int    成功返回0，失败返回POSIX错误代码的负值
  */
 int fat16_mknod(const char *path, mode_t mode, dev_t dev) {
-    printf("mknod(path='%s', mode=%03o, dev=%lu)\n", path, mode, dev);
+    log_debug("mknod(path='%s', mode=%03o, dev=%lu)", path, mode, dev);
     DirEntrySlot slot;
     const char* filename = NULL;
     int ret = find_empty_slot(path, &slot, &filename);
-    printf("find empty done\n");
+    log_trace("find empty done");
     if(ret < 0) {
         return ret;
     }
-    printf("find empty slot, sector num %lu, offset in sector %lu\n",slot.sector,slot.offset);
+    log_trace("find empty slot, sector num %lu, offset in sector %lu",slot.sector,slot.offset);
 
     char shortname[11];
     ret = to_shortname(filename, MAX_NAME_LEN, shortname);
@@ -992,7 +1391,7 @@ int fat16_mknod(const char *path, mode_t mode, dev_t dev) {
  * @return int  成功返回0，失败返回POSIX错误代码的负值
  */
 int fat16_unlink(const char *path) {
-    printf("unlink(path='%s')\n", path);
+    log_debug("unlink(path='%s')", path);
     DirEntrySlot slot;
     DIR_ENTRY* dir = &(slot.dir);
     int ret = find_entry(path, &slot);
@@ -1002,16 +1401,13 @@ int fat16_unlink(const char *path) {
     if(is_directory(dir->DIR_Attr)) {
         return -EISDIR;
     }
-    ret = free_clusters(dir->DIR_FstClusLO);
-    if(ret < 0) {
-        return ret;
-    }
+    // 先删除目录项，簇链交给后台回收；回收前崩溃只会留下 fsck 可以回收的丢失簇链
     dir->DIR_Name[0] = NAME_DELETED;
     ret = dir_entry_write(slot);
     if(ret < 0) {
         return ret;
     }
-    return 0;
+    return reclaim_chain(dir_entry_cluster(dir));
 }
 
 /**
@@ -1022,7 +1418,7 @@ int fat16_unlink(const char *path) {
  * @return int 
  */
 int fat16_utimens(const char *path, const struct timespec tv[2], struct fuse_file_info* fi) {
-    printf("utimens(path='%s', tv=[%ld.%09ld, %ld.%09ld])\n", path, 
+    log_debug("utimens(path='%s', tv=[%ld.%09ld, %ld.%09ld])", path, 
                 tv[0].tv_sec, tv[0].tv_nsec, tv[1].tv_sec, tv[1].tv_nsec);
     DirEntrySlot slot;
     DIR_ENTRY* dir = &(slot.dir);
@@ -1057,59 +1453,88 @@ int fat16_mkdir(const char *path, mode_t mode) {
 
     DirEntrySlot slot;
     const char *filename = NULL;
-    find_empty_slot(path, &slot, &filename);
+    int ret = find_empty_slot(path, &slot, &filename);
+    if(ret < 0) {
+        return ret;
+    }
 
     char shorname[11];
-    to_shortname(filename, MAX_NAME_LEN, shorname);
+    ret = to_shortname(filename, MAX_NAME_LEN, shorname);
+    if(ret < 0) {
+        return ret;
+    }
+
+    // 上一级目录的第一个簇号，写入 .. 目录项
+    char parent[MAX_NAME_LEN];
+    cluster_t parent_clus;
+    split_path(path, parent);
+    ret = dir_first_cluster(parent, &parent_clus);
+    if(ret < 0) {
+        return ret;
+    }
 
     cluster_t first_clus;
-    int ret = alloc_clusters(1, &first_clus);
-    printf("ret from alloc_clusters is %d\n",ret);
+    ret = alloc_clusters_near(1, dir_hint(parent_clus), &first_clus);
+    log_trace("ret from alloc_clusters is %d",ret);
+    if(ret < 0) {
+        return ret;
+    }
     dir_entry_create(slot, shorname, ATTR_DIRECTORY, first_clus, 2*sizeof(DIR_ENTRY));
 
-    const char DOT_NAME[] =    ".          ";
-    const char DOTDOT_NAME[] = "..         ";
-
     // TODO2.7: 使用 dir_entry_create 创建 . 和 .. 目录项
     // Hint: 两个目录项分别在你刚刚分配的簇的前两项。
     // Hint: 记得修改下面的返回值。
     // TODO:
 
+    // . 和 .. 的名字不是合法的 8.3 文件名，不能用 to_shortname 转换，直接写入
     DirEntrySlot slot_of_subdir;
-    char name[11];
-    to_shortname(DOT_NAME, 11, name);
-    find_entry(path, &slot_of_subdir);
     slot_of_subdir.sector = cluster_first_sector(first_clus);
     slot_of_subdir.offset = 0;
-    dir_entry_create(slot_of_subdir, name, ATTR_DIRECTORY,
-                     slot_of_subdir.dir.DIR_FstClusLO, 0);
-
-    to_shortname(DOTDOT_NAME, 11, name);
-    int i = strlen(path);
-    char pre_path[i];
-    strcpy(pre_path, path);
-    for (i = i - 1; i >= 0; i--) {
-        if (path[i] == '/') {
-            break;
-        }
-    }
-    if (i == 0) {
-        pre_path[i + 1] = '\0';
-    } //上一级目录是根目录
-    else {
-        pre_path[i] = '\0';
-    } //上一级目录不是根目录
-    find_entry(pre_path, &slot_of_subdir);
-    slot_of_subdir.sector = cluster_first_sector(first_clus);
+    dir_entry_create(slot_of_subdir, DOT_NAME, ATTR_DIRECTORY, first_clus, 0);
+
     slot_of_subdir.offset = sizeof(DIR_ENTRY);
-    dir_entry_create(slot_of_subdir, name, ATTR_DIRECTORY,
-                     slot_of_subdir.dir.DIR_FstClusLO, 0);
+    dir_entry_create(slot_of_subdir, DOTDOT_NAME, ATTR_DIRECTORY, parent_clus, 0);
                      
     return 0;
 }
 
 
 
+/**
+ * @brief 检查从 clus 开始的目录是否为空（忽略 . 和 ..）
+ *
+ * @return int 为空返回0，不为空返回 -ENOTEMPTY
+ */
+int dir_check_empty(cluster_t clus) {
+    char sec_buffer[meta.sector_size];
+    while (is_cluster_inuse(clus)) {
+        log_trace("reading cluster %u", clus);
+        for (int i = 0; i < meta.sec_per_clus; i++) {
+            sector_t sec = cluster_first_sector(clus) + i;
+            dir_sector_read(sec, sec_buffer);
+            DirScanMask mask;
+            dir_scan(sec_buffer, NULL, &mask);
+            uint32_t used = ((1u << DIR_ENTRIES_PER_SECTOR) - 1) & ~(mask.free | mask.deleted);
+            if (mask.free != 0) {
+                used &= (mask.free & -mask.free) - 1;
+            }
+            for (; used != 0; used &= used - 1) {
+                DIR_ENTRY* cur_dir = (DIR_ENTRY*)(sec_buffer + __builtin_ctz(used) * DIR_ENTRY_SIZE);
+                if (!is_dot(cur_dir)) {
+                    log_trace("this dir is not empty, find file name %s", cur_dir->DIR_Name);
+                    return -ENOTEMPTY;
+                }
+            }
+            if (mask.free != 0) {
+                return 0;   // 空项之后都是空项
+            }
+        }
+        clus = read_fat_entry(clus);
+    }
+
+    return 0;
+}
+
 /**
  * @brief 删除path对应的文件夹
  * 
@@ -1117,7 +1542,7 @@ int fat16_mkdir(const char *path, mode_t mode) {
  * @return int 成功:0， 失败: POSIX错误代码的负值
  */
 int fat16_rmdir(const char *path) {
-    printf("rmdir(path='%s')\n", path);
+    log_debug("rmdir(path='%s')", path);
     if(path_is_root(path)) {
         return -EBUSY;
     }
@@ -1138,38 +1563,190 @@ int fat16_rmdir(const char *path) {
     // Hint: 空目录中也有.和..两个目录项，你要正确地忽略它们。
     // Hint: 记得修改下面的返回值
 
-    char sec_buffer[meta.sector_size];
-    cluster_t clus = dir->DIR_FstClusLO;
-    printf("file name is %s\n", dir->DIR_Name);
-    while (is_cluster_inuse(clus)) {
-        printf("reading cluster %u\n", clus);
-        for (int i = 0; i < meta.sec_per_clus; i++) {
-            sector_t sec = cluster_first_sector(clus) + i;
-            sector_read(sec, sec_buffer);
-            for (size_t off = 0; off < meta.sector_size; off += sizeof(DIR_ENTRY)) {
-                DIR_ENTRY* cur_dir = (DIR_ENTRY*)(sec_buffer + off);
-                if (is_dot(cur_dir)) {
-                    printf("find . or ..\n");
-                    continue;
-                }
-                if (!is_free(cur_dir) && !is_deleted(cur_dir)) {
-                    printf("this dir is not empty, find file name %s\n", cur_dir->DIR_Name);
-                    return -ENOTEMPTY;
-                }
-            }
-        }
-        clus = read_fat_entry(clus);
+    log_trace("file name is %s", dir->DIR_Name);
+    ret = dir_check_empty(dir_entry_cluster(dir));
+    if(ret < 0) {
+        return ret;
     }
 
-    printf("this dir is empty\n");
+    log_trace("this dir is empty");
 
-    free_clusters(dir->DIR_FstClusLO);
     dir->DIR_Name[0] = NAME_DELETED;
-    dir_entry_write(slot);
+    ret = dir_entry_write(slot);
+    if(ret < 0) {
+        return ret;
+    }
+    return reclaim_chain(dir_entry_cluster(dir));
+}
+
+
+/**
+ * @brief 更新目录 dir_clus 中 .. 目录项指向的簇号，目录被移动到另一个目录下时使用
+ */
+int dir_update_dotdot(cluster_t dir_clus, cluster_t parent_clus) {
+    char sector_buffer[PHYSICAL_SECTOR_SIZE];
+    sector_t sec = cluster_first_sector(dir_clus);
+    int ret = dir_sector_read(sec, sector_buffer);
+    if(ret != 0) {
+        return -EIO;
+    }
+    DIR_ENTRY* dotdot = (DIR_ENTRY*)(sector_buffer + DIR_ENTRY_SIZE);
+    if(strncmp((const char*)dotdot->DIR_Name, DOTDOT_NAME, FAT_NAME_LEN) != 0) {
+        log_warn("directory at cluster %u has no .. entry", dir_clus);
+        return 0;
+    }
+    dir_entry_set_cluster(dotdot, parent_clus);
+    return sector_write(sec, sector_buffer) == 0 ? 0 : -EIO;
+}
 
+/**
+ * @brief 目录 dir_clus 是否就是 ancestor 或在它之下：沿 .. 目录项一直向上走到根目录。
+ *        FAT 的文件名不区分大小写，不能只比较路径字符串。
+ *
+ * @return int 是返回1，不是返回0，失败返回POSIX错误代码的负值
+ */
+static int dir_is_under(cluster_t dir_clus, cluster_t ancestor) {
+    char sector_buffer[PHYSICAL_SECTOR_SIZE];
+    for(size_t depth = 0; is_cluster_inuse(dir_clus) && dir_clus != meta.root_clus; depth++) {
+        if(dir_clus == ancestor) {
+            return 1;
+        }
+        if(depth > meta.clusters) {
+            log_error("loop in .. entries at cluster %u", dir_clus);
+            return -EIO;
+        }
+        if(dir_sector_read(cluster_first_sector(dir_clus), sector_buffer) != 0) {
+            return -EIO;
+        }
+        DIR_ENTRY* dotdot = (DIR_ENTRY*)(sector_buffer + DIR_ENTRY_SIZE);
+        if(strncmp((const char*)dotdot->DIR_Name, DOTDOT_NAME, FAT_NAME_LEN) != 0) {
+            log_warn("directory at cluster %u has no .. entry", dir_clus);
+            return -EIO;
+        }
+        dir_clus = dir_entry_cluster(dotdot);
+    }
     return 0;
 }
 
+/**
+ * @brief 将 from 重命名（移动）为 to，只修改目录项，不复制数据。
+ *        同一目录中改名时原地改写 8.3 文件名；移动到其他目录时在目标目录写入新的目录项，再删除原目录项，
+ *        被移动的是目录时还要更新其中的 .. 目录项。to 已存在时按 POSIX 语义替换。
+ *
+ * @param from  原路径
+ * @param to    新路径
+ * @param flags 支持 RENAME_NOREPLACE，不支持 RENAME_EXCHANGE
+ * @return int  成功返回0，失败返回POSIX错误代码的负值
+ */
+int fat16_rename(const char *from, const char *to, unsigned int flags) {
+    log_debug("rename(from='%s', to='%s', flags=%u)", from, to, flags);
+    if(flags & RENAME_EXCHANGE) {
+        return -EINVAL;
+    }
+    if(path_is_root(from) || path_is_root(to)) {
+        return -EBUSY;
+    }
+
+    DirEntrySlot src;
+    int ret = find_entry(from, &src);
+    if(ret < 0) {
+        return ret;
+    }
+    bool src_is_dir = is_directory(src.dir.DIR_Attr);
+
+    char from_parent[MAX_NAME_LEN];
+    char to_parent[MAX_NAME_LEN];
+    split_path(from, from_parent);
+    const char* to_name = split_path(to, to_parent);
+
+    // 不能把目录移动到它自己的子目录中
+    if(src_is_dir && is_cluster_inuse(dir_entry_cluster(&src.dir))) {
+        cluster_t parent_clus;
+        ret = dir_first_cluster(to_parent, &parent_clus);
+        if(ret == 0) {
+            ret = dir_is_under(parent_clus, dir_entry_cluster(&src.dir));
+        }
+        if(ret < 0) {
+            return ret;
+        }
+        if(ret == 1) {
+            return -EINVAL;
+        }
+    }
+    char shortname[FAT_NAME_LEN];
+    ret = to_shortname(to_name, MAX_NAME_LEN, shortname);
+    if(ret < 0) {
+        return ret;
+    }
+
+    // dst 是 to 已有的目录项，或者目标目录中的空槽
+    DirEntrySlot dst;
+    const char* remains = NULL;
+    int state = find_entry_internal(to, &dst, &remains);
+    if(state < 0) {
+        return state;
+    }
+    cluster_t replaced = CLUSTER_FREE;
+    if(state == FIND_EXIST) {
+        if(dst.sector == src.sector && dst.offset == src.offset) {
+            return 0;   // 同一个文件，例如只有大小写不同
+        }
+        if(flags & RENAME_NOREPLACE) {
+            return -EEXIST;
+        }
+        if(is_directory(dst.dir.DIR_Attr)) {
+            if(!src_is_dir) {
+                return -EISDIR;
+            }
+            ret = dir_check_empty(dir_entry_cluster(&dst.dir));
+            if(ret < 0) {
+                return ret;
+            }
+        } else if(src_is_dir) {
+            return -ENOTDIR;
+        }
+        replaced = dir_entry_cluster(&dst.dir);
+    }
+
+    bool same_dir = strcmp(from_parent, to_parent) == 0;
+    if(same_dir && state != FIND_EXIST) {
+        memcpy(src.dir.DIR_Name, shortname, FAT_NAME_LEN);
+        return dir_entry_write(src);
+    }
+    if(state == FIND_FULL) {
+        ret = dir_extend(to, &dst);
+        if(ret < 0) {
+            return ret;
+        }
+    }
+
+    // 先写新目录项再删除原目录项，中途崩溃时文件仍然可以找到
+    DirEntrySlot moved = dst;
+    moved.dir = src.dir;
+    memcpy(moved.dir.DIR_Name, shortname, FAT_NAME_LEN);
+    ret = dir_entry_write(moved);
+    if(ret < 0) {
+        return ret;
+    }
+    src.dir.DIR_Name[0] = NAME_DELETED;
+    ret = dir_entry_write(src);
+    if(ret < 0) {
+        return ret;
+    }
+
+    if(src_is_dir && !same_dir && is_cluster_inuse(dir_entry_cluster(&src.dir))) {
+        cluster_t parent_clus;
+        ret = dir_first_cluster(to_parent, &parent_clus);
+        if(ret == 0) {
+            ret = dir_update_dotdot(dir_entry_cluster(&moved.dir), parent_clus);
+        }
+        if(ret < 0) {
+            return ret;
+        }
+    }
+    return reclaim_chain(replaced);
+}
+
 
 // ------------------TASK3: 写文件、裁剪文件-----------------------------------
 
@@ -1186,7 +1763,7 @@ int fat16_rmdir(const char *path) {
  * @return ssize_t  成功写入的字节数，失败返回错误代码负值。可能部分成功，此时仅返回成功写入的字节数，不提供错误原因（POSIX标准）。
  */
 ssize_t write_to_cluster_at_offset(cluster_t clus, off_t offset, const char* data, size_t size) {
-    printf("in write_to_cluster_at_offset(clus= %u, offset= %lu, size= %lu)\n",
+    log_trace("in write_to_cluster_at_offset(clus= %u, offset= %lu, size= %lu)",
            clus, offset, size);
     assert(offset + size <= meta.cluster_size);  // offset + size 必须小于簇大小
     char sector_buffer[PHYSICAL_SECTOR_SIZE];
@@ -1211,80 +1788,65 @@ ssize_t write_to_cluster_at_offset(cluster_t clus, off_t offset, const char* dat
 }
 
 /**
- * @brief 为文件分配新的簇至足够容纳size大小
+ * @brief 沿簇链从 clus 向后走 index 个簇，链提前结束时返回 CLUSTER_FREE
+ */
+static cluster_t chain_cluster_at(cluster_t clus, size_t index) {
+    for(size_t i = 0; i < index && is_cluster_inuse(clus); i++) {
+        clus = read_fat_entry(clus);
+    }
+    return is_cluster_inuse(clus) ? clus : CLUSTER_FREE;
+}
+
+/**
+ * @brief 为文件分配新的簇至足够容纳size大小。新簇已清零，连在簇链末尾。
+ *        按簇链的实际长度计算，而不是按文件大小：截断到 0 或写入失败后，簇链可能比文件大小需要的长。
+ *        文件大小之后多出来的簇（如 copy_file_range 连续分配后崩溃）可能还是旧数据，用到时先清零。
  * 
- * @param dir 文件的目录项
- * @param size 所需的大小
- * @return int 成功返回0
+ * @param slot 文件的目录项，首簇号可能被修改，由调用者写回
+ * @param size 需要容纳的字节数（文件的新大小）
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
  */
-int file_reserve_clusters(DIR_ENTRY* dir, size_t size) {
-    // TODO: 为文件分配新的簇至足够容纳size大小
-    //   1. 计算需要多少簇
-    //   2. 如果文件没有簇，直接分配足够的簇
-    //   3. 如果文件已有簇，找到最后一个簇（哪个簇是当前该文件的最后一个簇？），并计算需要额外分配多少个簇
-    //   4. 分配额外的簇，并将分配好的簇连在最后一个簇后
-
-    printf("in file_reserve_clusters, extend size is %lu, old file size= %u\n",
+int file_reserve_clusters(DirEntrySlot* slot, size_t size) {
+    DIR_ENTRY* dir = &slot->dir;
+    log_trace("in file_reserve_clusters, new size is %lu, old file size= %u",
            size, dir->DIR_FileSize);
-    cluster_t new_cluster_num = 0;
-    cluster_t first_cluster_index;
-    if (dir->DIR_FileSize == 0) {
-        new_cluster_num = size / meta.cluster_size + 1;
-        printf("current file does not have cluster, need %u clusters\n",
-               new_cluster_num);
-        int ret = alloc_clusters(new_cluster_num, &first_cluster_index);
-        printf("ret from alloc_clusters is %d\n", ret);
-        dir->DIR_FstClusLO = first_cluster_index;
-        printf("out file_reserve_clusters\n");
+    size_t need = (size + meta.cluster_size - 1) / meta.cluster_size;
+    size_t used = (dir->DIR_FileSize + meta.cluster_size - 1) / meta.cluster_size;
+    size_t have = 0;
+    cluster_t last = CLUSTER_FREE;
+    int ret;
+    for(cluster_t clus = dir_entry_cluster(dir); is_cluster_inuse(clus) && have < need;
+            clus = read_fat_entry(clus)) {
+        if(have >= used && (ret = cluster_clear(clus)) < 0) {
+            return ret;
+        }
+        last = clus;
+        have++;
+    }
+    if(have >= need) {
         return 0;
     }
-    //当前文件没有簇
-    else {
-        size_t space_in_last_cluster = 0;
-        if (dir->DIR_FileSize % meta.cluster_size == 0) {
-            space_in_last_cluster = 0;
-        } else {
-            space_in_last_cluster =
-                meta.cluster_size - dir->DIR_FileSize % meta.cluster_size;
-        }
-        if (space_in_last_cluster >= size) {
-            printf("remains is last cluster is %lu, don't need alloc new "
-                   "cluster\n",
-                   space_in_last_cluster);
-            printf("out file_reserve_clusters\n");
-            return 0;
-        } else {
-            new_cluster_num =
-                (size - space_in_last_cluster) / meta.cluster_size + 1;
-        }
-        printf("current file have cluster, need %u clusters\n",
-               new_cluster_num);
-
-        int ret = alloc_clusters(new_cluster_num, &first_cluster_index);
-        printf("ret from alloc_clusters is %d\n", ret);
-
-        cluster_t last_cluster_index;
-        last_cluster_index = dir->DIR_FstClusLO;
-        while (true) {
-            cluster_t next = read_fat_entry(last_cluster_index);
-            if (is_cluster_end(next)) {
-                break;
-            }
-            last_cluster_index = next;
-        }
 
-        write_fat_entry(last_cluster_index, first_cluster_index);
-        printf("out file_reserve_clusters\n");
-        return 0;
+    log_trace("chain has %lu clusters, need %lu", have, need);
+    cluster_t first;
+    ret = alloc_clusters_near(need - have, file_hint(slot, last), &first);
+    if(ret < 0) {
+        return ret;
     }
-    //当前文件已有簇
+    if(is_cluster_inuse(last)) {
+        return write_fat_entry(last, first);
+    }
+    dir_entry_set_cluster(dir, first);
+    return 0;
 }
 
-
-
 /**
  * @brief 将长度为size的数据data写入path对应的文件的offset位置。注意当写入数据量超过文件本身大小时，
  *        需要扩展文件的大小，必要时需要分配新的簇。
+ *
+ *        打开了内核的 writeback cache 后，小的写入在内核中合并成大块写下来，offset 可能超过文件大小
+ *        （中间的空洞在新分配的簇中，已清零）；文件大小和修改时间的变化由内核通过 truncate / utimens 通知。
+ *        目录项只在文件大小或首簇号变化时写回。
  * 
  * @param path    要写入的文件的路径
  * @param data    要写入的数据
@@ -1295,65 +1857,67 @@ int file_reserve_clusters(DIR_ENTRY* dir, size_t size) {
  */
 int fat16_write(const char *path, const char *data, size_t size, off_t offset,
                 struct fuse_file_info *fi) {
-    printf("write(path='%s', offset=%ld, size=%lu)\n", path, offset, size);
-    // TODO: 写文件，请自行实现，将在下周发布进一步说明。
-    
+    log_debug("write(path='%s', offset=%ld, size=%lu)", path, offset, size);
     DirEntrySlot slot;
-    DIR_ENTRY *dir;
-    find_entry(path, &slot);
-    dir = &(slot.dir);
-
-    size_t start=offset;
-    size_t end=offset+size;
-    printf("start is %lu, end is %lu\n",start,end);
-
-    if (end > slot.dir.DIR_FileSize) {
-        printf("need extend file size\n");
-        file_reserve_clusters(dir, end - dir->DIR_FileSize);
+    DIR_ENTRY *dir = &(slot.dir);
+    int ret = find_entry(path, &slot);
+    if(ret < 0) {
+        return ret;
     }
+    if(is_directory(dir->DIR_Attr)) {
+        return -EISDIR;
+    }
+    if(size == 0) {
+        return 0;
+    }
+    if((uint64_t)offset + size > UINT32_MAX) {
+        return -EFBIG;      // DIR_FileSize 只有 32 位
+    }
+    DIR_ENTRY old = *dir;
 
-    cluster_t clus = dir->DIR_FstClusLO;
-    size_t pointer = 0;
-    while (true) {
-        if (pointer <= start && pointer + meta.cluster_size > start) {
-            break;
+    size_t start = offset;
+    size_t end = offset + size;
+    log_trace("start is %lu, end is %lu", start, end);
+    if(end > dir->DIR_FileSize) {
+        ret = file_reserve_clusters(&slot, end);
+        if(ret < 0) {
+            return ret;
         }
-        pointer += meta.cluster_size;
-        clus = read_fat_entry(clus);
     }
 
-    size_t cur_size;
-    size_t incr;
+    // 逐簇写入，第一个簇从 start 所在的位置开始
+    cluster_t clus = chain_cluster_at(dir_entry_cluster(dir), start / meta.cluster_size);
+    size_t clus_off = start % meta.cluster_size;
     size_t p = 0;
-    cur_size = min(size, meta.cluster_size - (start - pointer));
-    incr = write_to_cluster_at_offset(clus, start - pointer, data, cur_size);
-    p += incr;
-    data += incr;
-    clus = read_fat_entry(clus);
-    printf("incr= %lu, p= %lu, pointer= %lu\n", incr, p, pointer);
-    pointer += meta.cluster_size;
-    while (p < size) {
-        if (pointer + meta.cluster_size < end) {
-            printf("end is not in current cluster\n");
-            cur_size = meta.cluster_size;
-            p += write_to_cluster_at_offset(clus, 0, data, cur_size);
-            data += cur_size;
-            pointer += cur_size;
+    while(p < size) {
+        if(!is_cluster_inuse(clus)) {
+            ret = -EIO;
+            break;
+        }
+        size_t len = min(size - p, meta.cluster_size - clus_off);
+        ssize_t n = write_to_cluster_at_offset(clus, clus_off, data + p, len);
+        if(n < 0) {
+            ret = n;
+            break;
+        }
+        p += n;
+        clus_off = 0;
+        if(p < size) {
             clus = read_fat_entry(clus);
-        } else {
-            printf("end is in current cluster\n");
-            cur_size = size - p;
-            p += write_to_cluster_at_offset(clus, 0, data, cur_size);
-            pointer += cur_size;
-            data += cur_size;
         }
     }
 
-    if (end > dir->DIR_FileSize) {
-        dir->DIR_FileSize += p;
+    if(start + p > dir->DIR_FileSize) {
+        dir->DIR_FileSize = start + p;
     }
-    dir_entry_write(slot);
-    return p;
+    if(memcmp(&old, dir, sizeof(DIR_ENTRY)) != 0) {
+        int wret = dir_entry_write(slot);
+        if(wret < 0 && p == 0) {
+            return wret;
+        }
+    }
+    // 部分成功时返回已写入的字节数
+    return p > 0 ? (int)p : ret;
 }
 
 /**
@@ -1367,70 +1931,369 @@ int fat16_write(const char *path, const char *data, size_t size, off_t offset,
  * @return int 成功返回0，失败返回POSIX错误代码的负值。
  */
 int fat16_truncate(const char *path, off_t size, struct fuse_file_info* fi) {
-    printf("truncate(path='%s', size=%lu)\n", path, size);
+    log_debug("truncate(path='%s', size=%lu)", path, size);
     // TODO：裁剪文件，请自行实现，将在下周发布说明。
 
     DirEntrySlot slot;
     DIR_ENTRY *dir = &(slot.dir);
-    find_entry(path, &slot);
+    int ret = find_entry(path, &slot);
+    if(ret < 0) {
+        return ret;
+    }
 
     size_t old_size = dir->DIR_FileSize;
-    printf("old size is %lu\n", old_size);
+    log_trace("old size is %lu", old_size);
     if (size == old_size) {
-        printf("new size equals old size, out fat16_truncate\n");
+        log_trace("new size equals old size, out fat16_truncate");
         return 0;
     }
+    if (size > UINT32_MAX) {
+        return -EFBIG;
+    }
     if (size > old_size) {
-        size_t size_diff = size - old_size;
-        file_reserve_clusters(dir, size_diff);
+        ret = file_reserve_clusters(&slot, size);
+        if (ret < 0) {
+            return ret;
+        }
         dir->DIR_FileSize = size;
-        dir_entry_write(slot);
-        printf("new size is larger than old_size, out fat16_truncate\n");
-        return 0;
+        log_trace("new size is larger than old_size, out fat16_truncate");
+        return dir_entry_write(slot);
+    }
+    if (size == 0) {
+        // 空文件不占用簇，与 mknod 创建的文件相同
+        cluster_t first = dir_entry_cluster(dir);
+        dir_entry_set_cluster(dir, CLUSTER_FREE);
+        dir->DIR_FileSize = 0;
+        ret = dir_entry_write(slot);
+        if (ret < 0) {
+            return ret;
+        }
+        return reclaim_chain(first);
     }
     if (size < old_size) {
-        cluster_t clus = dir->DIR_FstClusLO;
-        size_t pointer = 0;
-        while (true) {
-            if (pointer <= size && size < pointer + meta.cluster_size) {
-                break;
+        // 保留容纳 size 字节的簇，最后一个簇中 size 之后的部分清零（扩展文件时读到 0）
+        size_t keep = (size + meta.cluster_size - 1) / meta.cluster_size;
+        cluster_t clus = chain_cluster_at(dir_entry_cluster(dir), keep - 1);
+        if (!is_cluster_inuse(clus)) {
+            return -EIO;
+        }
+        size_t clus_off = size % meta.cluster_size;
+        if (clus_off != 0) {
+            char sector_buffer[PHYSICAL_SECTOR_SIZE];
+            sector_t sec = cluster_first_sector(clus) + clus_off / meta.sector_size;
+            size_t sec_off = clus_off % meta.sector_size;
+            if (sec_off != 0) {
+                sector_read(sec, sector_buffer);
+                memset(sector_buffer + sec_off, 0, meta.sector_size - sec_off);
+                sector_write(sec, sector_buffer);
+                sec++;
             }
-            clus = read_fat_entry(clus);
-            pointer += meta.cluster_size;
+            for (; sec < cluster_first_sector(clus) + meta.sec_per_clus; sec++) {
+                sector_write(sec, ZERO_SECTOR);
+            }
+        }
+
+        // 先截断簇链并写回目录项，剩下的簇链交给后台回收
+        cluster_t next_clus = read_fat_entry(clus);
+        ret = write_fat_entry(clus, CLUSTER_END);
+        if (ret < 0) {
+            return ret;
+        }
+        dir->DIR_FileSize = size;
+        ret = dir_entry_write(slot);
+        if (ret < 0) {
+            return ret;
         }
+        log_trace("new size is less than old size, out fat16_truncate");
+        return reclaim_chain(next_clus);
+    }
+    return 0;
+}
+
+
+/**
+ * @brief 移到文件中的下一个扇区，跨簇时沿簇链前进
+ */
+static int chain_next_sector(cluster_t* clus, sector_t* sec) {
+    if(*sec + 1 < cluster_first_sector(*clus) + meta.sec_per_clus) {
+        (*sec)++;
+        return 0;
+    }
+    *clus = read_fat_entry(*clus);
+    if(!is_cluster_inuse(*clus)) {
+        return -EIO;
+    }
+    *sec = cluster_first_sector(*clus);
+    return 0;
+}
 
-        char ZERO[PHYSICAL_SECTOR_SIZE]={0};
-        char sector_buffer[PHYSICAL_SECTOR_SIZE];
-        sector_t first_sec = cluster_first_sector(clus);
-        sector_t sec=first_sec;
-        while (true) {
-            if (pointer <= size && size < pointer + meta.sector_size) {
+/**
+ * @brief 保证文件的簇链能容纳 size 字节。新簇一次分配，尽量紧跟在文件原来的最后一个簇之后并且地址连续。
+ *        连续分配时只清零最后一个新簇，调用者需要覆盖写其余的新簇，失败时用 file_cut_chain 截掉。
+ *        簇链中文件大小之后原有的簇与 file_reserve_clusters 一样先清零。
+ *
+ * @param slot  文件的目录项，首簇号可能被修改，由调用者写回
+ * @param size  需要容纳的字节数
+ * @return int  成功返回0，失败返回POSIX错误代码的负值
+ */
+static int file_alloc_contiguous(DirEntrySlot* slot, size_t size) {
+    DIR_ENTRY* dir = &slot->dir;
+    size_t need = (size + meta.cluster_size - 1) / meta.cluster_size;
+    size_t used = (dir->DIR_FileSize + meta.cluster_size - 1) / meta.cluster_size;
+    size_t have = 0;
+    cluster_t last = CLUSTER_FREE;
+    int ret;
+    for(cluster_t clus = dir_entry_cluster(dir); is_cluster_inuse(clus) && have <= meta.clusters;
+            clus = read_fat_entry(clus)) {
+        if(have >= used && have < need && (ret = cluster_clear(clus)) < 0) {
+            return ret;
+        }
+        last = clus;
+        have++;
+    }
+    if(have >= need) {
+        return 0;
+    }
+
+    cluster_t first;
+    cluster_t hint = file_hint(slot, last);
+    ret = alloc_clusters_contiguous(need - have, hint, &first);
+    if(ret == -ENOSPC) {
+        // 没有足够长的连续空闲簇，退回逐个分配，这些簇已经清零
+        ret = alloc_clusters_near(need - have, hint, &first);
+    } else if(ret == 0) {
+        ret = cluster_clear(first + (need - have) - 1);
+    }
+    if(ret < 0) {
+        return ret;
+    }
+    if(is_cluster_inuse(last)) {
+        return write_fat_entry(last, first);
+    }
+    dir_entry_set_cluster(dir, first);
+    return 0;
+}
+
+/**
+ * @brief 把文件的簇链截断到正好容纳文件大小，写回目录项后回收多出来的簇
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+static int file_cut_chain(DirEntrySlot* slot) {
+    DIR_ENTRY* dir = &slot->dir;
+    size_t keep = (dir->DIR_FileSize + meta.cluster_size - 1) / meta.cluster_size;
+    cluster_t rest;
+    if(keep == 0) {
+        rest = dir_entry_cluster(dir);
+        dir_entry_set_cluster(dir, CLUSTER_FREE);
+    } else {
+        cluster_t clus = chain_cluster_at(dir_entry_cluster(dir), keep - 1);
+        if(!is_cluster_inuse(clus)) {
+            return -EIO;
+        }
+        rest = read_fat_entry(clus);
+        if(!is_cluster_inuse(rest)) {
+            return 0;
+        }
+        int ret = write_fat_entry(clus, CLUSTER_END);
+        if(ret < 0) {
+            return ret;
+        }
+    }
+    int ret = dir_entry_write(*slot);
+    if(ret < 0) {
+        return ret;
+    }
+    return reclaim_chain(rest);
+}
+
+#define COPY_RUN_SECTORS 256        // copy_file_range 一次批量读写的最大扇区数（128KB）
+
+/**
+ * @brief 从 (sclus, ssec) 开始复制 size 字节到 (dclus, dsec)，两边都连续的扇区合并成一次读和一次写。
+ *        最后一个不完整的扇区保留目标扇区中其余的内容。
+ */
+static int copy_sectors(cluster_t sclus, sector_t ssec, cluster_t dclus, sector_t dsec, size_t size) {
+    char* buf = malloc(COPY_RUN_SECTORS * PHYSICAL_SECTOR_SIZE);
+    if(buf == NULL) {
+        return -ENOMEM;
+    }
+    size_t sectors = (size + meta.sector_size - 1) / meta.sector_size;
+    int ret = 0;
+    for(size_t pos = 0; pos < sectors; ) {
+        sector_t s0 = ssec, d0 = dsec;
+        size_t run = 0;
+        do {
+            run++;
+            if(pos + run == sectors) {
                 break;
             }
-            sec++;
-            pointer += meta.sector_size;
+            ret = chain_next_sector(&sclus, &ssec);
+            if(ret == 0) {
+                ret = chain_next_sector(&dclus, &dsec);
+            }
+        } while(ret == 0 && run < COPY_RUN_SECTORS && ssec == s0 + run && dsec == d0 + run);
+        if(ret < 0) {
+            break;
         }
-        sector_read(sec, sector_buffer);
-        memcpy(sector_buffer+size%meta.sector_size, ZERO, meta.sector_size-(size%meta.sector_size));
-        sector_write(sec, sector_buffer);
-        sec++;
-        while (sec<first_sec+meta.sec_per_clus) {
-            sector_write(sec, ZERO);
-            sec++;
+
+        ret = sectors_read(s0, run, buf);
+        size_t bytes = min(run * meta.sector_size, size - pos * meta.sector_size);
+        size_t tail = bytes % meta.sector_size;
+        if(ret == 0 && tail != 0) {
+            char sector_buffer[PHYSICAL_SECTOR_SIZE];
+            ret = sectors_read(d0 + run - 1, 1, sector_buffer);
+            memcpy(buf + bytes, sector_buffer + tail, meta.sector_size - tail);
+        }
+        if(ret == 0) {
+            ret = sectors_write(d0, run, buf);
+        }
+        if(ret < 0) {
+            break;
         }
+        pos += run;
+    }
+    free(buf);
+    return ret;
+}
 
-        cluster_t next_clus=read_fat_entry(clus);
-        free_clusters(next_clus);
-        write_fat_entry(clus, CLUSTER_END);
-        
-        dir->DIR_FileSize=size;
-        dir_entry_write(slot);
-        printf("new size is less than old size, out fat16_truncate\n");
+/**
+ * @brief 在文件系统内部把 path_in 中 offset_in 开始的 size 字节复制到 path_out 的 offset_out 处，
+ *        数据不经过内核和 FUSE。目标文件需要扩展时一次性连续分配新簇，复制时按连续扇区批量读写。
+ *        只处理两个偏移都按扇区对齐、且不会在目标文件中留下空洞的复制；其余情况返回 -EOPNOTSUPP，
+ *        内核会退回普通的读写。
+ *
+ * @return ssize_t 成功返回复制的字节数，失败返回POSIX错误代码的负值
+ */
+ssize_t fat16_copy_file_range(const char* path_in, struct fuse_file_info* fi_in, off_t offset_in,
+                              const char* path_out, struct fuse_file_info* fi_out, off_t offset_out,
+                              size_t size, int flags) {
+    log_debug("copy_file_range(in='%s', offset_in=%ld, out='%s', offset_out=%ld, size=%lu)",
+              path_in, offset_in, path_out, offset_out, size);
+    if(flags != 0) {
+        return -EINVAL;
+    }
+    if(offset_in % meta.sector_size != 0 || offset_out % meta.sector_size != 0) {
+        return -EOPNOTSUPP;
+    }
+    DirEntrySlot src, dst;
+    int ret = find_entry(path_in, &src);
+    if(ret < 0) {
+        return ret;
+    }
+    ret = find_entry(path_out, &dst);
+    if(ret < 0) {
+        return ret;
+    }
+    if(is_directory(src.dir.DIR_Attr) || is_directory(dst.dir.DIR_Attr)) {
+        return -EISDIR;
+    }
+    if(src.sector == dst.sector && src.offset == dst.offset) {
+        return -EOPNOTSUPP;     // 同一个文件内的复制
+    }
+    if((size_t)offset_in >= src.dir.DIR_FileSize || size == 0) {
         return 0;
     }
-    return 0;
+    if((size_t)offset_out > dst.dir.DIR_FileSize) {
+        return -EOPNOTSUPP;     // 会在目标文件中留下空洞
+    }
+    size = min(size, src.dir.DIR_FileSize - offset_in);
+    size_t end = offset_out + size;
+    if(end > UINT32_MAX) {
+        return -EFBIG;
+    }
+
+    if(end > dst.dir.DIR_FileSize) {
+        ret = file_alloc_contiguous(&dst, end);
+        if(ret < 0) {
+            return ret;
+        }
+    }
+    cluster_t sclus = chain_cluster_at(dir_entry_cluster(&src.dir), offset_in / meta.cluster_size);
+    cluster_t dclus = chain_cluster_at(dir_entry_cluster(&dst.dir), offset_out / meta.cluster_size);
+    if(sclus == CLUSTER_FREE || dclus == CLUSTER_FREE) {
+        ret = -EIO;
+    } else {
+        sector_t ssec = cluster_first_sector(sclus) + offset_in % meta.cluster_size / meta.sector_size;
+        sector_t dsec = cluster_first_sector(dclus) + offset_out % meta.cluster_size / meta.sector_size;
+        ret = copy_sectors(sclus, ssec, dclus, dsec, size);
+    }
+    if(ret < 0) {
+        // 新分配的簇没有被完整覆盖写，不能留在簇链上：扩展文件时会读到其中的旧数据
+        int cret = file_cut_chain(&dst);
+        if(cret < 0) {
+            log_error("copy_file_range: cut chain of %s failed: %s", path_out, strerror(-cret));
+        }
+        return ret;
+    }
+    if(end > dst.dir.DIR_FileSize) {
+        dst.dir.DIR_FileSize = end;
+    }
+    ret = dir_entry_write(dst);
+    if(ret < 0) {
+        return ret;
+    }
+    return size;
 }
 
+/**
+ * @brief 处理对挂载点下文件的 ioctl。目前只有 FAT16_IOC_EXTENTS：把文件的簇链分成连续的段（extent），
+ *        返回从 map->start 开始的最多 FAT16_EXTENTS_MAX 段，以及按模拟磁盘的时间模型估计的、
+ *        顺序读取时段与段之间的寻道时间（计算方法与 fat16_defrag 相同）。
+ *        FAT16 的根目录不是簇链，与空文件一样没有 extent。
+ *
+ * @return int 成功返回0，失败返回POSIX错误代码的负值
+ */
+int fat16_ioctl(const char* path, int cmd, void* arg, struct fuse_file_info* fi,
+                unsigned int flags, void* data) {
+    log_debug("ioctl(path='%s', cmd=%#x)", path, (unsigned int)cmd);
+    if(flags & FUSE_IOCTL_COMPAT) {
+        return -ENOSYS;
+    }
+    if((unsigned int)cmd != FAT16_IOC_EXTENTS) {
+        return -ENOTTY;
+    }
+    cluster_t clus = meta.root_clus;
+    if(!path_is_root(path)) {
+        DirEntrySlot slot;
+        int ret = find_entry(path, &slot);
+        if(ret < 0) {
+            return ret;
+        }
+        clus = dir_entry_cluster(&slot.dir);
+    }
+
+    Fat16ExtentMap* map = data;
+    map->count = 0;
+    map->total = 0;
+    map->cluster_size = meta.cluster_size;
+    map->seek_ns = 0;
+    size_t walked = 0;          // 已经走过的簇数，簇链有环时不会超过总簇数
+    sector_t last_sec = 0;      // 上一个 extent 的最后一个扇区
+    while(is_cluster_inuse(clus) && walked < meta.clusters) {
+        Fat16Extent e = { .offset = (uint64_t)walked * meta.cluster_size, .cluster = clus,
+                          .sector = cluster_first_sector(clus), .clusters = 1 };
+        e.track = e.sector / SEC_PER_TRACK;
+        cluster_t next;
+        while((next = read_fat_entry(clus)) == clus + 1 && is_cluster_inuse(next)
+                && walked + e.clusters < meta.clusters) {
+            clus = next;
+            e.clusters++;
+        }
+        walked += e.clusters;
+        if(map->total > 0) {
+            e.seek_ns = disk_seek_estimate(last_sec, e.sector);
+            map->seek_ns += e.seek_ns;
+        }
+        last_sec = cluster_first_sector(clus) + meta.sec_per_clus - 1;
+        if(map->total >= map->start && map->count < FAT16_EXTENTS_MAX) {
+            map->extents[map->count++] = e;
+        }
+        map->total++;
+        clus = next;
+    }
+    return 0;
+}
 
 struct fuse_operations fat16_oper = {
     .init = fat16_init,
@@ -1439,6 +2302,7 @@ struct fuse_operations fat16_oper = {
 
     // TASK1: tree [dir] / ls [dir] ; cat [file] / tail [file] / head [file]
     .readdir = fat16_readdir,
+    .open = fat16_open,
     .read = fat16_read,
 
     // TASK2: touch [file]; rm [file]
@@ -1449,8 +2313,11 @@ struct fuse_operations fat16_oper = {
     // TASK3: mkdir [dir] ; rm -r [dir]
     .mkdir = fat16_mkdir,
     .rmdir = fat16_rmdir,
+    .rename = fat16_rename,
 
     // TASK4: echo "hello world!" > [file] ;  echo "hello world!" >> [file]
     .write = fat16_write,
-    .truncate = fat16_truncate
+    .truncate = fat16_truncate,
+    .copy_file_range = fat16_copy_file_range,
+    .ioctl = fat16_ioctl
 };
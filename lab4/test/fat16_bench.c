@@ -0,0 +1,385 @@
+/**
+ * 在挂载点上运行可配置的负载，按阶段和操作类型输出 CSV：吞吐量以及 p50/p99/p999 延迟。
+ *
+ * 用法: fat16_bench [选项] <dir>
+ *   -w phases    逗号分隔的阶段，按顺序执行（默认 create,append,read，与原 fat16_bench.py 相同）
+ *                  create  在随机深度的目录中创建文件
+ *                  append  随机选择文件追加写
+ *                  read    随机选择文件读取
+ *                  mixed   按 -r 的比例混合读和追加写
+ *                  meta    create/stat/unlink 风暴，只有元数据操作
+ *   -n files     文件数（默认 40）
+ *   -d depth     文件所在目录的最大深度（默认 6）
+ *   -s size      每次读写的字节数（默认 2333）
+ *   -o ops       每个阶段每个线程的操作数（默认 2000）
+ *   -r percent   mixed 阶段中读操作的百分比（默认 50）
+ *   -S           顺序读：每个文件从上次读到的位置继续读，而不是随机偏移
+ *   -t threads   客户端线程数（默认 1）；文件按编号分给各线程，线程之间不会写同一个文件
+ *   -p seed      随机数种子（默认 0）
+ *
+ * 所有文件都建在 <dir>/bench 下。最后一行是所有阶段的总耗时。
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+enum OpKind { OP_CREATE, OP_APPEND, OP_READ, OP_STAT, OP_UNLINK, OP_KINDS };
+static const char* OP_NAMES[OP_KINDS] = { "create", "append", "read", "stat", "unlink" };
+
+enum Phase { PHASE_CREATE, PHASE_APPEND, PHASE_READ, PHASE_MIXED, PHASE_META };
+static const char* PHASE_NAMES[] = { "create", "append", "read", "mixed", "meta" };
+#define PHASE_COUNT (sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]))
+
+typedef struct {
+    int phases[16];
+    int phase_count;
+    int files;
+    int depth;
+    size_t io_size;
+    int ops;
+    int read_percent;
+    bool sequential;
+    int threads;
+    unsigned seed;
+} Config;
+
+static Config cfg = {
+    .phase_count = 0,
+    .files = 40,
+    .depth = 6,
+    .io_size = 2333,
+    .ops = 2000,
+    .read_percent = 50,
+    .sequential = false,
+    .threads = 1,
+    .seed = 0,
+};
+
+typedef struct {
+    double* v;          // 每次操作的延迟（微秒）
+    size_t n, cap;
+    uint64_t errors;
+    uint64_t bytes;
+} Samples;
+
+typedef struct {
+    int id;
+    int phase;
+    unsigned rng;
+    Samples samples[OP_KINDS];
+    char* buf;
+} Worker;
+
+static char** files;            // 每个文件的路径
+static off_t* read_cursor;      // 顺序读时每个文件的读位置
+static char** dirs;             // 文件所在目录，meta 阶段也在这些目录中创建文件
+static pthread_barrier_t barrier;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static unsigned next_rand(unsigned* state) {
+    *state = *state * 1103515245u + 12345u;
+    return (*state >> 8) & 0xFFFFFF;
+}
+
+static void record(Samples* s, double start, bool ok, size_t bytes) {
+    if(!ok) {
+        s->errors++;
+        return;
+    }
+    if(s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 1024;
+        s->v = realloc(s->v, s->cap * sizeof(double));
+    }
+    s->v[s->n++] = now_us() - start;
+    s->bytes += bytes;
+}
+
+static int mkdirs(const char* path) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for(char* p = tmp + 1; *p; p++) {
+        if(*p == '/') {
+            *p = '\0';
+            if(mkdir(tmp, 0777) < 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if(mkdir(tmp, 0777) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 生成文件路径（与 fat16_bench.py 一样，每层目录名是 2 个随机字符），并创建目录
+ */
+static int prepare_paths(const char* root) {
+    static const char CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    unsigned rng = cfg.seed;
+    files = calloc(cfg.files, sizeof(char*));
+    dirs = calloc(cfg.files, sizeof(char*));
+    read_cursor = calloc(cfg.files, sizeof(off_t));
+    for(int i = 0; i < cfg.files; i++) {
+        char dir[4096];
+        int len = snprintf(dir, sizeof(dir), "%s/bench", root);
+        int level = 1 + next_rand(&rng) % cfg.depth;
+        for(int l = 0; l < level; l++) {
+            len += snprintf(dir + len, sizeof(dir) - len, "/%c%c",
+                            CHARS[next_rand(&rng) % 36], CHARS[next_rand(&rng) % 36]);
+        }
+        if(mkdirs(dir) < 0) {
+            fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+            return -1;
+        }
+        dirs[i] = strdup(dir);
+        files[i] = malloc(len + 16);
+        sprintf(files[i], "%s/f%02d.txt", dir, i);
+    }
+    return 0;
+}
+
+static void do_create(Worker* w, int f) {
+    double start = now_us();
+    bool ok = mknod(files[f], S_IFREG | 0666, 0) == 0 || errno == EEXIST;
+    record(&w->samples[OP_CREATE], start, ok, 0);
+}
+
+static void do_append(Worker* w, int f) {
+    double start = now_us();
+    int fd = open(files[f], O_WRONLY | O_APPEND);
+    bool ok = fd >= 0 && write(fd, w->buf, cfg.io_size) == (ssize_t)cfg.io_size;
+    if(fd >= 0) {
+        close(fd);
+    }
+    record(&w->samples[OP_APPEND], start, ok, cfg.io_size);
+}
+
+static void do_read(Worker* w, int f) {
+    double start = now_us();
+    struct stat st;
+    bool ok = stat(files[f], &st) == 0;
+    off_t off = 0;
+    if(ok && (size_t)st.st_size > cfg.io_size) {
+        if(cfg.sequential) {
+            off = read_cursor[f];
+            if(off + (off_t)cfg.io_size > st.st_size) {
+                off = 0;
+            }
+            read_cursor[f] = off + cfg.io_size;
+        } else {
+            off = next_rand(&w->rng) % (st.st_size - cfg.io_size + 1);
+        }
+    }
+    ssize_t n = 0;
+    if(ok) {
+        int fd = open(files[f], O_RDONLY);
+        ok = fd >= 0 && (n = pread(fd, w->buf, cfg.io_size, off)) >= 0;
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+    record(&w->samples[OP_READ], start, ok, n > 0 ? n : 0);
+}
+
+static void do_meta(Worker* w, int f, int i) {
+    char path[4200];
+    snprintf(path, sizeof(path), "%s/m%d_%d", dirs[f], w->id, i % 1000);
+    double start = now_us();
+    record(&w->samples[OP_CREATE], start, mknod(path, S_IFREG | 0666, 0) == 0, 0);
+    struct stat st;
+    start = now_us();
+    record(&w->samples[OP_STAT], start, stat(path, &st) == 0, 0);
+    start = now_us();
+    record(&w->samples[OP_UNLINK], start, unlink(path) == 0, 0);
+}
+
+// 线程 w 负责编号为 w->id, w->id + threads, ... 的文件
+static int pick_file(Worker* w) {
+    int owned = (cfg.files - w->id + cfg.threads - 1) / cfg.threads;
+    if(owned <= 0) {
+        return -1;
+    }
+    return w->id + (next_rand(&w->rng) % owned) * cfg.threads;
+}
+
+static void* worker_main(void* arg) {
+    Worker* w = arg;
+    pthread_barrier_wait(&barrier);
+    if(w->phase == PHASE_CREATE) {
+        for(int f = w->id; f < cfg.files; f += cfg.threads) {
+            do_create(w, f);
+        }
+    } else {
+        for(int i = 0; i < cfg.ops; i++) {
+            int f = pick_file(w);
+            if(f < 0) {
+                break;
+            }
+            switch(w->phase) {
+            case PHASE_APPEND:
+                do_append(w, f);
+                break;
+            case PHASE_READ:
+                do_read(w, f);
+                break;
+            case PHASE_MIXED:
+                if((int)(next_rand(&w->rng) % 100) < cfg.read_percent) {
+                    do_read(w, f);
+                } else {
+                    do_append(w, f);
+                }
+                break;
+            case PHASE_META:
+                do_meta(w, f, i);
+                break;
+            }
+        }
+    }
+    pthread_barrier_wait(&barrier);
+    return NULL;
+}
+
+static int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double percentile(const Samples* s, double p) {
+    if(s->n == 0) {
+        return 0;
+    }
+    size_t i = (size_t)(p * (s->n - 1) + 0.5);
+    return s->v[i];
+}
+
+/**
+ * @brief 用 threads 个线程执行一个阶段，输出该阶段每种操作的一行 CSV，返回阶段耗时（秒）
+ */
+static double run_phase(int phase) {
+    Worker* workers = calloc(cfg.threads, sizeof(Worker));
+    pthread_t* tids = calloc(cfg.threads, sizeof(pthread_t));
+    pthread_barrier_init(&barrier, NULL, cfg.threads + 1);
+    for(int t = 0; t < cfg.threads; t++) {
+        workers[t].id = t;
+        workers[t].phase = phase;
+        workers[t].rng = cfg.seed * 7919 + t * 104729 + phase;
+        workers[t].buf = malloc(cfg.io_size);
+        memset(workers[t].buf, 'a', cfg.io_size);
+        pthread_create(&tids[t], NULL, worker_main, &workers[t]);
+    }
+    pthread_barrier_wait(&barrier);
+    double start = now_us();
+    pthread_barrier_wait(&barrier);
+    double seconds = (now_us() - start) / 1e6;
+    for(int t = 0; t < cfg.threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    for(int k = 0; k < OP_KINDS; k++) {
+        Samples all = { 0 };
+        for(int t = 0; t < cfg.threads; t++) {
+            Samples* s = &workers[t].samples[k];
+            all.v = realloc(all.v, (all.n + s->n + 1) * sizeof(double));
+            memcpy(all.v + all.n, s->v, s->n * sizeof(double));
+            all.n += s->n;
+            all.errors += s->errors;
+            all.bytes += s->bytes;
+            free(s->v);
+        }
+        if(all.n + all.errors > 0) {
+            qsort(all.v, all.n, sizeof(double), cmp_double);
+            printf("%s,%s,%d,%zu,%lu,%.6f,%.1f,%.3f,%.1f,%.1f,%.1f\n", PHASE_NAMES[phase], OP_NAMES[k],
+                   cfg.threads, all.n, all.errors, seconds, all.n / seconds, all.bytes / seconds / 1e6,
+                   percentile(&all, 0.5), percentile(&all, 0.99), percentile(&all, 0.999));
+            fflush(stdout);
+        }
+        free(all.v);
+    }
+    for(int t = 0; t < cfg.threads; t++) {
+        free(workers[t].buf);
+    }
+    free(workers);
+    free(tids);
+    return seconds;
+}
+
+static int parse_phases(char* list) {
+    cfg.phase_count = 0;
+    for(char* tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        size_t p = 0;
+        while(p < PHASE_COUNT && strcmp(tok, PHASE_NAMES[p]) != 0) {
+            p++;
+        }
+        if(p == PHASE_COUNT || cfg.phase_count == 16) {
+            fprintf(stderr, "unknown phase: %s\n", tok);
+            return -1;
+        }
+        cfg.phases[cfg.phase_count++] = p;
+    }
+    return 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: fat16_bench [-w phases] [-n files] [-d depth] [-s size] [-o ops] "
+                    "[-r read%%] [-S] [-t threads] [-p seed] <dir>\n");
+}
+
+int main(int argc, char* argv[]) {
+    char default_phases[] = "create,append,read";
+    int opt;
+    while((opt = getopt(argc, argv, "w:n:d:s:o:r:St:p:")) != -1) {
+        switch(opt) {
+        case 'w':
+            if(parse_phases(optarg) < 0) {
+                return 1;
+            }
+            break;
+        case 'n': cfg.files = atoi(optarg); break;
+        case 'd': cfg.depth = atoi(optarg); break;
+        case 's': cfg.io_size = strtoul(optarg, NULL, 0); break;
+        case 'o': cfg.ops = atoi(optarg); break;
+        case 'r': cfg.read_percent = atoi(optarg); break;
+        case 'S': cfg.sequential = true; break;
+        case 't': cfg.threads = atoi(optarg); break;
+        case 'p': cfg.seed = strtoul(optarg, NULL, 0); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if(optind + 1 != argc || cfg.files <= 0 || cfg.depth <= 0 || cfg.io_size == 0
+            || cfg.threads <= 0 || cfg.ops < 0) {
+        usage();
+        return 1;
+    }
+    if(cfg.phase_count == 0) {
+        parse_phases(default_phases);
+    }
+
+    if(prepare_paths(argv[optind]) < 0) {
+        return 1;
+    }
+    printf("phase,op,threads,count,errors,seconds,ops_per_s,mb_per_s,p50_us,p99_us,p999_us\n");
+    double total = 0;
+    for(int i = 0; i < cfg.phase_count; i++) {
+        total += run_phase(cfg.phases[i]);
+    }
+    printf("total,,%d,,,%.6f,,,,,\n", cfg.threads, total);
+    return 0;
+}
@@ -0,0 +1,362 @@
+/**
+ * 不经过内核 FUSE，直接在进程内调用 fat16_oper 的回调，测量文件系统自身代码的耗时和扇区 I/O。
+ * 不需要 /dev/fuse，也不需要 root。
+ *
+ * 用法: fat16_harness [选项] <image>...
+ *   -w phases    逗号分隔的阶段：create,append,read,meta（默认 create,append,read）
+ *   -n files     文件数（默认 40）
+ *   -d depth     文件所在目录的最大深度（默认 6）
+ *   -s size      每次读写的字节数（默认 2333）
+ *   -o ops       append/read/meta 阶段的操作数（默认 2000）
+ *   -T us        模拟磁盘每个磁道的寻道时间（默认 0）
+ *   -M model     模拟磁盘的时间模型：linear / curve / rotational / ssd（默认 linear，其余参数取默认值）。
+ *                ssd 模型先检查跨通道的读要等到最慢的通道完成，不满足时退出码为 1
+ *   -p seed      随机数种子（默认 0）
+ *   -H csv       记录模拟磁盘的 I/O 热力图，结束时写入 csv
+ *   -J journal   使用写前日志（与 simple_fat16 --journal 相同），镜像不再以 O_DSYNC 打开
+ *   -S kb        多个镜像组成条带化的逻辑卷时，条带的大小（默认 64，与 simple_fat16 --stripe_kb 相同）
+ *   -t threads   每个阶段的并发线程数（默认 1），大于 1 时与 simple_fat16 一样启用后台回收；
+ *                回调间的互斥总是与 simple_fat16 相同
+ *
+ * 会修改镜像，请对副本运行。每个阶段结束后输出阶段耗时以及该阶段的 /.stats 报告
+ * （每个回调的调用次数、延迟分布、扇区读写次数和寻道）。
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fat16.h"
+#include "../fat16_journal.h"
+
+#define PAGE_SIZE 4096
+
+enum Phase { PHASE_CREATE, PHASE_APPEND, PHASE_READ, PHASE_META };
+static const char* PHASE_NAMES[] = { "create", "append", "read", "meta" };
+#define PHASE_COUNT (sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]))
+
+static int files = 40;
+static int depth = 6;
+static size_t io_size = 2333;
+static int ops = 2000;
+static int threads = 1;
+static unsigned seed;
+static __thread unsigned rng;   // 每个线程一个随机数序列
+
+static char** paths;
+static char** dirs;
+
+static unsigned next_rand(void) {
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 8) & 0xFFFFFF;
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 与 fat16_bench 相同的目录结构：每层目录名是 2 个随机字符
+static void prepare_paths(void) {
+    static const char CHARS[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    paths = calloc(files, sizeof(char*));
+    dirs = calloc(files, sizeof(char*));
+    for(int i = 0; i < files; i++) {
+        char dir[MAX_NAME_LEN];
+        int len = snprintf(dir, sizeof(dir), "/bench");
+        int level = 1 + next_rand() % depth;
+        for(int l = 0; l < level; l++) {
+            len += snprintf(dir + len, sizeof(dir) - len, "/%c%c", CHARS[next_rand() % 36], CHARS[next_rand() % 36]);
+        }
+        dirs[i] = strdup(dir);
+        paths[i] = malloc(len + 16);
+        sprintf(paths[i], "%s/f%02d.txt", dir, i);
+    }
+}
+
+// 与内核一样，先 lookup（getattr），只对不存在的目录调用 mkdir
+static int mkdirs(const char* path) {
+    char tmp[MAX_NAME_LEN];
+    struct stat st;
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    for(char* p = tmp + 1; ; p++) {
+        if(*p == '/' || *p == '\0') {
+            char c = *p;
+            *p = '\0';
+            int ret = fat16_oper.getattr(tmp, &st, NULL);
+            if(ret == -ENOENT) {
+                ret = fat16_oper.mkdir(tmp, 0777);
+            }
+            if(ret == -EEXIST) {
+                ret = 0;        // 其他线程刚刚创建了这个目录
+            }
+            if(ret < 0) {
+                return ret;
+            }
+            *p = c;
+            if(c == '\0') {
+                return 0;
+            }
+        }
+    }
+}
+
+static size_t file_size(const char* path) {
+    struct stat st;
+    return fat16_oper.getattr(path, &st, NULL) == 0 ? st.st_size : 0;
+}
+
+// 追加写：与内核处理 O_APPEND 一样，先取文件大小，再在文件末尾写。
+// 数据以文件路径和偏移开头，簇被放错位置时内容会变化（fat16_fsck -c 可以比较）
+static int do_append(const char* path, char* buf) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    size_t off = file_size(path);
+    int n = snprintf(buf, io_size, "%s@%zu ", path, off);
+    memset(buf + min((size_t)n, io_size - 1), 'a', io_size - min((size_t)n, io_size - 1));
+    return fat16_oper.write(path, buf, io_size, off, &fi);
+}
+
+// 随机读：模拟内核页缓存，按页对齐的偏移和长度读取
+static int do_read(const char* path, char* buf) {
+    size_t size = file_size(path);
+    size_t off = size > io_size ? next_rand() % (size - io_size + 1) : 0;
+    size_t start = off & ~(size_t)(PAGE_SIZE - 1);
+    size_t end = min((off + io_size + PAGE_SIZE - 1) & ~(size_t)(PAGE_SIZE - 1), size);
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    for(size_t p = start; p < end; p += PAGE_SIZE) {
+        int ret = fat16_oper.read(path, buf, PAGE_SIZE, p, &fi);
+        if(ret < 0) {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int phase;
+    int errors;
+} Worker;
+
+// 第 id 个线程执行阶段中下标为 id, id + threads, ... 的操作
+static void* run_worker(void* arg) {
+    Worker* w = arg;
+    int phase = w->phase;
+    char* buf = malloc(max(io_size, (size_t)PAGE_SIZE));
+    memset(buf, 'a', io_size);
+    if(w->id > 0) {
+        rng = seed + w->id * 7919u + phase;     // 主线程沿用 prepare_paths 之后的序列，与单线程时相同
+    }
+    for(int i = w->id; i < (phase == PHASE_CREATE ? files : ops); i += threads) {
+        int f = phase == PHASE_CREATE ? i : (int)(next_rand() % files);
+        int ret = 0;
+        switch(phase) {
+        case PHASE_CREATE:
+            ret = mkdirs(dirs[f]);
+            if(ret == 0) {
+                ret = fat16_oper.mknod(paths[f], S_IFREG | 0666, 0);
+            }
+            break;
+        case PHASE_APPEND:
+            ret = do_append(paths[f], buf);
+            break;
+        case PHASE_READ:
+            ret = do_read(paths[f], buf);
+            break;
+        case PHASE_META: {
+            char path[MAX_NAME_LEN];
+            struct stat st;
+            snprintf(path, sizeof(path), "%s/m%03d", dirs[f], i % 1000);
+            ret = fat16_oper.mknod(path, S_IFREG | 0666, 0);
+            if(ret == 0) {
+                ret = fat16_oper.getattr(path, &st, NULL);
+            }
+            if(ret == 0) {
+                ret = fat16_oper.unlink(path);
+            }
+            break;
+        }
+        }
+        if(ret < 0) {
+            w->errors++;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static int run_phase(int phase) {
+    Worker* workers = calloc(threads, sizeof(Worker));
+    for(int t = 0; t < threads; t++) {
+        workers[t].id = t;
+        workers[t].phase = phase;
+    }
+    for(int t = 1; t < threads; t++) {
+        pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+    }
+    run_worker(&workers[0]);
+    int errors = workers[0].errors;
+    for(int t = 1; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        errors += workers[t].errors;
+    }
+    free(workers);
+    return errors;
+}
+
+// ===========================ssd 模型检查===============================
+
+#define SSD_CHECK_LATENCY_NS    50000   // disk_set_timing 的默认 ssd_latency
+#define SSD_CHECK_HELPERS       8
+
+static volatile bool ssd_check_stop;
+
+// 不停地读第 0 页（通道 0），让通道 0 上总是排着 SSD_CHECK_HELPERS 个访问
+static void* ssd_check_helper(void* arg) {
+    (void)arg;
+    char buffer[8 * PHYSICAL_SECTOR_SIZE];
+    while(!ssd_check_stop) {
+        sectors_read(0, 8, buffer);
+    }
+    return NULL;
+}
+
+/**
+ * @brief 通道 0 繁忙时读第 8、9 页（通道 0 和 1）：第 9 页先完成，整个读要等到排在通道 0 上的第 8 页完成。
+ *        在 fat16_oper.init 之前调用，这时还没有 FAT 缓存，所有读都经过时间模型。
+ *
+ * @return int 满足返回0，否则返回1
+ */
+static int check_ssd_wait(void) {
+    pthread_t helpers[SSD_CHECK_HELPERS];
+    ssd_check_stop = false;
+    for(int i = 0; i < SSD_CHECK_HELPERS; i++) {
+        pthread_create(&helpers[i], NULL, ssd_check_helper, NULL);
+    }
+    usleep(5000);
+    char buffer[16 * PHYSICAL_SECTOR_SIZE];
+    double start = now_sec();
+    sectors_read(64, 16, buffer);
+    double waited = now_sec() - start;
+    ssd_check_stop = true;
+    for(int i = 0; i < SSD_CHECK_HELPERS; i++) {
+        pthread_join(helpers[i], NULL);
+    }
+
+    // 通道 0 上排队的访问至少要等几个延迟；只等最后一页（通道 1）时约为一个延迟
+    double least = SSD_CHECK_LATENCY_NS * (SSD_CHECK_HELPERS / 2) / 1e9;
+    printf("ssd check: 2-page read behind a busy channel took %.0f us (at least %.0f us)\n",
+           waited * 1e6, least * 1e6);
+    return waited >= least ? 0 : 1;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: fat16_harness [-w phases] [-n files] [-d depth] [-s size] [-o ops] "
+                    "[-T seek_us] [-M model] [-p seed] [-H heatmap.csv] [-J journal] [-S stripe_kb] [-t threads] "
+                    "<image>...\n");
+}
+
+int main(int argc, char* argv[]) {
+    char phase_list[256] = "create,append,read";
+    DiskTiming timing = { .model = "linear" };
+    const char* heatmap_path = NULL;
+    const char* journal_path = NULL;
+    unsigned long stripe_kb = 64;
+    int opt;
+    while((opt = getopt(argc, argv, "w:n:d:s:o:T:M:p:H:J:S:t:")) != -1) {
+        switch(opt) {
+        case 'w': snprintf(phase_list, sizeof(phase_list), "%s", optarg); break;
+        case 'n': files = atoi(optarg); break;
+        case 'd': depth = atoi(optarg); break;
+        case 's': io_size = strtoul(optarg, NULL, 0); break;
+        case 'o': ops = atoi(optarg); break;
+        case 'T': timing.seek_time_us = strtoull(optarg, NULL, 0); break;
+        case 'M': timing.model = optarg; break;
+        case 'p': seed = strtoul(optarg, NULL, 0); break;
+        case 'H': heatmap_path = optarg; break;
+        case 'J': journal_path = optarg; break;
+        case 'S': stripe_kb = strtoul(optarg, NULL, 0); break;
+        case 't': threads = atoi(optarg); break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if(optind == argc || files <= 0 || depth <= 0 || io_size == 0 || ops < 0 || threads <= 0) {
+        usage();
+        return 1;
+    }
+
+    int phases[16];
+    int phase_count = 0;
+    for(char* tok = strtok(phase_list, ","); tok; tok = strtok(NULL, ",")) {
+        size_t p = 0;
+        while(p < PHASE_COUNT && strcmp(tok, PHASE_NAMES[p]) != 0) {
+            p++;
+        }
+        if(p == PHASE_COUNT || phase_count == 16) {
+            fprintf(stderr, "unknown phase: %s\n", tok);
+            return 1;
+        }
+        phases[phase_count++] = p;
+    }
+
+    init_disk_striped((const char* const*)&argv[optind], argc - optind, stripe_kb * 1024 / PHYSICAL_SECTOR_SIZE,
+                      timing.seek_time_us);
+    if(disk_set_timing(&timing) < 0) {
+        fprintf(stderr, "unknown disk model: %s\n", timing.model);
+        return 1;
+    }
+    if(strcmp(timing.model, "ssd") == 0 && check_ssd_wait() != 0) {
+        return 1;
+    }
+    if(heatmap_path != NULL && disk_enable_heatmap(heatmap_path) < 0) {
+        perror(heatmap_path);
+        return 1;
+    }
+    if(journal_path != NULL) {
+        int ret = journal_open(journal_path);
+        if(ret < 0) {
+            fprintf(stderr, "%s: %s\n", journal_path, strerror(-ret));
+            return 1;
+        }
+        journal_wrap_operations(&fat16_oper);
+    }
+    lock_wrap_operations(&fat16_oper);
+    if(threads > 1) {
+        reclaim_wrap_operations(&fat16_oper);
+    }
+    stats_wrap_operations(&fat16_oper);
+    struct fuse_conn_info conn;
+    struct fuse_config config;
+    memset(&conn, 0, sizeof(conn));
+    memset(&config, 0, sizeof(config));
+    fat16_oper.init(&conn, &config);
+    rng = seed;
+    prepare_paths();
+
+    double total = 0;
+    for(int i = 0; i < phase_count; i++) {
+        stats_reset();
+        double start = now_sec();
+        int errors = run_phase(phases[i]);
+        double seconds = now_sec() - start;
+        total += seconds;
+
+        size_t len;
+        char* report = stats_render(&len);
+        printf("=== phase %s: %.6f s, %d errors\n%s\n", PHASE_NAMES[phases[i]], seconds, errors, report);
+        free(report);
+    }
+    fat16_oper.destroy(NULL);
+    disk_heatmap_dump();
+    printf("total: %.6f s\n", total);
+    return 0;
+}
@@ -0,0 +1,306 @@
+/**
+ * 重放 simple_fat16 --trace=file 记录的操作序列。
+ *
+ * 用法: fat16_replay [-f] [-v] [-T us] (-i image | -m mountpoint) <trace>
+ *   -i image       在进程内直接调用 fat16_oper 的回调（与 fat16_harness 相同，不需要 FUSE）
+ *   -m mountpoint  通过系统调用在挂载点上重放
+ *   -f             尽快重放，忽略记录中的时间间隔（默认按原来的时间间隔重放）
+ *   -v             输出返回值与记录不一致的每个操作
+ *   -T us          进程内重放时模拟磁盘每个磁道的寻道时间（默认 0）
+ *
+ * 操作按记录的顺序在一个线程中依次重放。写入的数据没有被记录，重放时写入固定内容。
+ * 通过挂载点重放时，copy_file_range 由内核决定是否交给文件系统处理。
+ * 结束后输出每种操作的次数、返回值不一致的次数和总耗时；进程内重放还会输出 /.stats 报告。
+ */
+#define _GNU_SOURCE      // copy_file_range
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../fat16.h"
+#include "../fat16_trace.h"
+
+static bool in_process;
+static const char* mountpoint;
+static bool verbose;
+static char* data;              // write 使用的数据，read 的缓冲区
+static size_t data_size;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns) {
+    struct timespec ts = { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
+static void ensure_buffer(size_t size) {
+    if(size > data_size) {
+        data = realloc(data, size);
+        memset(data, 'x', size);
+        data_size = size;
+    }
+}
+
+static void to_timespec(uint64_t v, struct timespec* ts) {
+    if(v == TRACE_TIME_NOW) {
+        ts->tv_sec = 0;
+        ts->tv_nsec = UTIME_NOW;
+    } else if(v == TRACE_TIME_OMIT) {
+        ts->tv_sec = 0;
+        ts->tv_nsec = UTIME_OMIT;
+    } else {
+        ts->tv_sec = v / 1000000000;
+        ts->tv_nsec = v % 1000000000;
+    }
+}
+
+static int fill_nothing(void* buf, const char* name, const struct stat* st, off_t off,
+                        enum fuse_fill_dir_flags flags) {
+    return 0;
+}
+
+/**
+ * @brief 在进程内重放一条记录，返回回调的返回值；不需要重放的操作返回记录中的值
+ */
+static int replay_callback(const TraceRecord* rec, const char* path) {
+    struct fuse_file_info fi;
+    memset(&fi, 0, sizeof(fi));
+    struct stat st;
+    struct timespec tv[2];
+    switch(rec->op) {
+    case OP_GETATTR:
+        return fat16_oper.getattr(path, &st, NULL);
+    case OP_READDIR:
+        return fat16_oper.readdir(path, NULL, fill_nothing, rec->arg1, &fi, 0);
+    case OP_READ:
+        ensure_buffer(rec->arg2);
+        return fat16_oper.read(path, data, rec->arg2, rec->arg1, &fi);
+    case OP_WRITE:
+        ensure_buffer(rec->arg2);
+        return fat16_oper.write(path, data, rec->arg2, rec->arg1, &fi);
+    case OP_MKNOD:
+        return fat16_oper.mknod(path, rec->arg2, 0);
+    case OP_MKDIR:
+        return fat16_oper.mkdir(path, rec->arg2);
+    case OP_UNLINK:
+        return fat16_oper.unlink(path);
+    case OP_RMDIR:
+        return fat16_oper.rmdir(path);
+    case OP_TRUNCATE:
+        return fat16_oper.truncate(path, rec->arg1, NULL);
+    case OP_UTIMENS:
+        to_timespec(rec->arg1, &tv[0]);
+        to_timespec(rec->arg2, &tv[1]);
+        return fat16_oper.utimens(path, tv, NULL);
+    case OP_OPEN:
+        fi.flags = rec->arg2;
+        return fat16_oper.open(path, &fi);
+    case OP_RELEASE:
+        return fat16_oper.release(path, &fi);
+    case OP_RENAME:
+        return fat16_oper.rename(path, path + strlen(path) + 1, rec->arg2);
+    case OP_COPY_FILE_RANGE:
+        return fat16_oper.copy_file_range(path, &fi, rec->arg1, path + strlen(path) + 1, &fi, rec->arg2,
+                                          rec->arg3, 0);
+    default:
+        return rec->ret;
+    }
+}
+
+/**
+ * @brief 通过挂载点重放一条记录。read/write 各自打开和关闭文件，open/release 不单独重放。
+ */
+static int replay_syscall(const TraceRecord* rec, const char* path) {
+    char full[MAX_NAME_LEN * 2];
+    snprintf(full, sizeof(full), "%s%s", mountpoint, path);
+    struct stat st;
+    struct timespec tv[2];
+    int ret = 0;
+    switch(rec->op) {
+    case OP_GETATTR:
+        ret = lstat(full, &st);
+        break;
+    case OP_READDIR: {
+        DIR* dir = opendir(full);
+        if(dir == NULL) {
+            return -errno;
+        }
+        while(readdir(dir) != NULL) {
+        }
+        closedir(dir);
+        return 0;
+    }
+    case OP_READ:
+    case OP_WRITE: {
+        int fd = open(full, rec->op == OP_READ ? O_RDONLY : O_WRONLY);
+        if(fd < 0) {
+            return -errno;
+        }
+        ensure_buffer(rec->arg2);
+        ssize_t n = rec->op == OP_READ ? pread(fd, data, rec->arg2, rec->arg1)
+                                       : pwrite(fd, data, rec->arg2, rec->arg1);
+        ret = n < 0 ? -errno : (int)n;
+        close(fd);
+        return ret;
+    }
+    case OP_MKNOD:
+        ret = mknod(full, rec->arg2, 0);
+        break;
+    case OP_MKDIR:
+        ret = mkdir(full, rec->arg2 & 07777);
+        break;
+    case OP_UNLINK:
+        ret = unlink(full);
+        break;
+    case OP_RMDIR:
+        ret = rmdir(full);
+        break;
+    case OP_TRUNCATE:
+        ret = truncate(full, rec->arg1);
+        break;
+    case OP_UTIMENS:
+        to_timespec(rec->arg1, &tv[0]);
+        to_timespec(rec->arg2, &tv[1]);
+        ret = utimensat(AT_FDCWD, full, tv, AT_SYMLINK_NOFOLLOW);
+        break;
+    case OP_RENAME: {
+        char full2[MAX_NAME_LEN * 2];
+        snprintf(full2, sizeof(full2), "%s%s", mountpoint, path + strlen(path) + 1);
+        ret = rec->arg2 == 0 ? rename(full, full2)
+                             : (int)syscall(SYS_renameat2, AT_FDCWD, full, AT_FDCWD, full2, (unsigned)rec->arg2);
+        break;
+    }
+    case OP_COPY_FILE_RANGE: {
+        char full2[MAX_NAME_LEN * 2];
+        snprintf(full2, sizeof(full2), "%s%s", mountpoint, path + strlen(path) + 1);
+        int in = open(full, O_RDONLY);
+        int out = open(full2, O_WRONLY);
+        loff_t off_in = rec->arg1, off_out = rec->arg2;
+        ssize_t n = in < 0 || out < 0 ? -1 : copy_file_range(in, &off_in, out, &off_out, rec->arg3, 0);
+        ret = n < 0 ? -errno : (int)n;
+        if(in >= 0) {
+            close(in);
+        }
+        if(out >= 0) {
+            close(out);
+        }
+        return ret;
+    }
+    default:
+        return rec->ret;
+    }
+    return ret < 0 ? -errno : 0;
+}
+
+static void usage(void) {
+    fprintf(stderr, "Usage: fat16_replay [-f] [-v] [-T seek_us] (-i image | -m mountpoint) <trace>\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* image = NULL;
+    bool fast = false;
+    uint64_t seek_time_us = 0;
+    int opt;
+    while((opt = getopt(argc, argv, "fvT:i:m:")) != -1) {
+        switch(opt) {
+        case 'f': fast = true; break;
+        case 'v': verbose = true; break;
+        case 'T': seek_time_us = strtoull(optarg, NULL, 0); break;
+        case 'i': image = optarg; break;
+        case 'm': mountpoint = optarg; break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if(optind + 1 != argc || (image == NULL) == (mountpoint == NULL)) {
+        usage();
+        return 1;
+    }
+    in_process = image != NULL;
+
+    FILE* f = fopen(argv[optind], "rb");
+    if(f == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+    TraceHeader header;
+    if(fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != TRACE_VERSION || header.record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a trace file or unsupported version\n", argv[optind]);
+        return 1;
+    }
+
+    if(in_process) {
+        init_disk(image, seek_time_us);
+        stats_wrap_operations(&fat16_oper);
+        struct fuse_conn_info conn;
+        struct fuse_config config;
+        memset(&conn, 0, sizeof(conn));
+        memset(&config, 0, sizeof(config));
+        fat16_oper.init(&conn, &config);
+        stats_reset();
+    }
+
+    uint64_t counts[OP_COUNT] = { 0 };
+    uint64_t mismatches[OP_COUNT] = { 0 };
+    uint64_t start = now_ns();
+    TraceRecord rec;
+    char path[UINT16_MAX + 1];
+    while(fread(&rec, sizeof(rec), 1, f) == 1) {
+        if(fread(path, 1, rec.path_len, f) != rec.path_len || rec.op >= OP_COUNT) {
+            fprintf(stderr, "truncated or corrupt trace\n");
+            break;
+        }
+        path[rec.path_len] = '\0';
+        if((rec.op == OP_RENAME || rec.op == OP_COPY_FILE_RANGE) && strlen(path) == rec.path_len) {
+            fprintf(stderr, "corrupt %s record\n", OP_NAMES[rec.op]);
+            break;
+        }
+        if(rec.op == OP_INIT || rec.op == OP_DESTROY) {
+            continue;
+        }
+        if(!fast) {
+            sleep_until(start + rec.start_ns);
+        }
+        int ret = in_process ? replay_callback(&rec, path) : replay_syscall(&rec, path);
+        counts[rec.op]++;
+        if(ret != rec.ret) {
+            mismatches[rec.op]++;
+            if(verbose) {
+                fprintf(stderr, "%s(%s): recorded %d, replayed %d\n", OP_NAMES[rec.op], path, rec.ret, ret);
+            }
+        }
+    }
+    double seconds = (now_ns() - start) / 1e9;
+    fclose(f);
+
+    printf("%-10s %10s %10s\n", "op", "count", "mismatch");
+    uint64_t total = 0;
+    for(int op = 0; op < OP_COUNT; op++) {
+        if(counts[op] != 0) {
+            printf("%-10s %10lu %10lu\n", OP_NAMES[op], counts[op], mismatches[op]);
+            total += counts[op];
+        }
+    }
+    printf("replayed %lu operations in %.6f s\n", total, seconds);
+
+    if(in_process) {
+        size_t len;
+        char* report = stats_render(&len);
+        printf("\n%s", report);
+        free(report);
+        fat16_oper.destroy(NULL);
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+/**
+ * 检查 fat16_simd.c 中的向量化扫描：dir_scan、fat_free_bitmap、fat_count_free、fat_find_free_run
+ * 的结果与逐项计算的参考实现相同。用环境变量 FAT16_SIMD=scalar|sse2|avx2 选择要测试的实现，
+ * run_simd_test.sh 依次测试每一种，并比较它们输出的结果摘要。
+ *
+ * 用法: fat16_simd_test [-n 轮数] [-p seed]
+ *
+ * 覆盖：不足 64 项的最后一个位图字、跨 64 位字和跨 4096 项扫描块的连续空闲段、
+ * 分多次调用 fat_find_free_run 时跨调用的连续空闲段、FAT32 表项的高 4 位。
+ * 有不一致时打印第一处差异并返回 1。
+ */
+#include <getopt.h>
+#include <string.h>
+
+#include "../fat16.h"
+
+#define MAX_ENTRIES 20000
+
+static unsigned rng;
+static int failures;
+static uint64_t digest = 0xcbf29ce484222325ull;
+
+static unsigned next_rand(void) {
+    rng = rng * 1103515245u + 12345u;
+    return (rng >> 8) & 0xFFFFFF;
+}
+
+static void mix(uint64_t v) {
+    for(int i = 0; i < 8; i++, v >>= 8) {
+        digest = (digest ^ (v & 0xFF)) * 0x100000001b3ull;
+    }
+}
+
+#define CHECK(cond, ...) do {                       \
+        if(!(cond)) {                               \
+            if(failures++ < 10) {                   \
+                printf("FAIL: " __VA_ARGS__);       \
+                printf("\n");                       \
+            }                                       \
+        }                                           \
+    } while(0)
+
+// ===========================参考实现===============================
+
+static bool entry_free(const void* fat, size_t i, int bits) {
+    if(bits == 32) {
+        return (((const uint32_t*)fat)[i] & FAT32_ENTRY_MASK) == 0;
+    }
+    return ((const uint16_t*)fat)[i] == 0;
+}
+
+static size_t ref_count_free(const void* fat, size_t n, int bits) {
+    size_t count = 0;
+    for(size_t i = 0; i < n; i++) {
+        count += entry_free(fat, i, bits);
+    }
+    return count;
+}
+
+// 与 fat_find_free_run 相同的约定，*carry 为之前的连续空闲表项数
+static size_t ref_find_free_run(const void* fat, size_t n, int bits, size_t want, size_t* carry) {
+    size_t run = *carry;
+    for(size_t i = 0; i < n; i++) {
+        run = entry_free(fat, i, bits) ? run + 1 : 0;
+        if(run >= want) {
+            return i;
+        }
+    }
+    *carry = run;
+    return SIZE_MAX;
+}
+
+// ===========================测试数据===============================
+
+/**
+ * @brief 生成 n 个表项：空闲的表项成段出现，段长由 density 决定；FAT32 的空闲表项随机带上高 4 位
+ */
+static void fill_fat(void* fat, size_t n, int bits, unsigned density) {
+    bool free_run = false;
+    for(size_t i = 0; i < n; i++) {
+        if(next_rand() % 100 < density) {
+            free_run = !free_run;
+        }
+        uint32_t entry = free_run ? 0 : 1 + next_rand() % 0xFFF0;
+        if(bits == 32) {
+            if(next_rand() % 4 == 0) {
+                entry |= 0xF0000000u;       // 保留位不影响是否空闲
+            }
+            ((uint32_t*)fat)[i] = entry;
+        } else {
+            ((uint16_t*)fat)[i] = entry;
+        }
+    }
+}
+
+static void test_dir_scan(int rounds) {
+    uint8_t sector[PHYSICAL_SECTOR_SIZE];
+    char name[FAT_NAME_LEN];
+    for(int r = 0; r < rounds; r++) {
+        for(size_t i = 0; i < FAT_NAME_LEN; i++) {
+            name[i] = 'A' + next_rand() % 3;
+        }
+        for(int e = 0; e < DIR_ENTRIES_PER_SECTOR; e++) {
+            uint8_t* p = sector + e * DIR_ENTRY_SIZE;
+            for(size_t i = 0; i < DIR_ENTRY_SIZE; i++) {
+                p[i] = next_rand();
+            }
+            switch(next_rand() % 6) {
+            case 0: p[0] = NAME_FREE; break;
+            case 1: p[0] = NAME_DELETED; break;
+            case 2: memcpy(p, name, FAT_NAME_LEN); break;
+            case 3:
+                // 只有一个字节不同，包括最后一个字节
+                memcpy(p, name, FAT_NAME_LEN);
+                p[next_rand() % FAT_NAME_LEN] ^= 1 << (next_rand() % 8);
+                break;
+            default: break;
+            }
+            if(next_rand() % 4 == 0) {
+                p[FAT_NAME_LEN] = ATTR_LFN;
+            }
+        }
+
+        for(int with_name = 0; with_name < 2; with_name++) {
+            const char* probe = with_name ? name : NULL;
+            DirScanMask want, got;
+            memset(&want, 0, sizeof(want));
+            for(int e = 0; e < DIR_ENTRIES_PER_SECTOR; e++) {
+                const uint8_t* p = sector + e * DIR_ENTRY_SIZE;
+                uint32_t bit = 1u << e;
+                want.free |= p[0] == NAME_FREE ? bit : 0;
+                want.deleted |= p[0] == NAME_DELETED ? bit : 0;
+                want.lfn |= p[FAT_NAME_LEN] == ATTR_LFN ? bit : 0;
+                want.match |= probe != NULL && memcmp(p, probe, FAT_NAME_LEN) == 0 ? bit : 0;
+            }
+            dir_scan(sector, probe, &got);
+            CHECK(memcmp(&want, &got, sizeof(want)) == 0,
+                  "dir_scan round %d name %d: free %#x/%#x deleted %#x/%#x lfn %#x/%#x match %#x/%#x",
+                  r, with_name, got.free, want.free, got.deleted, want.deleted, got.lfn, want.lfn,
+                  got.match, want.match);
+            mix(got.free);
+            mix(got.deleted);
+            mix(got.lfn);
+            mix(got.match);
+        }
+    }
+}
+
+static void test_fat_bitmap(const void* fat, size_t n, int bits) {
+    static uint64_t bitmap[MAX_ENTRIES / 64 + 2];   // 多一个字检查越界写
+    size_t words = (n + 63) / 64;
+    memset(bitmap, 0xA5, sizeof(bitmap));
+    fat_free_bitmap(fat, n, bits, bitmap);
+    for(size_t w = 0; w < words; w++) {
+        uint64_t want = 0;
+        for(size_t i = w * 64; i < min(n, (w + 1) * 64); i++) {
+            want |= (uint64_t)entry_free(fat, i, bits) << (i % 64);
+        }
+        CHECK(bitmap[w] == want, "fat_free_bitmap n=%zu bits=%d word %zu: %#lx, want %#lx",
+              n, bits, w, bitmap[w], want);
+        mix(bitmap[w]);
+    }
+    CHECK(bitmap[words] == 0xA5A5A5A5A5A5A5A5ull, "fat_free_bitmap n=%zu bits=%d wrote past the end",
+          n, bits);
+
+    size_t count = fat_count_free(fat, n, bits);
+    CHECK(count == ref_count_free(fat, n, bits), "fat_count_free n=%zu bits=%d: %zu, want %zu",
+          n, bits, count, ref_count_free(fat, n, bits));
+    mix(count);
+}
+
+static void test_free_run(const void* fat, size_t n, int bits, size_t want) {
+    // 一次扫描整个表
+    size_t carry = 0, ref_carry = 0;
+    size_t got = fat_find_free_run(fat, n, bits, want, &carry);
+    size_t ref = ref_find_free_run(fat, n, bits, want, &ref_carry);
+    CHECK(got == ref && (ref != SIZE_MAX || carry == ref_carry),
+          "fat_find_free_run n=%zu bits=%d want=%zu: %zd carry %zu, want %zd carry %zu",
+          n, bits, want, (ssize_t)got, carry, (ssize_t)ref, ref_carry);
+    mix(got);
+
+    // 分成随机长度的几段扫描，连续空闲段可能跨越调用
+    carry = 0;
+    size_t split = SIZE_MAX;
+    for(size_t pos = 0; pos < n; ) {
+        size_t len = 1 + next_rand() % 700;     // min 是宏，不能直接把 next_rand() 传进去
+        len = min(n - pos, len);
+        size_t idx = fat_find_free_run((const char*)fat + pos * (bits / 8), len, bits, want, &carry);
+        if(idx != SIZE_MAX) {
+            split = pos + idx;
+            break;
+        }
+        pos += len;
+    }
+    CHECK(split == ref, "fat_find_free_run split n=%zu bits=%d want=%zu: %zd, want %zd",
+          n, bits, want, (ssize_t)split, (ssize_t)ref);
+}
+
+static void test_fat(int rounds) {
+    static uint32_t fat[MAX_ENTRIES];
+    // 边界附近的长度：不足一个字、正好一个字、跨扫描块（4096 项）
+    static const size_t SIZES[] = { 0, 1, 5, 63, 64, 65, 127, 128, 129, 1000, 4095, 4096, 4097, 8191,
+                                    8193, MAX_ENTRIES };
+    static const size_t WANTS[] = { 1, 2, 3, 31, 63, 64, 65, 100, 129, 300, 5000 };
+    static const unsigned DENSITY[] = { 1, 5, 30, 90 };
+    for(int r = 0; r < rounds; r++) {
+        for(int bits = 16; bits <= 32; bits += 16) {
+            for(size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+                size_t n = SIZES[s];
+                fill_fat(fat, n, bits, DENSITY[(r + s) % 4]);
+                test_fat_bitmap(fat, n, bits);
+                for(size_t w = 0; w < sizeof(WANTS) / sizeof(WANTS[0]); w++) {
+                    test_free_run(fat, n, bits, WANTS[w]);
+                }
+            }
+            // 全部空闲和全部占用
+            for(int all = 0; all < 2; all++) {
+                memset(fat, all ? 0 : 0x11, sizeof(fat));
+                test_fat_bitmap(fat, MAX_ENTRIES - r, bits);
+                test_free_run(fat, MAX_ENTRIES - r, bits, 4096 + r);
+            }
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int rounds = 50;
+    int opt;
+    while((opt = getopt(argc, argv, "n:p:")) != -1) {
+        switch(opt) {
+        case 'n': rounds = atoi(optarg); break;
+        case 'p': rng = strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rounds] [-p seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    const char* want = getenv("FAT16_SIMD");
+    if(want != NULL && strcmp(want, simd_variant()) != 0) {
+        fprintf(stderr, "FAT16_SIMD=%s is not supported on this CPU, using %s\n", want, simd_variant());
+        return 2;
+    }
+
+    test_dir_scan(rounds * 20);
+    test_fat(rounds);
+    printf("%s: %d failures, digest %016lx\n", simd_variant(), failures, digest);
+    return failures ? 1 : 0;
+}
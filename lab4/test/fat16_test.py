@@ -1,3 +1,4 @@
+import errno
 import os
 import random
 import unittest
@@ -184,6 +185,16 @@ class TestFat16CreateRemove(unittest.TestCase):
         shutil.rmtree(tree_dir, ignore_errors=True)
         self.assertFalse(os.path.exists(tree_dir), f'remove {tree_dir}, but it still exists')
 
+    def test9_dir_grow(self):
+        # 超过一个簇能容纳的目录项时，目录要扩展到新的簇
+        os.chdir(FAT_DIR)
+        dir = os.path.join(FAT_DIR, 'bigdir')
+        os.mkdir(dir, mode=0o777)
+        names = [f'f{i:03}.txt' for i in range(200)]
+        for name in names:
+            os.mknod(os.path.join(dir, name), mode=0o666)
+        self.assertEqual(sorted(os.listdir(dir)), names)
+
 
 class TestFat16Write(unittest.TestCase):
     def test1_file_truncate_extend(self):
@@ -287,7 +298,111 @@ class TestFat16Write(unittest.TestCase):
                 expected = expected_content[start: start + wlen]
                 self.assertEqual(content, expected,
                             f'{file} does not match expected content, start={start}, len={wlen}')
+
+    def test5_write_past_eof(self):
+        os.chdir(FAT_DIR)
+        file = 'sparse.txt'
+        with open(file, 'wb') as f:
+            f.write(b'head')
+            f.seek(10000)
+            f.write(b'tail')
+        self.assertEqual(os.path.getsize(file), 10004)
+        with open(file, 'rb') as f:
+            self.assertEqual(f.read(), b'head' + b'\0' * 9996 + b'tail')
+        # 截断到 0 后再追加，簇链不会重复分配
+        with open(file, 'wb') as f:
+            for i in range(100):
+                f.write(b'%03d\n' % i)
+        with open(file, 'rb') as f:
+            self.assertEqual(f.read(), b''.join(b'%03d\n' % i for i in range(100)))
+
+    def test6_read_past_eof(self):
+        os.chdir(FAT_DIR)
+        file = 'shortread.txt'
+        with open(file, 'wb') as f:
+            f.write(b'0123456789')
+        fd = os.open(file, os.O_RDONLY)
+        try:
+            self.assertEqual(os.pread(fd, 100, 5), b'56789')
+            self.assertEqual(os.pread(fd, 100, 10), b'')
+            self.assertEqual(os.pread(fd, 100, 100000), b'')
+        finally:
+            os.close(fd)
+        # 扩展文件的写还没有写回时，读其中的空洞
+        with open(file, 'r+b') as f:
+            f.seek(20000)
+            f.write(b'tail')
+            f.flush()
+            f.seek(5000)
+            self.assertEqual(f.read(100), b'\0' * 100)
+            f.seek(20004)
+            self.assertEqual(f.read(100), b'')
+        os.remove(file)
                 
         
         
 
+
+
+class TestFat16Rename(unittest.TestCase):
+    def test1_file_rename_same_dir(self):
+        os.chdir(FAT_DIR)
+        with open('mvsrc.txt', 'w') as f:
+            f.write(SMALL_FILES_CONTENT[0])
+        os.rename('mvsrc.txt', 'mvdst.txt')
+        self.assertFalse(os.path.exists('mvsrc.txt'), 'rename mvsrc.txt, but it still exists')
+        with open('mvdst.txt', 'r') as f:
+            self.assertEqual(f.read(), SMALL_FILES_CONTENT[0], 'mvdst.txt does not match expected content')
+
+    def test2_file_rename_replace(self):
+        os.chdir(FAT_DIR)
+        with open('mvold.txt', 'w') as f:
+            f.write(SMALL_FILES_CONTENT[1])
+        os.rename('mvold.txt', 'mvdst.txt')
+        self.assertFalse(os.path.exists('mvold.txt'), 'rename mvold.txt, but it still exists')
+        with open('mvdst.txt', 'r') as f:
+            self.assertEqual(f.read(), SMALL_FILES_CONTENT[1], 'mvdst.txt was not replaced')
+
+    def test3_dir_rename_cross_dir(self):
+        os.chdir(FAT_DIR)
+        os.mkdir('mvdir1', mode=0o777)
+        os.mkdir('mvdir2', mode=0o777)
+        with open('mvdir1/f.txt', 'w') as f:
+            f.write(SMALL_FILES_CONTENT[2])
+        os.rename('mvdir1', 'mvdir2/sub')
+        self.assertFalse(os.path.exists('mvdir1'), 'rename mvdir1, but it still exists')
+        self.assertTrue(os.path.isdir('mvdir2/sub'), 'mvdir2/sub is not a directory')
+        with open('mvdir2/sub/f.txt', 'r') as f:
+            self.assertEqual(f.read(), SMALL_FILES_CONTENT[2], 'mvdir2/sub/f.txt does not match expected content')
+        os.remove('mvdir2/sub/f.txt')
+        os.rmdir('mvdir2/sub')
+        os.rmdir('mvdir2')
+        self.assertFalse(os.path.exists('mvdir2'), 'remove mvdir2, but it still exists')
+
+    def test4_dir_rename_into_itself(self):
+        os.chdir(FAT_DIR)
+        os.mkdir('MVLOOP', mode=0o777)
+        os.mkdir('MVLOOP/sub', mode=0o777)
+        # 文件名不区分大小写，/mvloop/sub 就在 /MVLOOP 之下
+        for to in ['MVLOOP/inner', 'mvloop/inner', 'mvloop/SUB/inner']:
+            with self.assertRaises(OSError, msg=f'rename MVLOOP to {to} should fail') as cm:
+                os.rename('MVLOOP', to)
+            self.assertEqual(cm.exception.errno, errno.EINVAL)
+        self.assertTrue(os.path.isdir('MVLOOP/sub'), 'MVLOOP/sub disappeared after a failed rename')
+        os.rmdir('MVLOOP/sub')
+        os.rmdir('MVLOOP')
+
+
+class TestFat16Copy(unittest.TestCase):
+    def test1_copy_file_range_large(self):
+        os.chdir(FAT_DIR)
+        with open(LARGE_FILE, 'rb') as src, open('cplarge.txt', 'wb') as dst:
+            copied = 0
+            while copied < LARGE_FILE_SIZE:
+                n = os.copy_file_range(src.fileno(), dst.fileno(), LARGE_FILE_SIZE - copied)
+                self.assertTrue(n > 0, f'copy_file_range returned {n} after {copied} bytes')
+                copied += n
+        self.assertEqual(os.path.getsize('cplarge.txt'), LARGE_FILE_SIZE)
+        with open('cplarge.txt', 'r') as f:
+            self.assertEqual(f.read(), LARGE_FILE_CONTENT, f'cplarge.txt does not match {LARGE_FILE}')
+        os.remove('cplarge.txt')
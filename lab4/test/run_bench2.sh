@@ -5,22 +5,11 @@ PS4='> $ '
 # cd correct directory
 cd "$(dirname "$0")"
 
-# generate image
-rm -f ./fat16-test-32M.img
-mkfs.fat -C -F 16 -r 512 -R 32 -s 4 -S 512 ./fat16-test-32M.img $((32*1024))
-
-# mount image
-sudo umount ./vfat
-rm -rf ./vfat
-mkdir -p ./vfat
-sudo mount -t vfat \
-    --options "time_offset=480,iocharset=ascii,uid=$(id -u ${USER}),gid=$(id -g ${USER})" \
-    ./fat16-test-32M.img ./vfat
-
-# copy files into image
+# generate image with test files (no mkfs.fat or root needed)
 python3 ./generate_test_files.py
-cp -r ./_test_files/* ./vfat/
-sudo umount ./vfat
+make -C .. fat16_mkfs fat16_bench
+rm -f ./fat16-test-32M.img
+../fat16_mkfs -r 512 -R 32 -s 4 -d ./_test_files ./fat16-test-32M.img $((32*1024))
 
 rm -rf ./fat16
 mkdir -p ./fat16
@@ -28,7 +17,7 @@ mkdir -p ./fat16
 cp ./fat16-test-32M.img ./fat16-tmp.img
 fusermount -zu ./fat16
 ./std/simple_fat16 -s ./fat16 --img="./fat16-test-32M.img" --seek_time=10
-python3 ./fat16_bench.py ./fat16 | tee /tmp/std_time.txt
+../fat16_bench ./fat16 | tee /tmp/std_time.txt
 fusermount -zu ./fat16
 
 cp ./fat16-tmp.img ./fat16-test-32M.img
@@ -1,2 +1,3 @@
 #!/bin/bash
-python3 ./fat16_bench.py ./fat16 | tee /tmp/your_time.txt
+make -C .. fat16_bench
+../fat16_bench ./fat16 | tee /tmp/your_time.txt
@@ -0,0 +1,26 @@
+#!/bin/bash
+# 离线整理测试（不需要 FUSE）：交错追加写出碎片化的镜像，整理后镜像必须一致，每个文件的内容不变
+PS4='> $ '
+set -ex
+
+# cd correct directory
+cd "$(dirname "$0")"
+
+make -C .. fat16_mkfs fat16_fsck fat16_harness fat16_defrag
+
+# 空闲空间多的镜像，以及几乎写满、只能用少量空闲簇腾挪的镜像
+for ops in 6000 16000; do
+    rm -f ./defrag-test.img
+    ../fat16_mkfs -s 1 ./defrag-test.img $((16*1024))
+    ../fat16_harness -n 60 -o $ops -s 1000 -w create,append,meta ./defrag-test.img > /dev/null
+    ../fat16_fsck -c ./defrag-test.img | grep -v ' clusters, ' | sort -k 3 > ./defrag-before.txt
+
+    ../fat16_defrag ./defrag-test.img
+    ../fat16_fsck ./defrag-test.img
+    ../fat16_fsck -c ./defrag-test.img | grep -v ' clusters, ' | sort -k 3 > ./defrag-after.txt
+    diff ./defrag-before.txt ./defrag-after.txt
+
+    # 整理后没有需要移动的簇
+    ../fat16_defrag -n ./defrag-test.img | grep ' 0 clusters would move'
+done
+rm -f ./defrag-test.img ./defrag-before.txt ./defrag-after.txt
@@ -0,0 +1,21 @@
+#!/bin/bash
+# 向量化扫描测试（不需要 FUSE）：每种实现都要与参考实现一致，并且结果摘要相同
+PS4='> $ '
+set -ex -o pipefail
+
+# cd correct directory
+cd "$(dirname "$0")"
+
+make -C .. fat16_simd_test
+
+variants="scalar sse2"
+if grep -qw avx2 /proc/cpuinfo; then
+    variants="$variants avx2"
+fi
+for v in $variants; do
+    FAT16_SIMD=$v ../fat16_simd_test -p 1 | tee ./simd-$v.txt
+done
+for v in $variants; do
+    diff <(sed 's/^[a-z0-9]*: //' ./simd-scalar.txt) <(sed 's/^[a-z0-9]*: //' ./simd-$v.txt)
+done
+rm -f ./simd-*.txt
@@ -0,0 +1,14 @@
+#!/bin/bash
+# ssd 时间模型测试（不需要 FUSE）：fat16_harness -M ssd 先检查跨通道的读等到最慢的通道，再跑一遍负载
+PS4='> $ '
+set -ex
+
+# cd correct directory
+cd "$(dirname "$0")"
+
+make -C .. fat16_mkfs fat16_fsck fat16_harness
+rm -f ./ssd-test.img
+../fat16_mkfs ./ssd-test.img $((32*1024))
+../fat16_harness -M ssd -t 4 -n 40 -o 1000 -w create,append,read ./ssd-test.img
+../fat16_fsck ./ssd-test.img
+rm -f ./ssd-test.img
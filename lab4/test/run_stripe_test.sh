@@ -0,0 +1,20 @@
+#!/bin/bash
+# 条带化逻辑卷测试（不需要 FUSE）：拆分为 3 个成员，在条带化的卷上并发读写，合并后镜像必须一致
+PS4='> $ '
+set -ex
+
+# cd correct directory
+cd "$(dirname "$0")"
+
+make -C .. fat16_mkfs fat16_fsck fat16_harness fat16_stripe
+rm -f ./stripe-test.img ./stripe-test.m0 ./stripe-test.m1 ./stripe-test.m2
+
+../fat16_mkfs -s 4 ./stripe-test.img $((32*1024))
+../fat16_stripe -k 64 ./stripe-test.img ./stripe-test.m0 ./stripe-test.m1 ./stripe-test.m2
+../fat16_harness -S 64 -t 4 -n 60 -o 4000 -w create,append,meta,read \
+    ./stripe-test.m0 ./stripe-test.m1 ./stripe-test.m2 > /dev/null
+rm -f ./stripe-test.img
+../fat16_stripe -j -k 64 ./stripe-test.img ./stripe-test.m0 ./stripe-test.m1 ./stripe-test.m2
+../fat16_fsck ./stripe-test.img
+
+rm -f ./stripe-test.img ./stripe-test.m0 ./stripe-test.m1 ./stripe-test.m2
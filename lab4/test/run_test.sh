@@ -5,22 +5,11 @@ set -x
 # cd correct directory
 cd "$(dirname "$0")"
 
-# generate image
-rm -f ./fat16-test-32M.img
-mkfs.fat -C -F 16 -r 512 -R 32 -s 4 -S 512 ./fat16-test-32M.img $((32*1024))
-
-# mount image
-sudo umount ./vfat
-rm -rf ./vfat
-mkdir -p ./vfat
-sudo mount -t vfat \
-    --options "time_offset=480,iocharset=ascii,uid=$(id -u ${USER}),gid=$(id -g ${USER})" \
-    ./fat16-test-32M.img ./vfat
-
-# copy files into image
+# generate image with test files (no mkfs.fat or root needed)
 python3 ./generate_test_files.py
-cp -r ./_test_files/* ./vfat/
-sudo umount ./vfat
+make -C .. fat16_mkfs
+rm -f ./fat16-test-32M.img
+../fat16_mkfs -r 512 -R 32 -s 4 -d ./_test_files ./fat16-test-32M.img $((32*1024))
 
 # build, mount simple_fat16 and test
 fusermount -zu ./fat16
@@ -30,4 +19,12 @@ make -C .. debug
 ../simple_fat16 -s ./fat16 --img="./fat16-test-32M.img"
 # python3 -m unittest ./fat16_test.py
 python3 -m pytest -x -v ./fat16_test.py
-fusermount -zu ./fat16
\ No newline at end of file
+fusermount -zu ./fat16
+
+# the same tests on a FAT32 image (root directory is a cluster chain)
+rm -f ./fat32-test-64M.img
+../fat16_mkfs -F 32 -s 1 -d ./_test_files ./fat32-test-64M.img $((64*1024))
+../simple_fat16 -s ./fat16 --img="./fat32-test-64M.img"
+python3 -m pytest -x -v ./fat16_test.py
+fusermount -zu ./fat16
+../fat16_fsck ./fat32-test-64M.img